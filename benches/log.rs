@@ -0,0 +1,213 @@
+//! throughput and latency benchmarks for the log subsystem
+//!
+//! Run with `cargo bench --bench log`, optionally followed by a filter which selects the
+//! benchmarks whose names contain it (e.g. `cargo bench --bench log -- contention`). Each
+//! benchmark reports the median and 99th percentile latency of a single operation, and the
+//! overall throughput in events per second.
+
+use std::env;
+use std::hint::black_box;
+use std::io::{self, Write};
+use std::sync::{Arc, Barrier};
+use std::thread;
+use std::time::{Duration, Instant};
+use timberwolf::log::dispatch::OverflowPolicy;
+use timberwolf::log::event::{ConsoleReceiver, Event, Receiver, Severity};
+use timberwolf::log::output::string::{append_event, format_event};
+use timberwolf::log::Log;
+use timberwolf::log_info;
+
+/// the number of operations timed together as one latency sample, to amortize the clock reads
+const BATCH: usize = 64;
+/// the number of latency samples taken per benchmark (or per thread)
+const SAMPLES: usize = 2_000;
+/// the number of samples run and discarded before measuring
+const WARMUP: usize = 200;
+
+/// a receiver which discards every event
+struct NullReceiver;
+impl Receiver for NullReceiver {
+    fn notify(&mut self, event: &Event) {
+        black_box(event);
+    }
+}
+
+/// a stream which discards everything written to it, but still receives every formatted byte
+/// (unlike `std::io::sink`, which may skip the formatting)
+struct NullWriter;
+impl Write for NullWriter {
+    fn write(&mut self, buffer: &[u8]) -> io::Result<usize> {
+        black_box(buffer);
+        Ok(buffer.len())
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        Ok(())
+    }
+}
+
+/// latency samples (in nanoseconds per operation) and the wall time they were collected over
+struct Measurement {
+    samples: Vec<f64>,
+    operations: usize,
+    elapsed: Duration,
+}
+impl Measurement {
+    fn merge(measurements: Vec<Measurement>) -> Measurement {
+        let elapsed = measurements
+            .iter()
+            .map(|measurement| measurement.elapsed)
+            .max()
+            .unwrap_or_default();
+        let operations = measurements
+            .iter()
+            .map(|measurement| measurement.operations)
+            .sum();
+        let samples = measurements
+            .into_iter()
+            .flat_map(|measurement| measurement.samples)
+            .collect();
+        Measurement {
+            samples,
+            operations,
+            elapsed,
+        }
+    }
+
+    fn report(mut self, name: &str) {
+        self.samples
+            .sort_by(|a, b| a.partial_cmp(b).expect("latency is NaN"));
+        let percentile = |p: f64| {
+            let index = ((self.samples.len() - 1) as f64 * p).round() as usize;
+            self.samples[index]
+        };
+        println!(
+            "{:<36} p50 {:>10.1} ns   p99 {:>10.1} ns   {:>14.0} events/s",
+            name,
+            percentile(0.50),
+            percentile(0.99),
+            self.operations as f64 / self.elapsed.as_secs_f64()
+        );
+    }
+}
+
+/// time `operation` in batches on the calling thread
+fn measure(mut operation: impl FnMut()) -> Measurement {
+    for _ in 0..WARMUP * BATCH {
+        operation();
+    }
+    let mut samples = Vec::with_capacity(SAMPLES);
+    let start = Instant::now();
+    for _ in 0..SAMPLES {
+        let batch = Instant::now();
+        for _ in 0..BATCH {
+            operation();
+        }
+        samples.push(batch.elapsed().as_nanos() as f64 / BATCH as f64);
+    }
+    Measurement {
+        samples,
+        operations: SAMPLES * BATCH,
+        elapsed: start.elapsed(),
+    }
+}
+
+/// time `operation` on `threads` threads at once, each started together
+fn measure_contended(threads: usize, operation: impl Fn() + Send + Sync + 'static) -> Measurement {
+    let operation = Arc::new(operation);
+    let barrier = Arc::new(Barrier::new(threads));
+    let handles: Vec<_> = (0..threads)
+        .map(|_| {
+            let operation = operation.clone();
+            let barrier = barrier.clone();
+            thread::spawn(move || {
+                barrier.wait();
+                measure(|| operation())
+            })
+        })
+        .collect();
+    Measurement::merge(
+        handles
+            .into_iter()
+            .map(|handle| handle.join().expect("benchmark thread panicked"))
+            .collect(),
+    )
+}
+
+fn log_with_receivers(count: usize) -> Log {
+    let log = Log::new();
+    for _ in 0..count {
+        log.add_receiver(Box::new(NullReceiver));
+    }
+    log
+}
+
+fn main() {
+    let filter = env::args()
+        .skip(1)
+        .find(|argument| !argument.starts_with("--"));
+    let selected = |name: &str| filter.as_ref().is_none_or(|filter| name.contains(filter));
+    let event = Event::now(Severity::Info, "bench", "a typical log message");
+
+    for &receivers in &[0, 1, 8] {
+        let name = format!("notify/{}_receivers", receivers);
+        if selected(&name) {
+            let log = log_with_receivers(receivers);
+            measure(|| log.notify(black_box(&event))).report(&name);
+        }
+    }
+
+    if selected("log_info/template") {
+        let log = log_with_receivers(1);
+        let mut frame = 0u64;
+        measure(|| {
+            frame += 1;
+            log_info!(log, "bench", "frame {} took {} ms", frame, 16.6);
+        })
+        .report("log_info/template");
+    }
+
+    if selected("format_event/allocate") {
+        measure(|| {
+            black_box(format_event(black_box(&event)));
+        })
+        .report("format_event/allocate");
+    }
+
+    if selected("format_event/reuse") {
+        let mut buffer = Vec::with_capacity(256);
+        measure(|| {
+            buffer.clear();
+            append_event(&mut buffer, black_box(&event));
+        })
+        .report("format_event/reuse");
+    }
+
+    if selected("console/null_sink") {
+        let mut console = ConsoleReceiver::with_sinks(Box::new(NullWriter), Box::new(NullWriter));
+        measure(|| console.notify(black_box(&event))).report("console/null_sink");
+    }
+
+    for &threads in &[2, 4, 8, 16] {
+        let name = format!("contention/sync/{}_threads", threads);
+        if selected(&name) {
+            let log = Arc::new(log_with_receivers(1));
+            measure_contended(threads, move || log.info("bench", "a typical log message"))
+                .report(&name);
+        }
+
+        let name = format!("contention/async/{}_threads", threads);
+        if selected(&name) {
+            let log = Arc::new(Log::new_async(1 << 16, OverflowPolicy::DropNewest));
+            log.add_receiver(Box::new(NullReceiver));
+            let measurement = measure_contended(threads, {
+                let log = log.clone();
+                move || log.info("bench", "a typical log message")
+            });
+            measurement.report(&name);
+            if log.dropped_events() > 0 {
+                println!("{:<36} {} events dropped", "", log.dropped_events());
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+//! frame pacing benchmarks for the RevLimiter wait strategies
+//!
+//! Run with `cargo bench --bench timing`, optionally followed by a filter which selects the
+//! benchmarks whose names contain it (e.g. `cargo bench --bench timing -- hybrid`). Each benchmark
+//! runs an empty loop at a fixed frequency for two seconds and reports the distribution of how far
+//! each achieved interval missed its target, along with the lag the loop accumulated.
+
+use std::env;
+use std::time::{Duration, Instant};
+use timberwolf::event::timing::{RevLimiterBuilder, WaitStrategy};
+
+/// how long each benchmark runs its loop for
+const RUN_TIME: Duration = Duration::from_secs(2);
+
+fn run(name: &str, frequency: f64, wait_strategy: WaitStrategy) {
+    let mut rev_limiter = RevLimiterBuilder::new_from_frequency(frequency)
+        .enable_catchup()
+        .with_wait_strategy(wait_strategy)
+        .build();
+    let target = rev_limiter.interval.as_secs_f64() * 1_000_000.0;
+    let iterations = (RUN_TIME.as_secs_f64() * frequency) as usize;
+    let mut errors = Vec::with_capacity(iterations);
+    rev_limiter.begin();
+    let mut last = Instant::now();
+    for _ in 0..iterations {
+        rev_limiter.wait();
+        rev_limiter.begin();
+        let now = Instant::now();
+        errors.push((now - last).as_secs_f64() * 1_000_000.0 - target);
+        last = now;
+    }
+    errors.sort_by(|a, b| a.partial_cmp(b).expect("interval is NaN"));
+    let percentile = |p: f64| errors[((errors.len() - 1) as f64 * p).round() as usize];
+    println!(
+        "{:<20} error p50 {:>8.1} us   p99 {:>8.1} us   max {:>8.1} us   lag {:>8.1} us",
+        name,
+        percentile(0.50),
+        percentile(0.99),
+        errors[errors.len() - 1],
+        rev_limiter.lag.as_secs_f64() * 1_000_000.0
+    );
+}
+
+fn main() {
+    let filter = env::args()
+        .skip(1)
+        .find(|argument| !argument.starts_with("--"));
+    for &frequency in &[60.0, 144.0, 240.0] {
+        for &(strategy_name, wait_strategy) in &[
+            ("sleep", WaitStrategy::Sleep),
+            ("hybrid", WaitStrategy::Hybrid),
+            ("spin", WaitStrategy::Spin),
+        ] {
+            let name = format!("{}/{}_hz", strategy_name, frequency);
+            if filter.as_ref().is_none_or(|filter| name.contains(filter)) {
+                run(&name, frequency, wait_strategy);
+            }
+        }
+    }
+}
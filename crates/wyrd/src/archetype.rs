@@ -0,0 +1,246 @@
+//! archetype tables: every entity with the same set of component types is stored in the same
+//! archetype, with one dense column per component type
+
+use crate::Entity;
+use std::any::{Any, TypeId};
+use std::cell::UnsafeCell;
+use std::collections::HashMap;
+
+/// a type which can be stored as a component of an entity
+pub trait Component: Send + Sync + 'static {}
+impl<T: Send + Sync + 'static> Component for T {}
+
+/// a type-erased column of components of a single type
+pub(crate) trait Column: Send + Sync {
+    fn as_any(&self) -> &dyn Any;
+    fn as_any_mut(&mut self) -> &mut dyn Any;
+    fn len(&self) -> usize;
+    fn reserve(&mut self, additional: usize);
+    /// push a boxed component, which must be of the column's type
+    fn push_boxed(&mut self, component: Box<dyn Any + Send + Sync>);
+    /// remove the component in a row, replacing it with the last row, and dropping it
+    fn swap_remove(&mut self, row: usize);
+    /// remove the component in a row, replacing it with the last row, and push it onto another
+    /// column of the same type
+    fn swap_remove_into(&mut self, row: usize, to: &mut dyn Column);
+}
+impl<T: Component> Column for Vec<T> {
+    fn as_any(&self) -> &dyn Any {
+        self
+    }
+
+    fn as_any_mut(&mut self) -> &mut dyn Any {
+        self
+    }
+
+    fn len(&self) -> usize {
+        Vec::len(self)
+    }
+
+    fn reserve(&mut self, additional: usize) {
+        Vec::reserve(self, additional);
+    }
+
+    fn push_boxed(&mut self, component: Box<dyn Any + Send + Sync>) {
+        let component: Box<dyn Any> = component;
+        match component.downcast::<T>() {
+            Ok(component) => self.push(*component),
+            Err(_) => panic!("component pushed onto a column of another type"),
+        }
+    }
+
+    fn swap_remove(&mut self, row: usize) {
+        Vec::swap_remove(self, row);
+    }
+
+    fn swap_remove_into(&mut self, row: usize, to: &mut dyn Column) {
+        let component = Vec::swap_remove(self, row);
+        to.as_any_mut()
+            .downcast_mut::<Vec<T>>()
+            .expect("component moved onto a column of another type")
+            .push(component);
+    }
+}
+
+/// creates an empty column for a component type
+pub(crate) type ColumnFactory = fn() -> Box<dyn Column>;
+
+pub(crate) fn new_column<T: Component>() -> Box<dyn Column> {
+    Box::new(Vec::<T>::new())
+}
+
+/// a column which systems running in parallel can borrow through a shared reference to the Wyrd
+pub(crate) struct ColumnCell(UnsafeCell<Box<dyn Column>>);
+
+// SAFETY: a column is only borrowed mutably through a shared reference by systems whose access
+// the scheduler has checked does not conflict with any other system running at the same time
+unsafe impl Sync for ColumnCell {}
+
+/// the entities which have exactly the same set of component types, and their components
+pub struct Archetype {
+    /// the component types, sorted
+    types: Box<[TypeId]>,
+    /// one column per component type, in the same order as the types
+    columns: Box<[ColumnCell]>,
+    /// the entity in each row
+    entities: Vec<Entity>,
+    /// the archetypes reached by adding a component type
+    pub(crate) add_edges: HashMap<TypeId, usize>,
+    /// the archetypes reached by removing a component type
+    pub(crate) remove_edges: HashMap<TypeId, usize>,
+}
+impl Archetype {
+    pub(crate) fn new(types: Box<[TypeId]>, columns: Box<[Box<dyn Column>]>) -> Self {
+        Self {
+            types,
+            columns: columns
+                .into_vec()
+                .into_iter()
+                .map(|column| ColumnCell(UnsafeCell::new(column)))
+                .collect(),
+            entities: Vec::new(),
+            add_edges: HashMap::new(),
+            remove_edges: HashMap::new(),
+        }
+    }
+
+    /// the component types of the archetype's entities, sorted
+    pub fn types(&self) -> &[TypeId] {
+        &self.types
+    }
+
+    /// the entities in the archetype, in row order
+    pub fn entities(&self) -> &[Entity] {
+        &self.entities
+    }
+
+    /// the number of entities in the archetype
+    pub fn len(&self) -> usize {
+        self.entities.len()
+    }
+
+    /// whether the archetype has no entities
+    pub fn is_empty(&self) -> bool {
+        self.entities.is_empty()
+    }
+
+    /// whether the archetype's entities have a component type
+    pub fn has(&self, type_id: TypeId) -> bool {
+        self.column_index(type_id).is_some()
+    }
+
+    fn column_index(&self, type_id: TypeId) -> Option<usize> {
+        self.types.binary_search(&type_id).ok()
+    }
+
+    fn cell(&self, type_id: TypeId) -> Option<&UnsafeCell<Box<dyn Column>>> {
+        Some(&self.columns[self.column_index(type_id)?].0)
+    }
+
+    fn cell_mut(&mut self, type_id: TypeId) -> Option<&mut Box<dyn Column>> {
+        let index = self.column_index(type_id)?;
+        Some(self.columns[index].0.get_mut())
+    }
+
+    /// the components of a type, in row order
+    pub fn column<T: Component>(&self) -> Option<&[T]> {
+        // SAFETY: the archetype is borrowed immutably, so only the scheduler's systems can be
+        // writing to a column, and none of those can overlap with a shared borrow from outside
+        unsafe { self.column_unchecked::<T>() }.map(Vec::as_slice)
+    }
+
+    /// the components of a type, in row order, mutably
+    pub fn column_mut<T: Component>(&mut self) -> Option<&mut [T]> {
+        self.column_vec_mut::<T>().map(Vec::as_mut_slice)
+    }
+
+    pub(crate) fn column_vec_mut<T: Component>(&mut self) -> Option<&mut Vec<T>> {
+        self.cell_mut(TypeId::of::<T>())?
+            .as_any_mut()
+            .downcast_mut::<Vec<T>>()
+    }
+
+    /// borrow the components of a type through a shared reference
+    ///
+    /// # Safety
+    /// The column must not be borrowed mutably for as long as the returned reference lives.
+    pub(crate) unsafe fn column_unchecked<T: Component>(&self) -> Option<&Vec<T>> {
+        (*self.cell(TypeId::of::<T>())?.get())
+            .as_any()
+            .downcast_ref::<Vec<T>>()
+    }
+
+    /// borrow the components of a type mutably through a shared reference
+    ///
+    /// # Safety
+    /// The column must not be borrowed at all for as long as the returned reference lives.
+    #[allow(clippy::mut_from_ref)]
+    pub(crate) unsafe fn column_unchecked_mut<T: Component>(&self) -> Option<&mut Vec<T>> {
+        (*self.cell(TypeId::of::<T>())?.get())
+            .as_any_mut()
+            .downcast_mut::<Vec<T>>()
+    }
+
+    /// reserve space for at least `additional` more entities
+    pub(crate) fn reserve(&mut self, additional: usize) {
+        self.entities.reserve(additional);
+        for column in self.columns.iter_mut() {
+            column.0.get_mut().reserve(additional);
+        }
+    }
+
+    /// add an entity with a boxed component for each of the archetype's types, returning its row
+    pub(crate) fn push(
+        &mut self,
+        entity: Entity,
+        components: impl Iterator<Item = (TypeId, Box<dyn Any + Send + Sync>)>,
+    ) -> usize {
+        for (type_id, component) in components {
+            let index = self
+                .column_index(type_id)
+                .expect("component type is not in the archetype");
+            self.columns[index].0.get_mut().push_boxed(component);
+        }
+        self.entities.push(entity);
+        let len = self.entities.len();
+        debug_assert!(self
+            .columns
+            .iter_mut()
+            .all(|column| column.0.get_mut().len() == len));
+        self.entities.len() - 1
+    }
+
+    /// remove an entity's row, dropping its components, and return the entity moved into the row
+    /// (if any)
+    pub(crate) fn swap_remove(&mut self, row: usize) -> Option<Entity> {
+        for column in self.columns.iter_mut() {
+            column.0.get_mut().swap_remove(row);
+        }
+        self.entities.swap_remove(row);
+        self.entities.get(row).copied()
+    }
+
+    /// move an entity's row to another archetype, moving the components of the types they share
+    /// and dropping the rest (except `skip`, whose column the caller has already removed the row
+    /// from), and return the entity moved into the row (if any)
+    pub(crate) fn move_row(
+        &mut self,
+        row: usize,
+        to: &mut Archetype,
+        skip: Option<TypeId>,
+    ) -> Option<Entity> {
+        for (type_id, column) in self.types.iter().zip(self.columns.iter_mut()) {
+            if Some(*type_id) == skip {
+                continue;
+            }
+            let column = column.0.get_mut();
+            match to.cell_mut(*type_id) {
+                Some(to) => column.swap_remove_into(row, &mut **to),
+                None => column.swap_remove(row),
+            }
+        }
+        let entity = self.entities.swap_remove(row);
+        to.entities.push(entity);
+        self.entities.get(row).copied()
+    }
+}
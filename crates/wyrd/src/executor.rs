@@ -0,0 +1,172 @@
+//! executors, which run the tasks a schedule splits its systems into on a fixed set of threads
+//!
+//! A schedule hands each batch of systems (and each parallel system's chunks) to its executor as a
+//! group of tasks, and waits for them all to finish. Tasks may start groups of their own, so an
+//! executor should run queued tasks on a waiting thread rather than block it (blocking only once
+//! the rest of its group is running elsewhere), which keeps the number of busy threads within the
+//! executor's limit. Any fork-join pool which helps while it
+//! waits (such as timberwolf's `JobPool::scope`) can be used by implementing `Executor` for it.
+
+use std::any::Any;
+use std::collections::VecDeque;
+use std::mem::transmute;
+use std::panic::{catch_unwind, resume_unwind, AssertUnwindSafe};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread::{Builder, JoinHandle};
+
+/// a unit of work run by an executor, which may borrow from the caller of `run_all`
+pub type Task<'a> = Box<dyn FnOnce() + Send + 'a>;
+
+/// something which runs groups of tasks in parallel
+pub trait Executor: Send + Sync {
+    /// the most threads the executor runs tasks on at once (including a thread waiting in
+    /// `run_all`)
+    fn threads(&self) -> usize;
+
+    /// run every task, possibly in parallel, and return once they have all finished (re-raising
+    /// the first panic from a task)
+    fn run_all(&self, tasks: Vec<Task<'_>>);
+}
+
+/// the tasks of a group which are yet to finish
+#[derive(Default)]
+struct Group {
+    pending: AtomicUsize,
+    panic: Mutex<Option<Box<dyn Any + Send>>>,
+    /// locked to signal `finished` once `pending` reaches zero
+    finishing: Mutex<()>,
+    /// signalled when the last task of the group finishes
+    finished: Condvar,
+}
+impl Group {
+    /// mark a task as finished, waking the thread waiting for the group if it was the last
+    fn finish(&self) {
+        if self.pending.fetch_sub(1, Ordering::AcqRel) == 1 {
+            let _finishing = self.finishing.lock().expect("task group is poisoned");
+            self.finished.notify_all();
+        }
+    }
+
+    /// block until every task in the group has finished
+    fn wait(&self) {
+        let mut finishing = self.finishing.lock().expect("task group is poisoned");
+        while self.pending.load(Ordering::Acquire) > 0 {
+            finishing = self
+                .finished
+                .wait(finishing)
+                .expect("task group is poisoned");
+        }
+    }
+}
+
+/// state shared between a thread pool and its workers
+#[derive(Default)]
+struct Shared {
+    /// the queued tasks, and whether the pool is shutting down
+    queue: Mutex<(VecDeque<Task<'static>>, bool)>,
+    available: Condvar,
+}
+impl Shared {
+    fn pop(&self) -> Option<Task<'static>> {
+        self.queue
+            .lock()
+            .expect("task queue is poisoned")
+            .0
+            .pop_front()
+    }
+
+    fn work(&self) {
+        let mut queue = self.queue.lock().expect("task queue is poisoned");
+        loop {
+            if let Some(task) = queue.0.pop_front() {
+                drop(queue);
+                task();
+                queue = self.queue.lock().expect("task queue is poisoned");
+            } else if queue.1 {
+                return;
+            } else {
+                queue = self.available.wait(queue).expect("task queue is poisoned");
+            }
+        }
+    }
+}
+
+/// a pool of persistent worker threads, where the thread calling `run_all` runs tasks alongside
+/// the workers until its group has finished
+pub struct ThreadPool {
+    shared: Arc<Shared>,
+    workers: Vec<JoinHandle<()>>,
+}
+impl ThreadPool {
+    /// create a pool which runs tasks on up to `threads` threads (starting one fewer workers, as
+    /// the calling thread also runs tasks)
+    pub fn new(threads: usize) -> Self {
+        let shared = Arc::new(Shared::default());
+        let workers = (1..threads.max(1))
+            .map(|index| {
+                let shared = shared.clone();
+                Builder::new()
+                    .name(format!("wyrd-worker-{}", index))
+                    .spawn(move || shared.work())
+                    .expect("failed to spawn a wyrd worker")
+            })
+            .collect();
+        Self { shared, workers }
+    }
+}
+impl Executor for ThreadPool {
+    fn threads(&self) -> usize {
+        self.workers.len() + 1
+    }
+
+    fn run_all(&self, tasks: Vec<Task<'_>>) {
+        if tasks.len() <= 1 || self.workers.is_empty() {
+            return tasks.into_iter().for_each(|task| task());
+        }
+        let group = Arc::new(Group::default());
+        group.pending.store(tasks.len(), Ordering::Relaxed);
+        {
+            let mut queue = self.shared.queue.lock().expect("task queue is poisoned");
+            for task in tasks {
+                let group = group.clone();
+                let task: Task<'_> = Box::new(move || {
+                    if let Err(payload) = catch_unwind(AssertUnwindSafe(task)) {
+                        group
+                            .panic
+                            .lock()
+                            .expect("task group is poisoned")
+                            .get_or_insert(payload);
+                    }
+                    group.finish();
+                });
+                // SAFETY: this waits for every task in the group to finish before it returns, so
+                // nothing a task borrows can be dropped while it is queued or running
+                queue
+                    .0
+                    .push_back(unsafe { transmute::<Task<'_>, Task<'static>>(task) });
+            }
+        }
+        self.shared.available.notify_all();
+        // help with queued tasks, then sleep once the rest of the group is running elsewhere
+        while group.pending.load(Ordering::Acquire) > 0 {
+            match self.shared.pop() {
+                Some(task) => task(),
+                None => group.wait(),
+            }
+        }
+        let panic = group.panic.lock().expect("task group is poisoned").take();
+        if let Some(payload) = panic {
+            resume_unwind(payload);
+        }
+    }
+}
+impl Drop for ThreadPool {
+    fn drop(&mut self) {
+        self.shared.queue.lock().expect("task queue is poisoned").1 = true;
+        self.shared.available.notify_all();
+        for worker in self.workers.drain(..) {
+            let _ = worker.join();
+        }
+    }
+}
@@ -1,54 +1,491 @@
 //! An Entity Component System Library
+//!
+//! Entities with the same set of component types are stored together in an archetype, which keeps
+//! each component type in a dense column, so iterating over the entities of an archetype streams
+//! through contiguous memory. Adding or removing a component moves an entity to the archetype for
+//! its new set of component types. Systems visit entities through typed queries (see `Query`), and
+//! a `Schedule` runs systems whose component accesses do not conflict in parallel.
+//!
+//! Component types which are added and removed often can be registered with sparse set storage
+//! instead (see `StorageType`), which keeps them out of the archetypes.
 
+mod archetype;
+mod executor;
+mod query;
+mod schedule;
+mod sparse;
+
+#[cfg(test)]
+mod test;
+
+pub use archetype::{Archetype, Component};
+pub use executor::{Executor, Task, ThreadPool};
+pub use query::{Access, Query, QueryFilter, QueryIter, QueryParam, With, Without};
+pub use schedule::{QuerySystem, Schedule, System};
+pub use sparse::{SparseSet, StorageType};
+
+use archetype::{new_column, ColumnFactory};
+use sparse::SparseStorage;
 use std::any::{Any, TypeId};
 use std::collections::HashMap;
+use std::convert::TryFrom;
+use std::sync::atomic::{AtomicU64, Ordering};
 
-#[derive(Default)]
-pub struct Wyrd {
-    component_storages: ComponentStorageMap,
-    entity_meta: Vec<EntityMeta>,
+/// the source of unique Wyrd ids, so a query can tell which Wyrd its archetypes belong to
+static NEXT_WYRD_ID: AtomicU64 = AtomicU64::new(1);
+
+/// identifies an entity in a Wyrd: the index of its slot, and the generation of the slot when the
+/// entity was spawned, so a handle to a despawned entity never refers to the entity which reuses
+/// its slot
+#[derive(Clone, Copy, Debug, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub struct Entity {
+    index: u32,
+    generation: u32,
+}
+impl Entity {
+    /// the index of the entity's slot in its Wyrd
+    pub fn index(self) -> usize {
+        self.index as usize
+    }
+
+    /// the number of times the entity's slot had been reused when the entity was spawned
+    pub fn generation(self) -> u32 {
+        self.generation
+    }
 }
 
-pub enum EntityMeta {
-    Empty,
-    Active,
+/// where the entity in a slot stores its components, or the next free slot
+enum EntityMeta {
+    Free { next: Option<u32> },
+    Active { archetype: usize, row: usize },
 }
 
-pub type ComponentStorageMap = HashMap<TypeId, *mut ()>;
-pub type ComponentStorage<T> = Vec<Option<T>>;
+/// an entity slot, which is reused once its entity is despawned
+struct EntitySlot {
+    generation: u32,
+    meta: EntityMeta,
+}
+
+pub struct Wyrd {
+    id: u64,
+    /// how to create a column for each component type with table storage
+    component_types: HashMap<TypeId, ColumnFactory>,
+    /// the sparse set of each component type with sparse set storage
+    sparse_sets: HashMap<TypeId, Box<dyn SparseStorage>>,
+    /// every archetype, starting with the archetype of entities without components
+    archetypes: Vec<Archetype>,
+    /// the index of the archetype for each sorted set of component types
+    archetype_indices: HashMap<Box<[TypeId]>, usize>,
+    entity_slots: Vec<EntitySlot>,
+    /// the first free slot, whose meta links to the next
+    free: Option<u32>,
+    /// the number of active entities
+    len: usize,
+}
+
+impl Default for Wyrd {
+    fn default() -> Self {
+        let mut archetype_indices = HashMap::new();
+        archetype_indices.insert(Box::default(), 0);
+        Self {
+            id: NEXT_WYRD_ID.fetch_add(1, Ordering::Relaxed),
+            component_types: HashMap::new(),
+            sparse_sets: HashMap::new(),
+            archetypes: vec![Archetype::new(Box::default(), Box::default())],
+            archetype_indices,
+            entity_slots: Vec::new(),
+            free: None,
+            len: 0,
+        }
+    }
+}
 
 impl Wyrd {
-    pub fn register_component_type<T: 'static>(&mut self) {
-        let mut data: ComponentStorage<T> = ComponentStorage::default();
-        self.component_storages
-            .insert(TypeId::of::<T>(), data.as_mut_ptr().cast::<()>());
-    }
-
-    // pub fn spawn_entity(&self, entity: BuiltEntity) {
-    //     for (type_id, component) in entity.builder.components.iter() {
-    //         if let Some(storage) = self.component_storages.get(type_id) {
-    //             let real_storage = unsafe { storage.cast::<ComponentStorage<type_id>>()}
-    //         }
-    //     }
-    // }
-
-    pub fn run_system(&self, system: fn(Entity)) {
-        for (i, meta) in self.entity_meta.iter().enumerate() {
-            if let EntityMeta::Active = meta {
-                system(Entity::new(&self.component_storages, i))
+    pub fn new() -> Self {
+        Default::default()
+    }
+
+    /// choose how the components of a type are stored (component types which are not registered
+    /// use table storage), panicking if the type is already registered with another storage type
+    pub fn register_component_type<T: Component>(&mut self, storage: StorageType) {
+        let type_id = TypeId::of::<T>();
+        let registered = match storage {
+            StorageType::Table => !self.sparse_sets.contains_key(&type_id),
+            StorageType::SparseSet => !self.component_types.contains_key(&type_id),
+        };
+        if !registered {
+            panic!(
+                "{} is already registered with another storage type",
+                std::any::type_name::<T>()
+            );
+        }
+        match storage {
+            StorageType::Table => {
+                self.component_types
+                    .entry(type_id)
+                    .or_insert(new_column::<T>);
+            }
+            StorageType::SparseSet => {
+                self.sparse_sets
+                    .entry(type_id)
+                    .or_insert_with(|| Box::new(SparseSet::<T>::default()));
+            }
+        }
+    }
+
+    /// whether a component type is registered with sparse set storage
+    pub(crate) fn is_sparse(&self, type_id: TypeId) -> bool {
+        !self.sparse_sets.is_empty() && self.sparse_sets.contains_key(&type_id)
+    }
+
+    /// the sparse set of a component type registered with sparse set storage
+    pub fn sparse_set<T: Component>(&self) -> Option<&SparseSet<T>> {
+        self.sparse_sets
+            .get(&TypeId::of::<T>())?
+            .as_any()
+            .downcast_ref()
+    }
+
+    /// the sparse set of a component type registered with sparse set storage, mutably
+    pub fn sparse_set_mut<T: Component>(&mut self) -> Option<&mut SparseSet<T>> {
+        self.sparse_sets
+            .get_mut(&TypeId::of::<T>())?
+            .as_any_mut()
+            .downcast_mut()
+    }
+
+    pub(crate) fn id(&self) -> u64 {
+        self.id
+    }
+
+    /// the number of entities
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// whether there are no entities
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// every archetype, including empty ones
+    pub fn archetypes(&self) -> &[Archetype] {
+        &self.archetypes
+    }
+
+    /// the index of the archetype for a sorted set of component types, creating it if needed
+    fn archetype_for(&mut self, types: &[TypeId]) -> usize {
+        if let Some(&index) = self.archetype_indices.get(types) {
+            return index;
+        }
+        let columns = types
+            .iter()
+            .map(|type_id| {
+                let factory = self
+                    .component_types
+                    .get(type_id)
+                    .expect("component type is not registered");
+                factory()
+            })
+            .collect();
+        let types: Box<[TypeId]> = types.into();
+        self.archetypes.push(Archetype::new(types.clone(), columns));
+        self.archetype_indices
+            .insert(types, self.archetypes.len() - 1);
+        self.archetypes.len() - 1
+    }
+
+    /// the archetype reached by adding a component type to (or removing it from) another
+    fn archetype_edge(&mut self, from: usize, type_id: TypeId, add: bool) -> usize {
+        let edges = match add {
+            true => &self.archetypes[from].add_edges,
+            false => &self.archetypes[from].remove_edges,
+        };
+        if let Some(&index) = edges.get(&type_id) {
+            return index;
+        }
+        let mut types = self.archetypes[from].types().to_vec();
+        match add {
+            true => {
+                types.push(type_id);
+                types.sort();
+            }
+            false => types.retain(|&other| other != type_id),
+        }
+        let index = self.archetype_for(&types);
+        match add {
+            true => self.archetypes[from].add_edges.insert(type_id, index),
+            false => self.archetypes[from].remove_edges.insert(type_id, index),
+        };
+        index
+    }
+
+    fn location(&self, entity: Entity) -> Option<(usize, usize)> {
+        match self.entity_slots.get(entity.index()) {
+            Some(&EntitySlot {
+                generation,
+                meta: EntityMeta::Active { archetype, row },
+            }) if generation == entity.generation => Some((archetype, row)),
+            _ => None,
+        }
+    }
+
+    fn set_row(&mut self, entity: Option<Entity>, archetype: usize, row: usize) {
+        if let Some(entity) = entity {
+            self.entity_slots[entity.index()].meta = EntityMeta::Active { archetype, row };
+        }
+    }
+
+    /// reserve space for at least `additional` more entity slots, on top of any free ones
+    pub fn reserve_entities(&mut self, additional: usize) {
+        self.entity_slots.reserve(additional);
+    }
+
+    /// take a free slot (or a new one) for an entity whose components are stored in a row
+    fn allocate(&mut self, archetype: usize, row: usize) -> Entity {
+        self.len += 1;
+        let meta = EntityMeta::Active { archetype, row };
+        if let Some(index) = self.free {
+            let slot = &mut self.entity_slots[index as usize];
+            self.free = match slot.meta {
+                EntityMeta::Free { next } => next,
+                EntityMeta::Active { .. } => unreachable!("free entity slot is active"),
             };
+            slot.meta = meta;
+            return Entity {
+                index,
+                generation: slot.generation,
+            };
+        }
+        let index = u32::try_from(self.entity_slots.len()).expect("too many entity slots");
+        self.entity_slots.push(EntitySlot {
+            generation: 0,
+            meta,
+        });
+        Entity {
+            index,
+            generation: 0,
+        }
+    }
+
+    /// add an entity with the components of a built entity
+    pub fn spawn_entity(&mut self, entity: BuiltEntity) -> Entity {
+        let entity = self.sort_entity(entity);
+        self.spawn(entity)
+    }
+
+    /// add an entity for each built entity, reserving space for them up front, and return them in
+    /// order
+    pub fn spawn_entities(
+        &mut self,
+        entities: impl IntoIterator<Item = BuiltEntity>,
+    ) -> Vec<Entity> {
+        let entities: Vec<SortedEntity> = entities
+            .into_iter()
+            .map(|entity| self.sort_entity(entity))
+            .collect();
+        // count the rows the batch adds to each archetype, so each is reserved exactly once
+        let mut rows = vec![0; self.archetypes.len()];
+        for entity in entities.iter() {
+            rows[entity.archetype] += 1;
+        }
+        for (archetype, rows) in self.archetypes.iter_mut().zip(rows) {
+            if rows > 0 {
+                archetype.reserve(rows);
+            }
+        }
+        self.reserve_entities(entities.len());
+        entities
+            .into_iter()
+            .map(|entity| self.spawn(entity))
+            .collect()
+    }
+
+    /// find (or create) the archetype for a built entity's components, and set aside those
+    /// stored in sparse sets
+    fn sort_entity(&mut self, entity: BuiltEntity) -> SortedEntity {
+        let mut components = entity.builder.components;
+        // the last component added of each type wins
+        components.reverse();
+        components.sort_by_key(|component| component.0);
+        components.dedup_by_key(|component| component.0);
+        let sparse_sets = &self.sparse_sets;
+        let (sparse, components): (Vec<_>, Vec<_>) = components
+            .into_iter()
+            .partition(|component| sparse_sets.contains_key(&component.0));
+        for &(type_id, _, factory) in components.iter() {
+            self.component_types.entry(type_id).or_insert(factory);
+        }
+        let types: Vec<TypeId> = components.iter().map(|component| component.0).collect();
+        SortedEntity {
+            archetype: self.archetype_for(&types),
+            components,
+            sparse,
+        }
+    }
+
+    /// add an entity whose components have been sorted into its archetype and sparse sets
+    fn spawn(&mut self, entity: SortedEntity) -> Entity {
+        let SortedEntity {
+            archetype,
+            components,
+            sparse,
+        } = entity;
+        let row = self.archetypes[archetype].len();
+        let entity = self.allocate(archetype, row);
+        self.archetypes[archetype].push(
+            entity,
+            components
+                .into_iter()
+                .map(|(type_id, component, _)| (type_id, component)),
+        );
+        for (type_id, component, _) in sparse {
+            self.sparse_sets
+                .get_mut(&type_id)
+                .expect("component type is not sparse")
+                .insert_boxed(entity, component);
+        }
+        entity
+    }
+
+    /// remove an entity and drop its components, returning whether it existed
+    pub fn despawn_entity(&mut self, entity: Entity) -> bool {
+        let (archetype, row) = match self.location(entity) {
+            Some(location) => location,
+            None => return false,
+        };
+        let moved = self.archetypes[archetype].swap_remove(row);
+        self.set_row(moved, archetype, row);
+        for sparse_set in self.sparse_sets.values_mut() {
+            sparse_set.remove_entity(entity);
+        }
+        let slot = &mut self.entity_slots[entity.index()];
+        slot.meta = EntityMeta::Free { next: None };
+        self.len -= 1;
+        // a slot whose generations have run out is retired, so stale handles can never match it
+        if let Some(generation) = slot.generation.checked_add(1) {
+            slot.generation = generation;
+            slot.meta = EntityMeta::Free { next: self.free };
+            self.free = Some(entity.index);
+        }
+        true
+    }
+
+    /// remove every entity in a batch and drop their components, returning how many existed
+    pub fn despawn_entities(&mut self, entities: &[Entity]) -> usize {
+        entities
+            .iter()
+            .filter(|&&entity| self.despawn_entity(entity))
+            .count()
+    }
+
+    /// whether an entity exists
+    pub fn contains(&self, entity: Entity) -> bool {
+        self.location(entity).is_some()
+    }
+
+    /// add a component to an entity (moving it to another archetype, unless the component type
+    /// has sparse set storage), or replace the component if the entity already has one of the same
+    /// type, returning whether the entity exists
+    pub fn add_component<T: Component>(&mut self, entity: Entity, component: T) -> bool {
+        let (from, row) = match self.location(entity) {
+            Some(location) => location,
+            None => return false,
+        };
+        if let Some(sparse_set) = self.sparse_set_mut::<T>() {
+            sparse_set.insert(entity, component);
+            return true;
+        }
+        if let Some(column) = self.archetypes[from].column_mut::<T>() {
+            column[row] = component;
+            return true;
+        }
+        self.register_component_type::<T>(StorageType::Table);
+        let to = self.archetype_edge(from, TypeId::of::<T>(), true);
+        let (source, target) = pair_mut(&mut self.archetypes, from, to);
+        let moved = source.move_row(row, target, None);
+        target
+            .column_vec_mut::<T>()
+            .expect("component type is not in the archetype")
+            .push(component);
+        let new_row = target.len() - 1;
+        self.set_row(moved, from, row);
+        self.set_row(Some(entity), to, new_row);
+        true
+    }
+
+    /// remove a component from an entity (moving it to another archetype, unless the component
+    /// type has sparse set storage), returning the component if the entity had one
+    pub fn remove_component<T: Component>(&mut self, entity: Entity) -> Option<T> {
+        if let Some(sparse_set) = self.sparse_set_mut::<T>() {
+            return sparse_set.remove(entity);
+        }
+        let (from, row) = self.location(entity)?;
+        if !self.archetypes[from].has(TypeId::of::<T>()) {
+            return None;
+        }
+        let to = self.archetype_edge(from, TypeId::of::<T>(), false);
+        let (source, target) = pair_mut(&mut self.archetypes, from, to);
+        let component = source
+            .column_vec_mut::<T>()
+            .expect("component type is not in the archetype")
+            .swap_remove(row);
+        let moved = source.move_row(row, target, Some(TypeId::of::<T>()));
+        let new_row = target.len() - 1;
+        self.set_row(moved, from, row);
+        self.set_row(Some(entity), to, new_row);
+        Some(component)
+    }
+
+    /// an entity's component of a type, if it has one
+    pub fn get_component<T: Component>(&self, entity: Entity) -> Option<&T> {
+        if let Some(sparse_set) = self.sparse_set::<T>() {
+            return sparse_set.get(entity);
+        }
+        let (archetype, row) = self.location(entity)?;
+        self.archetypes[archetype].column::<T>()?.get(row)
+    }
+
+    /// an entity's component of a type, mutably, if it has one
+    pub fn get_component_mut<T: Component>(&mut self, entity: Entity) -> Option<&mut T> {
+        if self.sparse_sets.contains_key(&TypeId::of::<T>()) {
+            return self.sparse_set_mut::<T>()?.get_mut(entity);
+        }
+        let (archetype, row) = self.location(entity)?;
+        self.archetypes[archetype].column_mut::<T>()?.get_mut(row)
+    }
+
+    /// run a system once per entity, archetype by archetype
+    pub fn run_system(&self, system: fn(EntityRef)) {
+        for archetype in self.archetypes.iter() {
+            for (row, &entity) in archetype.entities().iter().enumerate() {
+                system(EntityRef::new(self, archetype, entity, row))
+            }
         }
     }
 }
 
+/// mutably borrow two different elements of a slice
+fn pair_mut<T>(items: &mut [T], first: usize, second: usize) -> (&mut T, &mut T) {
+    assert_ne!(first, second, "cannot borrow an element twice");
+    if first < second {
+        let (head, tail) = items.split_at_mut(second);
+        (&mut head[first], &mut tail[0])
+    } else {
+        let (head, tail) = items.split_at_mut(first);
+        (&mut tail[0], &mut head[second])
+    }
+}
+
 #[derive(Default)]
 pub struct EntityBuilder {
-    pub(crate) components: HashMap<TypeId, Box<dyn Any>>,
+    pub(crate) components: Vec<(TypeId, Box<dyn Any + Send + Sync>, ColumnFactory)>,
 }
 
 impl EntityBuilder {
-    pub fn add_component<T: 'static>(&mut self, component: Box<T>) -> &mut Self {
-        self.components.insert(TypeId::of::<T>(), component);
+    pub fn add_component<T: Component>(&mut self, component: Box<T>) -> &mut Self {
+        self.components
+            .push((TypeId::of::<T>(), component, new_column::<T>));
         self
     }
 
@@ -61,35 +498,47 @@ pub struct BuiltEntity {
     pub(crate) builder: EntityBuilder,
 }
 
-pub struct Entity<'a> {
-    storage: &'a ComponentStorageMap,
-    index: usize,
+/// the components of a built entity, sorted by type into those stored in its archetype and
+/// those stored in sparse sets
+struct SortedEntity {
+    archetype: usize,
+    components: Vec<(TypeId, Box<dyn Any + Send + Sync>, ColumnFactory)>,
+    sparse: Vec<(TypeId, Box<dyn Any + Send + Sync>, ColumnFactory)>,
 }
 
-impl<'a> Entity<'a> {
-    fn new(storage: &'a ComponentStorageMap, index: usize) -> Self {
-        Self { storage, index }
+/// an entity being visited by a system, and its components
+pub struct EntityRef<'a> {
+    wyrd: &'a Wyrd,
+    archetype: &'a Archetype,
+    entity: Entity,
+    row: usize,
+}
+
+impl<'a> EntityRef<'a> {
+    fn new(wyrd: &'a Wyrd, archetype: &'a Archetype, entity: Entity, row: usize) -> Self {
+        Self {
+            wyrd,
+            archetype,
+            entity,
+            row,
+        }
     }
 
-    pub fn has_component<T: 'static>(&mut self) -> bool {
-        self.storage.contains_key(&TypeId::of::<T>())
+    pub fn entity(&self) -> Entity {
+        self.entity
     }
 
-    pub fn get_component<T: 'static>(&mut self) -> &'a Option<T> {
-        if let Some(pointer) = self.storage.get(&TypeId::of::<T>()) {
-            unsafe {
-                if let Some(storage) = pointer.cast::<Vec<Option<T>>>().as_ref() {
-                    if let Some(component) = storage.get(self.index) {
-                        component
-                    } else {
-                        &None
-                    }
-                } else {
-                    &None
-                }
-            }
-        } else {
-            &None
+    pub fn has_component<T: Component>(&self) -> bool {
+        match self.wyrd.sparse_set::<T>() {
+            Some(sparse_set) => sparse_set.contains(self.entity),
+            None => self.archetype.has(TypeId::of::<T>()),
+        }
+    }
+
+    pub fn get_component<T: Component>(&self) -> Option<&'a T> {
+        match self.wyrd.sparse_set::<T>() {
+            Some(sparse_set) => sparse_set.get(self.entity),
+            None => self.archetype.column::<T>()?.get(self.row),
         }
     }
 }
@@ -0,0 +1,478 @@
+//! typed queries over every entity with a set of components
+//!
+//! A query such as `Query<(&mut Position, &Velocity), Without<Frozen>>` remembers which archetypes
+//! match it, resolves each matching archetype's columns once per run, and then walks the columns
+//! row by row with raw pointers, so there is no per-entity lookup or bounds check.
+
+use crate::executor::{Executor, Task};
+use crate::{Archetype, Component, Entity, Wyrd};
+use std::any::{type_name, TypeId};
+use std::marker::PhantomData;
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+/// the component types a query reads and writes
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct Access {
+    reads: Vec<TypeId>,
+    writes: Vec<TypeId>,
+}
+impl Access {
+    /// the component types which are read (and not written)
+    pub fn reads(&self) -> &[TypeId] {
+        &self.reads
+    }
+
+    /// the component types which are written
+    pub fn writes(&self) -> &[TypeId] {
+        &self.writes
+    }
+
+    /// record a read of a component type
+    pub fn add_read(&mut self, type_id: TypeId, name: &str) {
+        if self.writes.contains(&type_id) {
+            panic!("{} is both read and written by a query", name);
+        }
+        self.reads.push(type_id);
+    }
+
+    /// record a write of a component type
+    pub fn add_write(&mut self, type_id: TypeId, name: &str) {
+        if self.writes.contains(&type_id) || self.reads.contains(&type_id) {
+            panic!("{} is written more than once by a query", name);
+        }
+        self.writes.push(type_id);
+    }
+
+    /// whether two accesses cannot run at the same time, because one writes a component type
+    /// which the other reads or writes
+    pub fn conflicts(&self, other: &Access) -> bool {
+        self.writes
+            .iter()
+            .any(|type_id| other.reads.contains(type_id) || other.writes.contains(type_id))
+            || other
+                .writes
+                .iter()
+                .any(|type_id| self.reads.contains(type_id))
+    }
+}
+
+/// something a query fetches for each entity: a component by reference (`&T`), a component by
+/// mutable reference (`&mut T`), the `Entity` itself, or a tuple of these
+///
+/// # Safety
+/// Schedules run queries with non-conflicting accesses at the same time, so `access` must record a
+/// read of every component type whose column `columns` resolves for reading, and a write of every
+/// one it resolves for writing, and `fetch` must not touch any other column.
+pub unsafe trait QueryParam {
+    /// what is fetched for each entity
+    type Item<'a>;
+    /// what is resolved once per archetype to fetch from each row
+    type Columns: Copy;
+
+    /// record the component types the parameter reads and writes
+    fn access(access: &mut Access);
+
+    /// record the component types the parameter fetches, with their names
+    fn component_types(types: &mut Vec<(TypeId, &'static str)>);
+
+    /// whether an archetype has every component the parameter fetches
+    fn matches(archetype: &Archetype) -> bool;
+
+    /// resolve a matching archetype's columns
+    ///
+    /// # Safety
+    /// No column the parameter writes may be borrowed elsewhere, and no column it reads may be
+    /// borrowed mutably elsewhere, for as long as the resolved columns are used.
+    unsafe fn columns(archetype: &Archetype) -> Self::Columns;
+
+    /// fetch a row from resolved columns
+    ///
+    /// # Safety
+    /// The row must be in bounds of the columns' archetype, which must outlive `'a`, and no other
+    /// reference to the fetched row's components may exist while a mutable item does.
+    unsafe fn fetch<'a>(columns: Self::Columns, row: usize) -> Self::Item<'a>;
+}
+
+// SAFETY: the only column resolved is the one read
+unsafe impl<T: Component> QueryParam for &T {
+    type Item<'a> = &'a T;
+    type Columns = *const T;
+
+    fn access(access: &mut Access) {
+        access.add_read(TypeId::of::<T>(), type_name::<T>());
+    }
+
+    fn component_types(types: &mut Vec<(TypeId, &'static str)>) {
+        types.push((TypeId::of::<T>(), type_name::<T>()));
+    }
+
+    fn matches(archetype: &Archetype) -> bool {
+        archetype.has(TypeId::of::<T>())
+    }
+
+    unsafe fn columns(archetype: &Archetype) -> Self::Columns {
+        archetype
+            .column_unchecked::<T>()
+            .expect("archetype does not match the query")
+            .as_ptr()
+    }
+
+    #[inline]
+    unsafe fn fetch<'a>(columns: Self::Columns, row: usize) -> Self::Item<'a> {
+        &*columns.add(row)
+    }
+}
+
+// SAFETY: the only column resolved is the one written
+unsafe impl<T: Component> QueryParam for &mut T {
+    type Item<'a> = &'a mut T;
+    type Columns = *mut T;
+
+    fn access(access: &mut Access) {
+        access.add_write(TypeId::of::<T>(), type_name::<T>());
+    }
+
+    fn component_types(types: &mut Vec<(TypeId, &'static str)>) {
+        types.push((TypeId::of::<T>(), type_name::<T>()));
+    }
+
+    fn matches(archetype: &Archetype) -> bool {
+        archetype.has(TypeId::of::<T>())
+    }
+
+    unsafe fn columns(archetype: &Archetype) -> Self::Columns {
+        archetype
+            .column_unchecked_mut::<T>()
+            .expect("archetype does not match the query")
+            .as_mut_ptr()
+    }
+
+    #[inline]
+    unsafe fn fetch<'a>(columns: Self::Columns, row: usize) -> Self::Item<'a> {
+        &mut *columns.add(row)
+    }
+}
+
+// SAFETY: no component column is resolved
+unsafe impl QueryParam for Entity {
+    type Item<'a> = Entity;
+    type Columns = *const Entity;
+
+    fn access(_: &mut Access) {}
+
+    fn component_types(_: &mut Vec<(TypeId, &'static str)>) {}
+
+    fn matches(_: &Archetype) -> bool {
+        true
+    }
+
+    unsafe fn columns(archetype: &Archetype) -> Self::Columns {
+        archetype.entities().as_ptr()
+    }
+
+    #[inline]
+    unsafe fn fetch<'a>(columns: Self::Columns, row: usize) -> Self::Item<'a> {
+        *columns.add(row)
+    }
+}
+
+macro_rules! impl_query_param {
+    ($($param:ident),+) => {
+        // SAFETY: the columns resolved are those of the parameters, whose accesses are recorded
+        unsafe impl<$($param: QueryParam),+> QueryParam for ($($param,)+) {
+            type Item<'a> = ($($param::Item<'a>,)+);
+            type Columns = ($($param::Columns,)+);
+
+            fn access(access: &mut Access) {
+                $($param::access(access);)+
+            }
+
+            fn component_types(types: &mut Vec<(TypeId, &'static str)>) {
+                $($param::component_types(types);)+
+            }
+
+            fn matches(archetype: &Archetype) -> bool {
+                $($param::matches(archetype))&&+
+            }
+
+            unsafe fn columns(archetype: &Archetype) -> Self::Columns {
+                ($($param::columns(archetype),)+)
+            }
+
+            #[inline]
+            #[allow(non_snake_case)]
+            unsafe fn fetch<'a>(columns: Self::Columns, row: usize) -> Self::Item<'a> {
+                let ($($param,)+) = columns;
+                ($($param::fetch($param, row),)+)
+            }
+        }
+    };
+}
+impl_query_param!(A);
+impl_query_param!(A, B);
+impl_query_param!(A, B, C);
+impl_query_param!(A, B, C, D);
+impl_query_param!(A, B, C, D, E);
+impl_query_param!(A, B, C, D, E, F);
+impl_query_param!(A, B, C, D, E, F, G);
+impl_query_param!(A, B, C, D, E, F, G, H);
+
+/// a condition on the component types of the entities a query visits, without fetching them
+pub trait QueryFilter {
+    /// whether an archetype's entities satisfy the filter
+    fn matches(archetype: &Archetype) -> bool;
+
+    /// record the component types the filter names, with their names
+    fn component_types(types: &mut Vec<(TypeId, &'static str)>);
+}
+
+/// only visit entities which have a component type
+pub struct With<T>(PhantomData<fn() -> T>);
+impl<T: Component> QueryFilter for With<T> {
+    fn matches(archetype: &Archetype) -> bool {
+        archetype.has(TypeId::of::<T>())
+    }
+
+    fn component_types(types: &mut Vec<(TypeId, &'static str)>) {
+        types.push((TypeId::of::<T>(), type_name::<T>()));
+    }
+}
+
+/// only visit entities which do not have a component type
+pub struct Without<T>(PhantomData<fn() -> T>);
+impl<T: Component> QueryFilter for Without<T> {
+    fn matches(archetype: &Archetype) -> bool {
+        !archetype.has(TypeId::of::<T>())
+    }
+
+    fn component_types(types: &mut Vec<(TypeId, &'static str)>) {
+        types.push((TypeId::of::<T>(), type_name::<T>()));
+    }
+}
+
+impl QueryFilter for () {
+    fn matches(_: &Archetype) -> bool {
+        true
+    }
+
+    fn component_types(_: &mut Vec<(TypeId, &'static str)>) {}
+}
+
+macro_rules! impl_query_filter {
+    ($($filter:ident),+) => {
+        impl<$($filter: QueryFilter),+> QueryFilter for ($($filter,)+) {
+            fn matches(archetype: &Archetype) -> bool {
+                $($filter::matches(archetype))&&+
+            }
+
+            fn component_types(types: &mut Vec<(TypeId, &'static str)>) {
+                $($filter::component_types(types);)+
+            }
+        }
+    };
+}
+impl_query_filter!(A);
+impl_query_filter!(A, B);
+impl_query_filter!(A, B, C);
+impl_query_filter!(A, B, C, D);
+
+/// a query for every entity with the components fetched by `Q` which satisfies the filter `F`,
+/// which caches the archetypes it matches between runs
+pub struct Query<Q: QueryParam, F: QueryFilter = ()> {
+    access: Access,
+    /// every component type the query fetches or filters on, which must be stored in tables
+    component_types: Vec<(TypeId, &'static str)>,
+    /// the Wyrd whose archetypes have been matched
+    wyrd_id: u64,
+    /// the number of that Wyrd's archetypes which have been matched
+    checked: usize,
+    /// the indices of the matching archetypes
+    matched: Vec<usize>,
+    marker: PhantomData<fn() -> (Q, F)>,
+}
+impl<Q: QueryParam, F: QueryFilter> Default for Query<Q, F> {
+    fn default() -> Self {
+        let mut access = Access::default();
+        Q::access(&mut access);
+        let mut component_types = Vec::new();
+        Q::component_types(&mut component_types);
+        F::component_types(&mut component_types);
+        Self {
+            access,
+            component_types,
+            wyrd_id: 0,
+            checked: 0,
+            matched: Vec::new(),
+            marker: PhantomData,
+        }
+    }
+}
+impl<Q: QueryParam, F: QueryFilter> Query<Q, F> {
+    /// create a query (panicking if it would alias a component mutably)
+    pub fn new() -> Self {
+        Default::default()
+    }
+
+    /// the component types the query reads and writes
+    pub fn access(&self) -> &Access {
+        &self.access
+    }
+
+    /// match any archetypes created since the query last ran (panicking if the query names a
+    /// component type stored in sparse sets, which archetypes never have)
+    fn update(&mut self, wyrd: &Wyrd) {
+        for &(type_id, name) in self.component_types.iter() {
+            if wyrd.is_sparse(type_id) {
+                panic!(
+                    "{} is stored in a sparse set, so queries cannot fetch or filter on it",
+                    name
+                );
+            }
+        }
+        if self.wyrd_id != wyrd.id() {
+            self.wyrd_id = wyrd.id();
+            self.checked = 0;
+            self.matched.clear();
+        }
+        let archetypes = wyrd.archetypes();
+        for (index, archetype) in archetypes.iter().enumerate().skip(self.checked) {
+            if Q::matches(archetype) && F::matches(archetype) {
+                self.matched.push(index);
+            }
+        }
+        self.checked = archetypes.len();
+    }
+
+    /// the number of entities the query visits
+    pub fn count(&mut self, wyrd: &Wyrd) -> usize {
+        self.update(wyrd);
+        self.matched
+            .iter()
+            .map(|&index| wyrd.archetypes()[index].len())
+            .sum()
+    }
+
+    /// call a function with the fetched components of every entity the query visits
+    pub fn for_each(&mut self, wyrd: &mut Wyrd, function: impl FnMut(Q::Item<'_>)) {
+        // SAFETY: the Wyrd is borrowed mutably, so nothing else can borrow its columns
+        unsafe { self.for_each_unchecked(wyrd, function) }
+    }
+
+    /// call a function with the fetched components of every entity the query visits, through a
+    /// shared reference to the Wyrd
+    ///
+    /// # Safety
+    /// No column the query writes may be borrowed elsewhere, and no column it reads may be
+    /// borrowed mutably elsewhere, until this returns.
+    pub(crate) unsafe fn for_each_unchecked(
+        &mut self,
+        wyrd: &Wyrd,
+        mut function: impl FnMut(Q::Item<'_>),
+    ) {
+        self.update(wyrd);
+        for &index in self.matched.iter() {
+            let archetype = &wyrd.archetypes()[index];
+            let columns = Q::columns(archetype);
+            for row in 0..archetype.len() {
+                // the access check rules out aliasing within a row, and rows are fetched once
+                function(Q::fetch(columns, row));
+            }
+        }
+    }
+
+    /// call a function with the fetched components of every entity the query visits, split into
+    /// chunks of rows which are spread over an executor's threads, through a shared reference to
+    /// the Wyrd
+    ///
+    /// # Safety
+    /// The same as `for_each_unchecked`.
+    pub(crate) unsafe fn par_for_each_unchecked<S>(
+        &mut self,
+        wyrd: &Wyrd,
+        chunk_size: usize,
+        executor: &dyn Executor,
+        function: &S,
+    ) where
+        S: Fn(Q::Item<'_>) + Sync,
+    {
+        self.update(wyrd);
+        let chunk_size = chunk_size.max(1);
+        let mut chunks = Vec::new();
+        for &index in self.matched.iter() {
+            let archetype = &wyrd.archetypes()[index];
+            let columns = Q::columns(archetype);
+            for start in (0..archetype.len()).step_by(chunk_size) {
+                let end = (start + chunk_size).min(archetype.len());
+                chunks.push((SendColumns(columns), start..end));
+            }
+        }
+        let next = AtomicUsize::new(0);
+        let work = &|| {
+            while let Some((columns, rows)) = chunks.get(next.fetch_add(1, Ordering::Relaxed)) {
+                for row in rows.clone() {
+                    // each chunk is taken by a single thread, and chunks do not overlap
+                    function(Q::fetch(columns.0, row));
+                }
+            }
+        };
+        let tasks = executor.threads().min(chunks.len());
+        if tasks <= 1 {
+            return work();
+        }
+        executor.run_all((0..tasks).map(|_| Box::new(work) as Task<'_>).collect());
+    }
+
+    /// iterate over the fetched components of every entity the query visits
+    pub fn iter<'w>(&'w mut self, wyrd: &'w mut Wyrd) -> QueryIter<'w, Q> {
+        self.update(wyrd);
+        QueryIter {
+            archetypes: wyrd.archetypes(),
+            matched: self.matched.iter(),
+            columns: None,
+            row: 0,
+            len: 0,
+        }
+    }
+}
+
+/// resolved columns which may be sent to the threads running a chunked query
+struct SendColumns<C>(C);
+
+// SAFETY: the scheduler ensures the columns' components are not accessed elsewhere while the
+// chunks run, and components are Send and Sync
+unsafe impl<C> Send for SendColumns<C> {}
+unsafe impl<C> Sync for SendColumns<C> {}
+
+/// an iterator over the results of a query
+pub struct QueryIter<'w, Q: QueryParam> {
+    /// the archetypes of a mutably borrowed Wyrd
+    archetypes: &'w [Archetype],
+    matched: std::slice::Iter<'w, usize>,
+    /// the resolved columns of the current archetype
+    columns: Option<Q::Columns>,
+    row: usize,
+    len: usize,
+}
+impl<'w, Q: QueryParam> Iterator for QueryIter<'w, Q> {
+    type Item = Q::Item<'w>;
+
+    #[inline]
+    fn next(&mut self) -> Option<Self::Item> {
+        loop {
+            if let Some(columns) = self.columns {
+                if self.row < self.len {
+                    let row = self.row;
+                    self.row += 1;
+                    // SAFETY: the row is in bounds, the Wyrd is borrowed mutably for 'w, the
+                    // access check rules out aliasing within a row, and each row is fetched once
+                    return Some(unsafe { Q::fetch(columns, row) });
+                }
+            }
+            let archetype = &self.archetypes[*self.matched.next()?];
+            // SAFETY: the Wyrd is borrowed mutably for 'w, so nothing else can borrow its columns
+            self.columns = Some(unsafe { Q::columns(archetype) });
+            self.row = 0;
+            self.len = archetype.len();
+        }
+    }
+}
@@ -0,0 +1,221 @@
+//! running systems in parallel: each system declares the component types it reads and writes, and
+//! a schedule runs the systems of a stage in batches, where no two systems in a batch conflict
+//!
+//! A system is placed in the batch after the last batch holding a system it conflicts with, so
+//! conflicting systems always run in the order they were added, and systems which do not conflict
+//! run concurrently. Stages are barriers: every system in a stage finishes before the next stage
+//! starts. A system running a large query can also split its rows into chunks which run on
+//! several threads (see `QuerySystem::parallel`). Batches and chunks run on the schedule's
+//! executor, which bounds the number of threads in use.
+
+use crate::executor::{Executor, Task, ThreadPool};
+use crate::{Access, Query, QueryFilter, QueryParam, Wyrd};
+use std::num::NonZeroUsize;
+use std::thread::available_parallelism;
+
+/// something which runs over the components of a Wyrd, touching only the component types it
+/// declares
+///
+/// # Safety
+/// The scheduler runs systems with non-conflicting accesses at the same time, so `run` must only
+/// read the component types the system's access reads or writes, and only write the component
+/// types it writes, and the access must not change between runs.
+pub unsafe trait System: Send {
+    /// the system's name, for debugging
+    fn name(&self) -> &str;
+
+    /// the component types the system reads and writes
+    fn access(&self) -> &Access;
+
+    /// run the system, splitting its work over an executor if it can
+    ///
+    /// # Safety
+    /// No system with a conflicting access may run at the same time, and nothing else may borrow
+    /// the components the system accesses until it returns.
+    unsafe fn run(&mut self, wyrd: &Wyrd, executor: &dyn Executor);
+}
+
+/// a system which calls a function with the fetched components of every entity a query visits
+pub struct QuerySystem<Q: QueryParam, F: QueryFilter, S> {
+    name: String,
+    query: Query<Q, F>,
+    function: S,
+    /// the number of rows per chunk, if the query is split over threads
+    chunk_size: Option<usize>,
+}
+impl<Q, F, S> QuerySystem<Q, F, S>
+where
+    Q: QueryParam,
+    F: QueryFilter,
+    S: for<'a> Fn(Q::Item<'a>) + Send + Sync,
+{
+    /// create a system which runs a query
+    pub fn new(name: impl Into<String>, query: Query<Q, F>, function: S) -> Self {
+        Self {
+            name: name.into(),
+            query,
+            function,
+            chunk_size: None,
+        }
+    }
+
+    /// split the rows the query visits into chunks, which run on the threads the schedule gives
+    /// the system
+    pub fn parallel(mut self, chunk_size: usize) -> Self {
+        self.chunk_size = Some(chunk_size);
+        self
+    }
+}
+// SAFETY: the system only touches the components its query fetches, which its access covers
+unsafe impl<Q, F, S> System for QuerySystem<Q, F, S>
+where
+    Q: QueryParam,
+    F: QueryFilter,
+    S: for<'a> Fn(Q::Item<'a>) + Send + Sync,
+{
+    fn name(&self) -> &str {
+        &self.name
+    }
+
+    fn access(&self) -> &Access {
+        self.query.access()
+    }
+
+    unsafe fn run(&mut self, wyrd: &Wyrd, executor: &dyn Executor) {
+        match self.chunk_size {
+            Some(chunk_size) if executor.threads() > 1 => {
+                self.query
+                    .par_for_each_unchecked(wyrd, chunk_size, executor, &self.function)
+            }
+            _ => self.query.for_each_unchecked(wyrd, &self.function),
+        }
+    }
+}
+
+/// the systems of a stage, sorted by batch
+#[derive(Default)]
+struct Stage {
+    systems: Vec<Box<dyn System>>,
+    /// the batch of each system
+    batches: Vec<usize>,
+}
+impl Stage {
+    fn add(&mut self, system: Box<dyn System>) {
+        // conflicting systems keep the order they were added in when sorted by batch
+        let batch = self
+            .systems
+            .iter()
+            .zip(self.batches.iter())
+            .filter(|(other, _)| other.access().conflicts(system.access()))
+            .map(|(_, &batch)| batch + 1)
+            .max()
+            .unwrap_or(0);
+        let index = self.batches.partition_point(|&other| other <= batch);
+        self.systems.insert(index, system);
+        self.batches.insert(index, batch);
+    }
+
+    /// the ranges of the systems in each batch
+    fn ranges(&self) -> impl Iterator<Item = std::ops::Range<usize>> + '_ {
+        let mut start = 0;
+        std::iter::from_fn(move || {
+            let batch = *self.batches.get(start)?;
+            let end = start + self.batches[start..].partition_point(|&other| other == batch);
+            Some(std::mem::replace(&mut start, end)..end)
+        })
+    }
+}
+
+/// systems grouped into stages, which run batches of non-conflicting systems in parallel
+pub struct Schedule {
+    stages: Vec<Stage>,
+    /// the executor systems run on, or `None` until the first run if none was given
+    executor: Option<Box<dyn Executor>>,
+}
+impl Default for Schedule {
+    fn default() -> Self {
+        Self {
+            stages: vec![Stage::default()],
+            executor: None,
+        }
+    }
+}
+impl Schedule {
+    /// create a schedule with a single stage, running systems on a pool of as many threads as the
+    /// machine has cores (started when the schedule first runs)
+    pub fn new() -> Self {
+        Default::default()
+    }
+
+    /// run systems on a pool of at most `threads` threads (including the thread calling `run`)
+    pub fn with_threads(self, threads: usize) -> Self {
+        self.with_executor(ThreadPool::new(threads))
+    }
+
+    /// run systems on an executor (e.g. a game engine's own job pool) instead of a pool of the
+    /// schedule's own
+    pub fn with_executor(mut self, executor: impl Executor + 'static) -> Self {
+        self.executor = Some(Box::new(executor));
+        self
+    }
+
+    /// add a system to the last stage
+    pub fn add_system(&mut self, system: impl System + 'static) -> &mut Self {
+        self.stages
+            .last_mut()
+            .expect("schedule has no stages")
+            .add(Box::new(system));
+        self
+    }
+
+    /// start a new stage, which runs once every system added before it has finished
+    pub fn add_stage(&mut self) -> &mut Self {
+        self.stages.push(Stage::default());
+        self
+    }
+
+    /// the names of the systems in each batch of each stage, in the order the batches run
+    pub fn batches(&self) -> Vec<Vec<Vec<&str>>> {
+        self.stages
+            .iter()
+            .map(|stage| {
+                stage
+                    .ranges()
+                    .map(|range| {
+                        stage.systems[range]
+                            .iter()
+                            .map(|system| system.name())
+                            .collect()
+                    })
+                    .collect()
+            })
+            .collect()
+    }
+
+    /// run every system once
+    pub fn run(&mut self, wyrd: &mut Wyrd) {
+        let wyrd = &*wyrd;
+        let executor = &**self.executor.get_or_insert_with(|| {
+            Box::new(ThreadPool::new(
+                available_parallelism().map_or(1, NonZeroUsize::get),
+            ))
+        });
+        for stage in self.stages.iter_mut() {
+            let ranges: Vec<_> = stage.ranges().collect();
+            for range in ranges {
+                // SAFETY: the Wyrd is borrowed mutably, and no two systems in a batch conflict
+                match &mut stage.systems[range] {
+                    [system] => unsafe { system.run(wyrd, executor) },
+                    systems => executor.run_all(
+                        systems
+                            .iter_mut()
+                            .map(|system| {
+                                Box::new(move || unsafe { system.run(wyrd, executor) }) as Task<'_>
+                            })
+                            .collect(),
+                    ),
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,163 @@
+//! sparse set storage, for component types which are added and removed too often to move their
+//! entities between archetypes every time
+//!
+//! A sparse set keeps its components in a packed array, with the entity of each, and a sparse
+//! array from entity index to position in the packed array. Adding a component pushes it onto the
+//! packed array, and removing one swaps the last component into its place, so both are O(1), and
+//! iterating visits only the entities which have the component.
+
+use crate::{Component, Entity};
+use std::any::Any;
+use std::convert::TryFrom;
+
+/// how the components of a type are stored, chosen when the type is registered
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub enum StorageType {
+    /// a dense column in each archetype whose entities have the component, which is fastest to
+    /// iterate and is visited by queries, but moves an entity to another archetype whenever the
+    /// component is added or removed
+    #[default]
+    Table,
+    /// a sparse set shared by every entity with the component, which adds and removes components
+    /// without moving entities, and is iterated through `Wyrd::sparse_set` rather than queries
+    /// (which panic if they fetch or filter on the type)
+    SparseSet,
+}
+
+/// the components of a type stored in a sparse set
+pub struct SparseSet<T> {
+    /// the components, packed
+    dense: Vec<T>,
+    /// the entity of each packed component
+    entities: Vec<Entity>,
+    /// the position of each entity index's component in the packed array
+    sparse: Vec<Option<u32>>,
+}
+impl<T> Default for SparseSet<T> {
+    fn default() -> Self {
+        Self {
+            dense: Vec::new(),
+            entities: Vec::new(),
+            sparse: Vec::new(),
+        }
+    }
+}
+impl<T: Component> SparseSet<T> {
+    /// the number of entities with the component
+    pub fn len(&self) -> usize {
+        self.dense.len()
+    }
+
+    /// whether no entity has the component
+    pub fn is_empty(&self) -> bool {
+        self.dense.is_empty()
+    }
+
+    fn position(&self, entity: Entity) -> Option<usize> {
+        let position = (*self.sparse.get(entity.index())?)? as usize;
+        match self.entities[position] == entity {
+            true => Some(position),
+            false => None,
+        }
+    }
+
+    /// whether an entity has the component
+    pub fn contains(&self, entity: Entity) -> bool {
+        self.position(entity).is_some()
+    }
+
+    /// an entity's component, if it has one
+    pub fn get(&self, entity: Entity) -> Option<&T> {
+        Some(&self.dense[self.position(entity)?])
+    }
+
+    /// an entity's component, mutably, if it has one
+    pub fn get_mut(&mut self, entity: Entity) -> Option<&mut T> {
+        let position = self.position(entity)?;
+        Some(&mut self.dense[position])
+    }
+
+    /// the entities with the component, in the same order as the components
+    pub fn entities(&self) -> &[Entity] {
+        &self.entities
+    }
+
+    /// the packed components
+    pub fn components(&self) -> &[T] {
+        &self.dense
+    }
+
+    /// the packed components, mutably
+    pub fn components_mut(&mut self) -> &mut [T] {
+        &mut self.dense
+    }
+
+    /// iterate over the entities with the component, and their components
+    pub fn iter(&self) -> impl Iterator<Item = (Entity, &T)> {
+        self.entities.iter().copied().zip(self.dense.iter())
+    }
+
+    /// iterate over the entities with the component, and their components mutably
+    pub fn iter_mut(&mut self) -> impl Iterator<Item = (Entity, &mut T)> {
+        self.entities.iter().copied().zip(self.dense.iter_mut())
+    }
+
+    /// give an entity a component, returning the component it replaces (if any)
+    pub(crate) fn insert(&mut self, entity: Entity, component: T) -> Option<T> {
+        if let Some(position) = self.position(entity) {
+            return Some(std::mem::replace(&mut self.dense[position], component));
+        }
+        if self.sparse.len() <= entity.index() {
+            self.sparse.resize(entity.index() + 1, None);
+        }
+        let position = u32::try_from(self.dense.len()).expect("too many sparse components");
+        self.sparse[entity.index()] = Some(position);
+        self.dense.push(component);
+        self.entities.push(entity);
+        None
+    }
+
+    /// take an entity's component, if it has one
+    pub(crate) fn remove(&mut self, entity: Entity) -> Option<T> {
+        let position = self.position(entity)?;
+        self.sparse[entity.index()] = None;
+        self.entities.swap_remove(position);
+        if let Some(&moved) = self.entities.get(position) {
+            self.sparse[moved.index()] = Some(position as u32);
+        }
+        Some(self.dense.swap_remove(position))
+    }
+}
+
+/// a type-erased sparse set
+pub(crate) trait SparseStorage: Send + Sync {
+    fn as_any(&self) -> &dyn Any;
+    fn as_any_mut(&mut self) -> &mut dyn Any;
+    /// give an entity a boxed component, which must be of the set's type
+    fn insert_boxed(&mut self, entity: Entity, component: Box<dyn Any + Send + Sync>);
+    /// drop an entity's component, returning whether it had one
+    fn remove_entity(&mut self, entity: Entity) -> bool;
+}
+impl<T: Component> SparseStorage for SparseSet<T> {
+    fn as_any(&self) -> &dyn Any {
+        self
+    }
+
+    fn as_any_mut(&mut self) -> &mut dyn Any {
+        self
+    }
+
+    fn insert_boxed(&mut self, entity: Entity, component: Box<dyn Any + Send + Sync>) {
+        let component: Box<dyn Any> = component;
+        match component.downcast::<T>() {
+            Ok(component) => {
+                self.insert(entity, *component);
+            }
+            Err(_) => panic!("component inserted into a sparse set of another type"),
+        }
+    }
+
+    fn remove_entity(&mut self, entity: Entity) -> bool {
+        self.remove(entity).is_some()
+    }
+}
@@ -0,0 +1,375 @@
+use crate::{
+    Entity, EntityBuilder, EntityRef, Query, QuerySystem, Schedule, StorageType, With, Without,
+    Wyrd,
+};
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+#[derive(Debug, PartialEq)]
+struct Position(f32, f32);
+#[derive(Debug, PartialEq)]
+struct Velocity(f32, f32);
+#[derive(Debug, PartialEq)]
+struct Frozen;
+
+fn spawn_moving(wyrd: &mut Wyrd, x: f32) -> Entity {
+    let mut builder = EntityBuilder::default();
+    builder
+        .add_component(Box::new(Position(x, 0.0)))
+        .add_component(Box::new(Velocity(1.0, 0.0)));
+    wyrd.spawn_entity(builder.build())
+}
+
+#[test]
+fn test_entities_with_the_same_components_share_an_archetype() {
+    let mut wyrd = Wyrd::new();
+    let first = spawn_moving(&mut wyrd, 1.0);
+    let second = spawn_moving(&mut wyrd, 2.0);
+    let archetype = wyrd
+        .archetypes()
+        .iter()
+        .find(|archetype| archetype.len() == 2)
+        .expect("no archetype holds both entities");
+    assert_eq!(archetype.entities(), &[first, second]);
+    assert_eq!(
+        archetype.column::<Position>(),
+        Some(&[Position(1.0, 0.0), Position(2.0, 0.0)][..])
+    );
+}
+
+#[test]
+fn test_adding_and_removing_components_moves_entities() {
+    let mut wyrd = Wyrd::new();
+    let first = spawn_moving(&mut wyrd, 1.0);
+    let second = spawn_moving(&mut wyrd, 2.0);
+    let third = spawn_moving(&mut wyrd, 3.0);
+
+    assert!(wyrd.add_component(first, Frozen));
+    assert_eq!(wyrd.get_component::<Frozen>(first), Some(&Frozen));
+    assert_eq!(
+        wyrd.get_component::<Position>(first),
+        Some(&Position(1.0, 0.0))
+    );
+    assert_eq!(
+        wyrd.get_component::<Position>(third),
+        Some(&Position(3.0, 0.0))
+    );
+
+    assert_eq!(
+        wyrd.remove_component::<Velocity>(first),
+        Some(Velocity(1.0, 0.0))
+    );
+    assert_eq!(wyrd.get_component::<Velocity>(first), None);
+    assert_eq!(wyrd.get_component::<Frozen>(first), Some(&Frozen));
+    assert_eq!(wyrd.remove_component::<Velocity>(first), None);
+
+    wyrd.get_component_mut::<Position>(second)
+        .expect("entity has no position")
+        .0 = 5.0;
+    assert!(wyrd.despawn_entity(third));
+    assert!(!wyrd.contains(third));
+    assert_eq!(
+        wyrd.get_component::<Position>(second),
+        Some(&Position(5.0, 0.0))
+    );
+}
+
+#[test]
+fn test_run_system_visits_every_entity() {
+    let mut wyrd = Wyrd::new();
+    for x in 0..10 {
+        spawn_moving(&mut wyrd, x as f32);
+    }
+    let frozen = spawn_moving(&mut wyrd, 10.0);
+    wyrd.add_component(frozen, Frozen);
+    wyrd.run_system(|entity: EntityRef| {
+        assert!(entity.has_component::<Position>());
+        let position = entity
+            .get_component::<Position>()
+            .expect("entity has no position");
+        assert_eq!(entity.has_component::<Frozen>(), position.0 == 10.0);
+    });
+}
+
+#[test]
+fn test_queries_fetch_and_filter_components() {
+    let mut wyrd = Wyrd::new();
+    let mut moving = Vec::new();
+    for x in 0..100 {
+        moving.push(spawn_moving(&mut wyrd, x as f32));
+    }
+    for &entity in moving.iter().step_by(10) {
+        wyrd.add_component(entity, Frozen);
+    }
+
+    let mut movement = Query::<(&mut Position, &Velocity), Without<Frozen>>::new();
+    assert_eq!(movement.count(&wyrd), 90);
+    movement.for_each(&mut wyrd, |(position, velocity)| {
+        position.0 += velocity.0;
+    });
+    assert_eq!(
+        wyrd.get_component::<Position>(moving[0]),
+        Some(&Position(0.0, 0.0))
+    );
+    assert_eq!(
+        wyrd.get_component::<Position>(moving[1]),
+        Some(&Position(2.0, 0.0))
+    );
+
+    let mut frozen = Query::<(Entity, &Position), With<Frozen>>::new();
+    let mut visited: Vec<Entity> = frozen.iter(&mut wyrd).map(|(entity, _)| entity).collect();
+    visited.sort();
+    assert_eq!(
+        visited,
+        moving.iter().step_by(10).copied().collect::<Vec<_>>()
+    );
+
+    // archetypes created after a query first ran are matched on its next run
+    let mut builder = EntityBuilder::default();
+    builder.add_component(Box::new(Position(0.0, 0.0)));
+    builder.add_component(Box::new(Velocity(0.0, 0.0)));
+    builder.add_component(Box::new(0u8));
+    wyrd.spawn_entity(builder.build());
+    assert_eq!(movement.count(&wyrd), 91);
+}
+
+#[test]
+#[should_panic(expected = "both read and written")]
+fn test_queries_cannot_alias_components() {
+    Query::<(&mut Position, &Position)>::new();
+}
+
+#[test]
+fn test_schedules_batch_systems_which_do_not_conflict() {
+    let mut schedule = Schedule::new().with_threads(4);
+    schedule
+        .add_system(QuerySystem::new(
+            "movement",
+            Query::<(&mut Position, &Velocity)>::new(),
+            |(position, velocity)| position.0 += velocity.0,
+        ))
+        .add_system(QuerySystem::new("speed", Query::<&Velocity>::new(), |_| ()))
+        .add_system(QuerySystem::new(
+            "thaw",
+            Query::<&mut Frozen>::new(),
+            |_| (),
+        ))
+        .add_system(QuerySystem::new(
+            "render",
+            Query::<&Position>::new(),
+            |_| (),
+        ))
+        .add_stage()
+        .add_system(QuerySystem::new(
+            "friction",
+            Query::<&mut Velocity>::new(),
+            |velocity| velocity.0 *= 0.5,
+        ));
+    assert_eq!(
+        schedule.batches(),
+        vec![
+            vec![vec!["movement", "speed", "thaw"], vec!["render"]],
+            vec![vec!["friction"]],
+        ]
+    );
+
+    let mut wyrd = Wyrd::new();
+    let entity = spawn_moving(&mut wyrd, 0.0);
+    schedule.run(&mut wyrd);
+    schedule.run(&mut wyrd);
+    assert_eq!(
+        wyrd.get_component::<Position>(entity),
+        Some(&Position(1.5, 0.0))
+    );
+}
+
+#[test]
+fn test_parallel_systems_visit_every_entity_once() {
+    let mut wyrd = Wyrd::new();
+    for x in 0..1000 {
+        let entity = spawn_moving(&mut wyrd, x as f32);
+        if x % 3 == 0 {
+            wyrd.add_component(entity, Frozen);
+        }
+    }
+    let visited = AtomicUsize::new(0);
+    let mut schedule = Schedule::new().with_threads(4);
+    schedule.add_system(
+        QuerySystem::new(
+            "movement",
+            Query::<(&mut Position, &Velocity)>::new(),
+            |(position, velocity)| {
+                position.0 += velocity.0;
+            },
+        )
+        .parallel(64),
+    );
+    schedule.run(&mut wyrd);
+
+    let mut positions = Query::<&Position>::new();
+    positions.for_each(&mut wyrd, |position| {
+        assert_eq!(position.0.fract(), 0.0);
+        visited.fetch_add(position.0 as usize, Ordering::Relaxed);
+    });
+    assert_eq!(visited.load(Ordering::Relaxed), (1..=1000).sum());
+}
+
+#[test]
+fn test_despawned_slots_are_reused_with_a_new_generation() {
+    let mut wyrd = Wyrd::new();
+    let first = spawn_moving(&mut wyrd, 1.0);
+    let second = spawn_moving(&mut wyrd, 2.0);
+    assert!(wyrd.despawn_entity(first));
+    assert!(!wyrd.despawn_entity(first));
+    assert_eq!(wyrd.len(), 1);
+
+    let reused = spawn_moving(&mut wyrd, 3.0);
+    assert_eq!(reused.index(), first.index());
+    assert_eq!(reused.generation(), first.generation() + 1);
+    assert!(!wyrd.contains(first));
+    assert_eq!(wyrd.get_component::<Position>(first), None);
+    assert!(!wyrd.add_component(first, Frozen));
+    assert_eq!(
+        wyrd.get_component::<Position>(reused),
+        Some(&Position(3.0, 0.0))
+    );
+    assert_eq!(
+        wyrd.get_component::<Position>(second),
+        Some(&Position(2.0, 0.0))
+    );
+}
+
+#[test]
+fn test_entities_spawn_and_despawn_in_bulk() {
+    let mut wyrd = Wyrd::new();
+    let spawned = wyrd.spawn_entities((0..1000).map(|x| {
+        let mut builder = EntityBuilder::default();
+        builder.add_component(Box::new(Position(x as f32, 0.0)));
+        if x % 2 == 0 {
+            builder.add_component(Box::new(Velocity(1.0, 0.0)));
+        }
+        builder.build()
+    }));
+    assert_eq!(spawned.len(), 1000);
+    assert_eq!(wyrd.len(), 1000);
+
+    let despawned: Vec<Entity> = spawned.iter().copied().step_by(3).collect();
+    assert_eq!(wyrd.despawn_entities(&despawned), 334);
+    assert_eq!(wyrd.despawn_entities(&despawned), 0);
+    assert_eq!(wyrd.len(), 666);
+    for (x, &entity) in spawned.iter().enumerate() {
+        let position = wyrd.get_component::<Position>(entity);
+        match x % 3 {
+            0 => assert_eq!(position, None),
+            _ => assert_eq!(position, Some(&Position(x as f32, 0.0))),
+        }
+    }
+
+    // freed slots are reused before new ones are added
+    let respawned = wyrd.spawn_entities((0..334).map(|_| EntityBuilder::default().build()));
+    assert!(respawned.iter().all(|entity| entity.index() < 1000));
+    assert_eq!(wyrd.len(), 1000);
+}
+
+#[derive(Debug, PartialEq)]
+struct Dirty(u32);
+
+#[test]
+fn test_sparse_components_do_not_move_entities() {
+    let mut wyrd = Wyrd::new();
+    wyrd.register_component_type::<Dirty>(StorageType::SparseSet);
+    let entities: Vec<Entity> = (0..10).map(|x| spawn_moving(&mut wyrd, x as f32)).collect();
+    let archetypes = wyrd.archetypes().len();
+    for &entity in entities.iter().step_by(2) {
+        assert!(wyrd.add_component(entity, Dirty(entity.index() as u32)));
+    }
+    assert_eq!(wyrd.archetypes().len(), archetypes);
+    assert_eq!(wyrd.get_component::<Dirty>(entities[2]), Some(&Dirty(2)));
+    assert_eq!(wyrd.get_component::<Dirty>(entities[3]), None);
+
+    assert_eq!(wyrd.remove_component::<Dirty>(entities[0]), Some(Dirty(0)));
+    assert_eq!(wyrd.remove_component::<Dirty>(entities[0]), None);
+    wyrd.get_component_mut::<Dirty>(entities[8]).unwrap().0 = 80;
+    let sparse_set = wyrd.sparse_set::<Dirty>().unwrap();
+    assert_eq!(sparse_set.len(), 4);
+    let mut dirty: Vec<(usize, u32)> = sparse_set
+        .iter()
+        .map(|(entity, dirty)| (entity.index(), dirty.0))
+        .collect();
+    dirty.sort();
+    assert_eq!(dirty, vec![(2, 2), (4, 4), (6, 6), (8, 80)]);
+
+    // despawned entities leave the sparse set, and their slots do not inherit components
+    wyrd.despawn_entity(entities[4]);
+    let mut builder = EntityBuilder::default();
+    builder.add_component(Box::new(Dirty(100)));
+    let spawned = wyrd.spawn_entity(builder.build());
+    assert_eq!(spawned.index(), entities[4].index());
+    assert_eq!(wyrd.get_component::<Dirty>(entities[4]), None);
+    assert_eq!(wyrd.get_component::<Dirty>(spawned), Some(&Dirty(100)));
+    assert_eq!(wyrd.sparse_set::<Dirty>().unwrap().len(), 4);
+    assert!(wyrd.archetypes()[0].entities().contains(&spawned));
+
+    // systems see sparse components alongside the components in archetypes, and queries which
+    // do not name sparse component types still visit every entity
+    static DIRTY: AtomicUsize = AtomicUsize::new(0);
+    wyrd.run_system(|entity: EntityRef| {
+        let dirty = entity.get_component::<Dirty>();
+        assert_eq!(entity.has_component::<Dirty>(), dirty.is_some());
+        if dirty.is_some() {
+            DIRTY.fetch_add(1, Ordering::Relaxed);
+        }
+    });
+    assert_eq!(DIRTY.load(Ordering::Relaxed), 4);
+    assert_eq!(Query::<Entity>::new().count(&wyrd), 10);
+}
+
+#[test]
+#[should_panic(expected = "is stored in a sparse set")]
+fn test_queries_reject_sparse_components() {
+    let mut wyrd = Wyrd::new();
+    wyrd.register_component_type::<Dirty>(StorageType::SparseSet);
+    let entity = spawn_moving(&mut wyrd, 0.0);
+    wyrd.add_component(entity, Dirty(0));
+    Query::<&Position, Without<Dirty>>::new().count(&wyrd);
+}
+
+#[test]
+#[should_panic(expected = "already registered with another storage type")]
+fn test_component_types_have_one_storage_type() {
+    let mut wyrd = Wyrd::new();
+    spawn_moving(&mut wyrd, 0.0);
+    wyrd.register_component_type::<Position>(StorageType::SparseSet);
+}
+
+#[test]
+fn test_schedules_stay_within_their_threads() {
+    let mut wyrd = Wyrd::new();
+    for x in 0..1000 {
+        spawn_moving(&mut wyrd, x as f32);
+    }
+    let threads = std::sync::Arc::new(std::sync::Mutex::new(std::collections::HashSet::new()));
+    let mut schedule = Schedule::new().with_threads(3);
+    for index in 0..10 {
+        let threads = threads.clone();
+        schedule.add_system(
+            QuerySystem::new(
+                format!("reader {}", index),
+                Query::<&Position>::new(),
+                move |_| {
+                    threads
+                        .lock()
+                        .expect("poisoned")
+                        .insert(std::thread::current().id());
+                },
+            )
+            .parallel(16),
+        );
+    }
+    assert_eq!(schedule.batches()[0].len(), 1);
+    for _ in 0..5 {
+        schedule.run(&mut wyrd);
+    }
+    // the same pool threads are reused by every run
+    let used = threads.lock().expect("poisoned").len();
+    assert!((1..=3).contains(&used), "systems ran on {} threads", used);
+}
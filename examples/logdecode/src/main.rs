@@ -0,0 +1,64 @@
+//! converts a binary log (as written by `timberwolf::log::binary::BinaryReceiver`) back into the
+//! standard text log format
+//!
+//! usage: `timberwolf-logdecode <binary log> [text log]` (writes to stdout without a text log)
+
+use std::env::args;
+use std::fs::{read, File};
+use std::io::{stdout, BufWriter, Write};
+use std::process::exit;
+use timberwolf::log::binary::Decoder;
+use timberwolf::log::output::string::append_event;
+
+fn main() {
+    let arguments = args().collect::<Vec<_>>();
+    if arguments.len() < 2 || arguments.len() > 3 {
+        eprintln!("usage: {} <binary log> [text log]", arguments[0]);
+        exit(2);
+    }
+
+    let data = match read(&arguments[1]) {
+        Ok(data) => data,
+        Err(error) => {
+            eprintln!("failed to read {}: {}", arguments[1], error);
+            exit(1);
+        }
+    };
+    let output: Box<dyn Write> = match arguments.get(2) {
+        Some(path) => match File::create(path) {
+            Ok(file) => Box::new(file),
+            Err(error) => {
+                eprintln!("failed to create {}: {}", path, error);
+                exit(1);
+            }
+        },
+        None => Box::new(stdout()),
+    };
+    let mut output = BufWriter::new(output);
+
+    let decoder = match Decoder::new(&data) {
+        Ok(decoder) => decoder,
+        Err(error) => {
+            eprintln!("{}: {}", arguments[1], error);
+            exit(1);
+        }
+    };
+    let mut line = Vec::new();
+    for record in decoder {
+        match record {
+            Ok(record) => {
+                line.clear();
+                append_event(&mut line, &record.to_event());
+                if output.write_all(&line).is_err() {
+                    exit(1);
+                }
+            }
+            Err(error) => {
+                let _ = output.flush();
+                eprintln!("{}: {}", arguments[1], error);
+                exit(1);
+            }
+        }
+    }
+    let _ = output.flush();
+}
@@ -1,16 +1,16 @@
 use timberwolf::{
     lifecycle::{Command, Context},
     log::event::ConsoleReceiver,
-    Game, GameState, ServiceLocator,
+    log_verbose, App, GlobalState, ServiceLocator,
 };
 use winit::Event;
 
 fn main() {
-    let game = Game::new();
-    game.get_services()
+    let app = App::new();
+    app.get_services()
         .log
         .add_receiver(Box::new(ConsoleReceiver::new()));
-    game.run(Box::new(LoadingContext::new()), 60, 20);
+    app.run(Box::new(LoadingContext::new()), 60, 20);
 }
 
 #[derive(Default)]
@@ -22,19 +22,24 @@ impl LoadingContext {
     }
 }
 impl Context for LoadingContext {
-    fn render(&self, delta: f64, services: &ServiceLocator) -> Command {
-        let message = format!("render delta: {}", delta);
-        services.log.verbose("demo", &message);
+    fn render(&self, delta: f64, alpha: f64, services: &ServiceLocator) -> Command {
+        log_verbose!(
+            services.log,
+            "demo",
+            "render delta: {}, alpha: {}",
+            delta,
+            alpha
+        );
         Command::Continue
     }
-    fn update(&self, delta: f64, services: &ServiceLocator, _state: &GameState) -> Command {
-        let message = format!("update delta: {}", delta);
-        services.log.verbose("demo", &message);
+    fn update(&self, delta: f64, services: &ServiceLocator, _state: &GlobalState) -> Command {
+        log_verbose!(services.log, "demo", "update delta: {}", delta);
         Command::Continue
     }
-    fn handle_input(&self, event: Event, services: &ServiceLocator, _state: &GameState) -> Command {
-        let message = format!("handle input: {:#?}", event);
-        services.log.verbose("demo", &message);
+    fn handle_input(&self, event: Event, services: &ServiceLocator, _state: &GlobalState) -> Command {
+        services
+            .log
+            .verbose("demo", format!("handle input: {:#?}", event));
         Command::Continue
     }
 }
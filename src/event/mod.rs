@@ -4,7 +4,10 @@ use std::fmt::Debug;
 use std::slice::Iter;
 use std::sync::Weak;
 
+pub mod source;
+pub mod stats;
 pub mod timing;
+pub mod wheel;
 
 /// an event emitter which other objects can observe
 pub trait Observable {
@@ -107,11 +110,17 @@ pub trait MultipleObserverStorage<'a>: ObserverStorage<'a> {
 }
 
 /// a multi-observable storage backed by Vec
-#[derive(Default)]
 pub struct VecObserverStorage<T> {
     /// the active listeners
     event_listeners: Vec<ObserverSlot<T>>,
 }
+impl<T> Default for VecObserverStorage<T> {
+    fn default() -> Self {
+        Self {
+            event_listeners: Vec::new(),
+        }
+    }
+}
 impl<T> VecObserverStorage<T> {
     fn push_observer_slot(&mut self, observer_slot: ObserverSlot<T>) {
         if let Some(matched_observer_slot) = self
@@ -0,0 +1,266 @@
+//! sources of the current time for clocks, so loops can run in real time, as fast as the CPU
+//! allows on a virtual clock, or replaying the clock readings of a recorded session
+//!
+//! A virtual source only moves forward when a RevLimiter waits for a deadline, which advances it
+//! to the deadline instead of sleeping. Loops sharing a virtual source should run on the same
+//! thread (e.g. all with `Affinity::Main`), so the scheduler wakes them in a deterministic order.
+
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::Mutex;
+use std::time::{Duration, Instant};
+
+#[cfg(target_arch = "x86_64")]
+use std::arch::x86_64::{__cpuid, _rdtsc};
+
+/// a source of the current time
+pub trait TimeSource: Send + Sync {
+    /// the current time
+    fn now(&self) -> Instant;
+
+    /// whether time only passes when the source is advanced, so that waiting for a deadline
+    /// should advance it rather than block
+    fn is_virtual(&self) -> bool {
+        false
+    }
+
+    /// advance a virtual source to a deadline (real time sources ignore this)
+    fn advance_to(&self, _deadline: Instant) {}
+
+    /// whether the order in which loops read the source matters (as it does for recording and
+    /// virtual sources), so loops sharing the source should run on the same thread
+    fn is_deterministic(&self) -> bool {
+        self.is_virtual()
+    }
+}
+
+/// the system's monotonic clock
+#[derive(Clone, Copy, Debug, Default)]
+pub struct RealTime;
+impl TimeSource for RealTime {
+    #[inline]
+    fn now(&self) -> Instant {
+        Instant::now()
+    }
+}
+
+/// the processor's time stamp counter, calibrated against the system's monotonic clock, which
+/// reads the time with a single instruction instead of a (possibly virtualized) clock call
+///
+/// The counter drifts from the system clock by the calibration error, which shrinks as the
+/// calibration period grows (a period of 100ms is typically accurate to within a microsecond
+/// per second).
+#[cfg(target_arch = "x86_64")]
+pub struct Tsc {
+    origin: Instant,
+    origin_ticks: u64,
+    nanoseconds_per_tick: f64,
+}
+#[cfg(target_arch = "x86_64")]
+impl Tsc {
+    /// calibrate the counter against the system clock over a period, or `None` if the processor
+    /// has no invariant time stamp counter (one which ticks at a constant rate in every power
+    /// state, and is synchronized between cores)
+    pub fn calibrate(period: Duration) -> Option<Self> {
+        // SAFETY: cpuid and rdtsc are available on every x86-64 processor
+        let invariant = unsafe {
+            __cpuid(0x8000_0000).eax >= 0x8000_0007 && __cpuid(0x8000_0007).edx & (1 << 8) != 0
+        };
+        if !invariant {
+            return None;
+        }
+        let (start, start_ticks) = Self::sample();
+        let mut end = start;
+        let mut end_ticks = start_ticks;
+        while end - start < period {
+            std::thread::sleep(period - (end - start));
+            let (now, now_ticks) = Self::sample();
+            end = now;
+            end_ticks = now_ticks;
+        }
+        if end_ticks <= start_ticks {
+            return None;
+        }
+        Some(Self {
+            origin: end,
+            origin_ticks: end_ticks,
+            nanoseconds_per_tick: (end - start).as_nanos() as f64
+                / (end_ticks - start_ticks) as f64,
+        })
+    }
+
+    /// read the system clock and the counter as close together as possible
+    fn sample() -> (Instant, u64) {
+        // SAFETY: rdtsc is available on every x86-64 processor
+        let before = unsafe { _rdtsc() };
+        let now = Instant::now();
+        let after = unsafe { _rdtsc() };
+        (now, before + (after - before) / 2)
+    }
+}
+#[cfg(target_arch = "x86_64")]
+impl TimeSource for Tsc {
+    #[inline]
+    fn now(&self) -> Instant {
+        // SAFETY: rdtsc is available on every x86-64 processor
+        let ticks = unsafe { _rdtsc() }.saturating_sub(self.origin_ticks);
+        self.origin + Duration::from_nanos((ticks as f64 * self.nanoseconds_per_tick) as u64)
+    }
+}
+
+/// a clock which only moves when it is advanced, for headless runs which simulate ticks as fast
+/// as possible with exact deltas
+pub struct VirtualClock {
+    origin: Instant,
+    /// the virtual time since the origin in nanoseconds
+    elapsed: AtomicU64,
+}
+impl Default for VirtualClock {
+    fn default() -> Self {
+        Self {
+            origin: Instant::now(),
+            elapsed: AtomicU64::new(0),
+        }
+    }
+}
+impl VirtualClock {
+    /// create a virtual clock at time zero
+    pub fn new() -> Self {
+        Default::default()
+    }
+
+    /// the virtual time which has passed
+    pub fn elapsed(&self) -> Duration {
+        Duration::from_nanos(self.elapsed.load(Ordering::Acquire))
+    }
+
+    /// let some virtual time pass
+    pub fn advance(&self, duration: Duration) {
+        self.elapsed
+            .fetch_add(duration.as_nanos() as u64, Ordering::AcqRel);
+    }
+}
+impl TimeSource for VirtualClock {
+    fn now(&self) -> Instant {
+        self.origin + self.elapsed()
+    }
+
+    fn is_virtual(&self) -> bool {
+        true
+    }
+
+    fn advance_to(&self, deadline: Instant) {
+        let elapsed = deadline.saturating_duration_since(self.origin).as_nanos() as u64;
+        self.elapsed.fetch_max(elapsed, Ordering::AcqRel);
+    }
+}
+
+/// the system's monotonic clock, recording every reading for a `ReplayClock` to play back (loops
+/// sharing a recording clock should run on the same thread, so they read it in the same order
+/// when replayed)
+pub struct RecordingClock {
+    origin: Instant,
+    readings: Mutex<Vec<Duration>>,
+}
+impl Default for RecordingClock {
+    fn default() -> Self {
+        Self {
+            origin: Instant::now(),
+            readings: Default::default(),
+        }
+    }
+}
+impl RecordingClock {
+    /// create a recording clock with no readings
+    pub fn new() -> Self {
+        Default::default()
+    }
+
+    /// a copy of every reading so far, as the time since the clock was created
+    pub fn readings(&self) -> Vec<Duration> {
+        self.readings
+            .lock()
+            .expect("clock readings is poisoned")
+            .clone()
+    }
+}
+impl TimeSource for RecordingClock {
+    fn now(&self) -> Instant {
+        let now = Instant::now();
+        self.readings
+            .lock()
+            .expect("clock readings is poisoned")
+            .push(now - self.origin);
+        now
+    }
+
+    fn is_deterministic(&self) -> bool {
+        true
+    }
+}
+
+/// a virtual clock which plays back the readings of a `RecordingClock` in order, so a loop given
+/// the same inputs computes bit-identical deltas, and then carries on as a `VirtualClock`
+pub struct ReplayClock {
+    origin: Instant,
+    readings: Vec<Duration>,
+    /// the index of the next reading
+    next: AtomicUsize,
+    /// the virtual time since the origin in nanoseconds, once the readings have run out
+    elapsed: AtomicU64,
+}
+impl ReplayClock {
+    /// create a clock which plays back recorded readings
+    pub fn new(readings: Vec<Duration>) -> Self {
+        Self {
+            origin: Instant::now(),
+            elapsed: AtomicU64::new(readings.last().map_or(0, |last| last.as_nanos() as u64)),
+            readings,
+            next: AtomicUsize::new(0),
+        }
+    }
+
+    /// whether every reading has been played back
+    pub fn is_finished(&self) -> bool {
+        self.next.load(Ordering::Acquire) >= self.readings.len()
+    }
+}
+impl TimeSource for ReplayClock {
+    fn now(&self) -> Instant {
+        let index = self.next.fetch_add(1, Ordering::AcqRel);
+        match self.readings.get(index) {
+            Some(&reading) => self.origin + reading,
+            None => {
+                self.next.store(self.readings.len(), Ordering::Release);
+                self.origin + Duration::from_nanos(self.elapsed.load(Ordering::Acquire))
+            }
+        }
+    }
+
+    fn is_virtual(&self) -> bool {
+        true
+    }
+
+    fn advance_to(&self, deadline: Instant) {
+        if self.is_finished() {
+            let elapsed = deadline.saturating_duration_since(self.origin).as_nanos() as u64;
+            self.elapsed.fetch_max(elapsed, Ordering::AcqRel);
+        }
+    }
+}
+
+#[cfg(target_arch = "x86_64")]
+#[test]
+fn tsc_follows_the_system_clock() {
+    let tsc = match Tsc::calibrate(Duration::from_millis(20)) {
+        Some(tsc) => tsc,
+        None => return,
+    };
+    std::thread::sleep(Duration::from_millis(10));
+    let (real, counted) = (Instant::now(), tsc.now());
+    let error = if real > counted {
+        real - counted
+    } else {
+        counted - real
+    };
+    assert!(error < Duration::from_millis(1), "tsc is {:?} out", error);
+}
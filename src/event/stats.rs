@@ -0,0 +1,285 @@
+//! frame timing statistics, recorded by a RevLimiter into lock-free histograms which any thread
+//! can read while the loop is running
+
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::Duration;
+
+/// the number of linear sub-buckets per power of two in a histogram (bounding the relative error
+/// of a percentile to 1/16)
+const SUB_BUCKETS: usize = 16;
+/// log2 of `SUB_BUCKETS`
+const SUB_BUCKET_BITS: u32 = 4;
+/// the largest value a histogram distinguishes (about 4.3 seconds), above which values are
+/// counted in the last bucket
+const MAX_VALUE: u64 = (1 << 32) - 1;
+/// the number of buckets in a histogram
+const BUCKETS: usize = (32 - SUB_BUCKET_BITS as usize + 1) * SUB_BUCKETS;
+
+/// a fixed-size log-linear histogram of durations, in nanoseconds, which can be recorded into and
+/// read from concurrently without locks
+pub struct Histogram {
+    counts: Box<[AtomicU64]>,
+    max: AtomicU64,
+}
+impl Default for Histogram {
+    fn default() -> Self {
+        Self {
+            counts: (0..BUCKETS).map(|_| AtomicU64::new(0)).collect(),
+            max: AtomicU64::new(0),
+        }
+    }
+}
+impl Histogram {
+    fn index(value: u64) -> usize {
+        let value = value.min(MAX_VALUE);
+        if value < SUB_BUCKETS as u64 {
+            return value as usize;
+        }
+        let exponent = 63 - value.leading_zeros();
+        let sub_bucket = (value >> (exponent - SUB_BUCKET_BITS)) as usize & (SUB_BUCKETS - 1);
+        (exponent - SUB_BUCKET_BITS + 1) as usize * SUB_BUCKETS + sub_bucket
+    }
+
+    /// the midpoint of the range of values counted in a bucket
+    fn value(index: usize) -> u64 {
+        if index < SUB_BUCKETS {
+            return index as u64;
+        }
+        let shift = (index / SUB_BUCKETS) as u32 - 1;
+        let low = ((SUB_BUCKETS + index % SUB_BUCKETS) as u64) << shift;
+        low + (1 << shift) / 2
+    }
+
+    /// count a duration
+    pub fn record(&self, duration: Duration) {
+        let value = duration.as_nanos().min(u128::from(u64::MAX)) as u64;
+        self.counts[Self::index(value)].fetch_add(1, Ordering::Relaxed);
+        self.max.fetch_max(value, Ordering::Relaxed);
+    }
+
+    /// the number of durations counted
+    pub fn count(&self) -> u64 {
+        self.counts
+            .iter()
+            .map(|count| count.load(Ordering::Relaxed))
+            .sum()
+    }
+
+    /// the longest duration counted
+    pub fn max(&self) -> Duration {
+        Duration::from_nanos(self.max.load(Ordering::Relaxed))
+    }
+
+    /// the duration below which a fraction (from 0.0 to 1.0) of the counted durations fall, to
+    /// within 1/16 of its value
+    pub fn percentile(&self, fraction: f64) -> Duration {
+        let counts: Vec<u64> = self
+            .counts
+            .iter()
+            .map(|count| count.load(Ordering::Relaxed))
+            .collect();
+        let total: u64 = counts.iter().sum();
+        if total == 0 {
+            return Duration::new(0, 0);
+        }
+        let rank = ((total as f64 * fraction.clamp(0.0, 1.0)).ceil() as u64).max(1);
+        let mut seen = 0;
+        for (index, count) in counts.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return Duration::from_nanos(Self::value(index)).min(self.max());
+            }
+        }
+        self.max()
+    }
+
+    /// the median, 95th and 99th percentile durations
+    pub fn percentiles(&self) -> Percentiles {
+        Percentiles {
+            p50: self.percentile(0.50),
+            p95: self.percentile(0.95),
+            p99: self.percentile(0.99),
+            max: self.max(),
+        }
+    }
+
+    /// forget every counted duration
+    pub fn reset(&self) {
+        for count in self.counts.iter() {
+            count.store(0, Ordering::Relaxed);
+        }
+        self.max.store(0, Ordering::Relaxed);
+    }
+}
+
+/// a summary of a histogram
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct Percentiles {
+    /// the median
+    pub p50: Duration,
+    /// the 95th percentile
+    pub p95: Duration,
+    /// the 99th percentile
+    pub p99: Duration,
+    /// the maximum
+    pub max: Duration,
+}
+
+/// a summary of a loop's timing statistics
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct FrameReport {
+    /// the number of iterations recorded
+    pub frames: u64,
+    /// the number of intervals missed by iterations which ran more than half an interval late
+    pub dropped_frames: u64,
+    /// the time between the starts of consecutive iterations
+    pub frame_time: Percentiles,
+    /// the time from the start to the end of each iteration
+    pub work_time: Percentiles,
+    /// the time each iteration planned to wait for
+    pub sleep_time: Percentiles,
+    /// how far each wait overshot its deadline
+    pub oversleep: Percentiles,
+    /// the lag after the latest iteration
+    pub lag: Duration,
+    /// the achieved number of iterations per second
+    pub tick_rate: f64,
+    /// how far the achieved rate is from the target rate, as a fraction of the target (negative
+    /// if the loop runs slow)
+    pub rate_deviation: f64,
+}
+
+/// timing statistics for a loop, recorded by its RevLimiter (see `RevLimiterBuilder::with_stats`)
+#[derive(Default)]
+pub struct FrameStats {
+    /// the time between the starts of consecutive iterations
+    pub frame_time: Histogram,
+    /// the time from the start to the end of each iteration
+    pub work_time: Histogram,
+    /// the time each iteration planned to wait for
+    pub sleep_time: Histogram,
+    /// how far each wait overshot its deadline
+    pub oversleep: Histogram,
+    dropped_frames: AtomicU64,
+    /// the sum of all frame times in nanoseconds
+    total_time: AtomicU64,
+    /// the latest lag in nanoseconds
+    lag: AtomicU64,
+    /// the target interval in nanoseconds
+    interval: AtomicU64,
+}
+impl FrameStats {
+    /// create empty frame statistics
+    pub fn new() -> Self {
+        Default::default()
+    }
+
+    /// record the time between the starts of two iterations of a loop with a target interval
+    pub fn record_frame(&self, frame_time: Duration, interval: Duration) {
+        self.frame_time.record(frame_time);
+        self.total_time
+            .fetch_add(frame_time.as_nanos() as u64, Ordering::Relaxed);
+        self.interval
+            .store(interval.as_nanos() as u64, Ordering::Relaxed);
+        if interval > Duration::new(0, 0) {
+            let slots = (frame_time.as_secs_f64() / interval.as_secs_f64()).round() as u64;
+            if slots > 1 {
+                self.dropped_frames.fetch_add(slots - 1, Ordering::Relaxed);
+            }
+        }
+    }
+
+    /// record the end of an iteration
+    pub fn record_work(&self, work_time: Duration, sleep_time: Duration, lag: Duration) {
+        self.work_time.record(work_time);
+        self.sleep_time.record(sleep_time);
+        self.lag.store(lag.as_nanos() as u64, Ordering::Relaxed);
+    }
+
+    /// record how far a wait overshot its deadline
+    pub fn record_oversleep(&self, oversleep: Duration) {
+        self.oversleep.record(oversleep);
+    }
+
+    /// the number of intervals missed by iterations which ran more than half an interval late
+    pub fn dropped_frames(&self) -> u64 {
+        self.dropped_frames.load(Ordering::Relaxed)
+    }
+
+    /// summarize the statistics
+    pub fn report(&self) -> FrameReport {
+        let frames = self.frame_time.count();
+        let total_time = self.total_time.load(Ordering::Relaxed);
+        let interval = self.interval.load(Ordering::Relaxed);
+        let tick_rate = if total_time > 0 {
+            frames as f64 * 1_000_000_000.0 / total_time as f64
+        } else {
+            0.0
+        };
+        let rate_deviation = if interval > 0 && tick_rate > 0.0 {
+            tick_rate * interval as f64 / 1_000_000_000.0 - 1.0
+        } else {
+            0.0
+        };
+        FrameReport {
+            frames,
+            dropped_frames: self.dropped_frames(),
+            frame_time: self.frame_time.percentiles(),
+            work_time: self.work_time.percentiles(),
+            sleep_time: self.sleep_time.percentiles(),
+            oversleep: self.oversleep.percentiles(),
+            lag: Duration::from_nanos(self.lag.load(Ordering::Relaxed)),
+            tick_rate,
+            rate_deviation,
+        }
+    }
+
+    /// forget every recorded iteration
+    pub fn reset(&self) {
+        self.frame_time.reset();
+        self.work_time.reset();
+        self.sleep_time.reset();
+        self.oversleep.reset();
+        self.dropped_frames.store(0, Ordering::Relaxed);
+        self.total_time.store(0, Ordering::Relaxed);
+    }
+}
+
+#[test]
+fn histogram_percentiles_are_within_bucket_precision() {
+    let histogram = Histogram::default();
+    for micros in 1..=1000 {
+        histogram.record(Duration::from_micros(micros));
+    }
+    assert_eq!(histogram.count(), 1000);
+    let close = |actual: Duration, expected: Duration| {
+        let error = (actual.as_secs_f64() - expected.as_secs_f64()).abs();
+        error <= expected.as_secs_f64() / 16.0
+    };
+    assert!(close(
+        histogram.percentile(0.50),
+        Duration::from_micros(500)
+    ));
+    assert!(close(
+        histogram.percentile(0.99),
+        Duration::from_micros(990)
+    ));
+    assert_eq!(histogram.max(), Duration::from_micros(1000));
+    assert!(histogram.percentile(1.0) <= histogram.max());
+}
+
+#[test]
+fn frame_stats_count_dropped_frames_and_deviation() {
+    let stats = FrameStats::new();
+    let interval = Duration::from_millis(10);
+    for _ in 0..8 {
+        stats.record_frame(Duration::from_millis(10), interval);
+    }
+    stats.record_frame(Duration::from_millis(31), interval);
+    stats.record_frame(Duration::from_millis(14), interval);
+    let report = stats.report();
+    assert_eq!(report.frames, 10);
+    assert_eq!(report.dropped_frames, 2);
+    assert!((report.tick_rate - 80.0).abs() < 0.01);
+    assert!((report.rate_deviation + 0.2).abs() < 0.0001);
+}
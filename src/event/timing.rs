@@ -1,18 +1,36 @@
 //! event emitters based on timing
 
+use crate::event::source::{RealTime, TimeSource};
+use crate::event::stats::FrameStats;
+use crate::event::wheel::{TimerWheel, WheelKey};
 use crate::event::{Observable, ObserverStorage, VecObserverStorage};
 use std::cell::Cell;
+use std::sync::atomic::{AtomicI64, AtomicU64, Ordering};
+use std::sync::Arc;
+use std::thread::{sleep, yield_now};
 use std::time::{Duration, Instant};
 
+thread_local! {
+    /// the time the current iteration of the loop running on this thread began
+    static FRAME_TIME: Cell<Option<Instant>> = const { Cell::new(None) };
+}
+
+/// the time the current iteration of the loop running on this thread began, as read once by its
+/// RevLimiter (so logs and timers can share the reading instead of reading the clock again), or
+/// `None` if no loop has begun an iteration on this thread
+#[inline]
+pub fn frame_time() -> Option<Instant> {
+    FRAME_TIME.with(Cell::get)
+}
+
 /// keeps track of the passing of time from a recorded instant
 pub struct Clock {
+    source: Arc<dyn TimeSource>,
     reset_time: Cell<Instant>,
 }
 impl Default for Clock {
     fn default() -> Self {
-        Self {
-            reset_time: Cell::new(Instant::now()),
-        }
+        Self::with_source(Arc::new(RealTime))
     }
 }
 impl Clock {
@@ -21,14 +39,47 @@ impl Clock {
         Default::default()
     }
 
+    /// create a new clock which reads the time from a source (starting from the moment it's
+    /// created)
+    pub fn with_source(source: Arc<dyn TimeSource>) -> Self {
+        Self {
+            reset_time: Cell::new(source.now()),
+            source,
+        }
+    }
+
+    /// the source the clock reads the time from
+    pub fn source(&self) -> &Arc<dyn TimeSource> {
+        &self.source
+    }
+
+    /// the current time, according to the clock's source
+    pub fn now(&self) -> Instant {
+        self.source.now()
+    }
+
     /// reset the clock back to its 0-state (no elapsed time)
     pub fn reset(&self) {
-        self.reset_time.set(Instant::now());
+        self.reset_time.set(self.source.now());
+    }
+
+    /// read the clock once, resetting it and returning the duration which elapsed before the
+    /// reset (so no time goes unmeasured between reading and resetting)
+    pub fn lap(&self) -> Duration {
+        let now = self.source.now();
+        now.saturating_duration_since(self.reset_time.replace(now))
+    }
+
+    /// the time the clock was last reset
+    pub fn reset_time(&self) -> Instant {
+        self.reset_time.get()
     }
 
     /// get the elapsed duration
     pub fn elapsed(&self) -> Duration {
-        Instant::now() - self.reset_time.get()
+        self.source
+            .now()
+            .saturating_duration_since(self.reset_time.get())
     }
 
     /// get the number of elapsed seconds as a 64-bit float
@@ -37,6 +88,235 @@ impl Clock {
     }
 }
 
+/// how a RevLimiter waits out the remainder of each iteration
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum WaitStrategy {
+    /// sleep for the whole wait, which the OS scheduler may overshoot by a millisecond or more
+    Sleep,
+    /// sleep for most of the wait, then yield in a loop until the deadline, sleeping short of it
+    /// by a self-calibrating estimate of how far the platform oversleeps
+    Hybrid,
+    /// yield in a loop for the whole wait (the most precise, and the most expensive)
+    Spin,
+}
+
+/// a self-calibrating estimate of how far the platform oversleeps a requested duration, kept as
+/// exponentially weighted averages of the overshoot and of its deviation
+#[derive(Clone, Copy, Debug)]
+pub struct SleepEstimate {
+    /// the average overshoot in seconds
+    mean: f64,
+    /// the average absolute deviation of the overshoot from its mean, in seconds
+    deviation: f64,
+}
+impl Default for SleepEstimate {
+    /// start from a pessimistic 1ms overshoot, which converges down after a few sleeps
+    fn default() -> Self {
+        Self {
+            mean: 0.001,
+            deviation: 0.000_25,
+        }
+    }
+}
+impl SleepEstimate {
+    /// the longest the estimate ever allows a hybrid wait to spin for
+    pub const MAX_MARGIN: Duration = Duration::from_millis(4);
+
+    /// how far short of a deadline to stop sleeping, so that the wait can end on time
+    pub fn margin(&self) -> Duration {
+        let margin = self.mean + 4.0 * self.deviation;
+        Duration::from_secs_f64(margin.max(0.0)).min(Self::MAX_MARGIN)
+    }
+
+    /// record how long a sleep actually took compared to how long was requested
+    pub fn record(&mut self, requested: Duration, actual: Duration) {
+        let overshoot = actual.as_secs_f64() - requested.as_secs_f64();
+        let error = overshoot - self.mean;
+        self.mean += error / 8.0;
+        self.deviation += (error.abs() - self.deviation) / 4.0;
+    }
+}
+
+/// a fixed-timestep accumulator, which turns the time passing between wakes of a loop into a
+/// whole number of ticks of equal length, carrying the remainder over to the next wake
+#[derive(Clone, Copy, Debug)]
+pub struct Accumulator {
+    /// the most ticks run in a single wake, beyond which the backlog is discarded instead of
+    /// letting a slow loop fall further and further behind (the "spiral of death")
+    pub max_ticks: u32,
+    /// loop time accumulated but not yet consumed by a tick
+    remainder: Duration,
+    /// when the loop last woke, or `None` before its first wake
+    last_wake: Option<Instant>,
+    /// the number of ticks discarded because of the limit
+    dropped_ticks: u64,
+}
+impl Accumulator {
+    /// create an empty accumulator which runs at most `max_ticks` ticks per wake
+    pub fn new(max_ticks: u32) -> Self {
+        Self {
+            max_ticks: max_ticks.max(1),
+            remainder: Duration::new(0, 0),
+            last_wake: None,
+            dropped_ticks: 0,
+        }
+    }
+
+    /// add loop time to the accumulator, and take out as many whole ticks of length `step` as it
+    /// covers (up to the limit)
+    pub fn accumulate(&mut self, time: Duration, step: Duration) -> u32 {
+        let step_nanos = step.as_nanos().max(1);
+        let total = self.remainder.as_nanos() + time.as_nanos();
+        let ticks = total / step_nanos;
+        self.remainder = Duration::from_nanos((total % step_nanos) as u64);
+        if ticks > u128::from(self.max_ticks) {
+            self.dropped_ticks += (ticks - u128::from(self.max_ticks)) as u64;
+            return self.max_ticks;
+        }
+        ticks as u32
+    }
+
+    /// the loop time accumulated towards the next tick
+    pub fn remainder(&self) -> Duration {
+        self.remainder
+    }
+
+    /// the number of ticks discarded because more than `max_ticks` were due in a single wake
+    pub fn dropped_ticks(&self) -> u64 {
+        self.dropped_ticks
+    }
+}
+
+/// what a RevLimiter does once it has fallen behind for a sustained period
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum OverloadStrategy {
+    /// lengthen the interval by a factor (lowering the tick rate), down to a minimum frequency
+    DegradeRate {
+        /// the factor the interval is multiplied by at each step (greater than 1.0)
+        factor: f64,
+        /// the lowest frequency the loop is degraded to
+        min_frequency: f64,
+    },
+    /// slow the passing of loop time by a factor, down to a minimum speed (which reduces the
+    /// number of ticks a fixed-timestep loop runs, and otherwise only slows the game down)
+    ScaleSpeed {
+        /// the factor the speed is multiplied by at each step (between 0.0 and 1.0)
+        factor: f64,
+        /// the lowest speed the loop is slowed to
+        min_speed: f64,
+    },
+    /// forget the lag, dropping the ticks it would take to catch up
+    DropTicks,
+}
+
+/// a notification from an overload policy about the loop it governs
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum OverloadEvent {
+    /// the loop fell behind by `lag` for the sustain period, so its lag was dropped and it was
+    /// degraded by a step (if the strategy degrades)
+    Overloaded {
+        /// the lag which was dropped
+        lag: Duration,
+        /// the loop's interval afterwards
+        interval: Duration,
+        /// the loop's speed afterwards
+        speed: f64,
+    },
+    /// the loop kept up for the recovery period, so it was restored by a step
+    Recovered {
+        /// the loop's interval afterwards
+        interval: Duration,
+        /// the loop's speed afterwards
+        speed: f64,
+    },
+}
+
+/// a policy for degrading a RevLimiter gracefully when it falls behind for a sustained period,
+/// rather than letting it catch up without bound, and restoring it once it keeps up again
+pub struct OverloadPolicy {
+    /// what to do when the loop is overloaded
+    pub strategy: OverloadStrategy,
+    /// the lag above which an iteration counts as overloaded
+    pub threshold: Duration,
+    /// the number of consecutive overloaded iterations before acting
+    pub sustain: u32,
+    /// the number of consecutive iterations lagging less than half the threshold before restoring
+    /// the loop by a step
+    pub recover: u32,
+    /// observers notified of each action taken
+    pub observers: VecObserverStorage<OverloadEvent>,
+    overloaded: u32,
+    healthy: u32,
+    /// the number of degradation steps currently applied
+    steps: u32,
+    /// the interval and speed before the first degradation step
+    base: (Duration, f64),
+}
+impl OverloadPolicy {
+    /// create a policy which acts after `sustain` consecutive iterations lagging more than
+    /// `threshold`, and recovers after ten times as many iterations which keep up
+    pub fn new(strategy: OverloadStrategy, threshold: Duration, sustain: u32) -> Self {
+        Self {
+            strategy,
+            threshold,
+            sustain: sustain.max(1),
+            recover: sustain.max(1).saturating_mul(10),
+            observers: Default::default(),
+            overloaded: 0,
+            healthy: 0,
+            steps: 0,
+            base: (Duration::new(0, 0), 1.0),
+        }
+    }
+
+    /// set the number of consecutive iterations which keep up before restoring the loop by a step
+    pub fn with_recovery(mut self, iterations: u32) -> Self {
+        self.recover = iterations.max(1);
+        self
+    }
+
+    /// the number of degradation steps currently applied
+    pub fn steps(&self) -> u32 {
+        self.steps
+    }
+
+    /// the interval and speed after a number of degradation steps from the base (never beyond
+    /// the limit, and never faster than the base if the base is already beyond the limit)
+    fn degraded(&self, steps: u32) -> (Duration, f64) {
+        let (interval, speed) = self.base;
+        if steps == 0 {
+            return self.base;
+        }
+        match self.strategy {
+            OverloadStrategy::DegradeRate {
+                factor,
+                min_frequency,
+            } => {
+                let mut seconds = interval.as_secs_f64() * factor.powi(steps as i32);
+                if min_frequency > 0.0 {
+                    seconds = seconds.min((1.0 / min_frequency).max(interval.as_secs_f64()));
+                }
+                (
+                    Duration::try_from_secs_f64(seconds).unwrap_or(Duration::MAX),
+                    speed,
+                )
+            }
+            OverloadStrategy::ScaleSpeed { factor, min_speed } => (
+                interval,
+                (speed * factor.powi(steps as i32)).max(min_speed.min(speed)),
+            ),
+            OverloadStrategy::DropTicks => (interval, speed),
+        }
+    }
+}
+impl Observable for OverloadPolicy {
+    type NotificationType = OverloadEvent;
+
+    fn notify_observers(&self, notification: Self::NotificationType) {
+        self.observers.notify_observers(notification)
+    }
+}
+
 /// an object that provides a means of controlling the rate at which a loop is run
 pub struct RevLimiter {
     /// whether or not each iteration advances by the same interval despite jitter (deterministic loops)
@@ -51,6 +331,21 @@ pub struct RevLimiter {
     pub lag: Duration,
     /// the ratio of passing time in the loop to passing real time
     pub speed: f64,
+    /// how the remainder of each iteration is waited out by `wait`
+    pub wait_strategy: WaitStrategy,
+    /// the calibrated overshoot of sleeping on this thread, used by the hybrid wait strategy
+    pub sleep_estimate: SleepEstimate,
+    /// the fixed-timestep accumulator, or `None` if the loop runs one iteration per wake
+    pub accumulator: Option<Accumulator>,
+    /// where each iteration's timings are recorded, if anywhere
+    pub stats: Option<Arc<FrameStats>>,
+    /// how the loop degrades when it falls behind, if at all
+    pub overload_policy: Option<OverloadPolicy>,
+    /// the loop's timers, fired by `begin` (or by the scheduler before each tick of a
+    /// fixed-timestep loop)
+    pub timers: Timers,
+    /// when the latest iteration began, for measuring frame times
+    last_begin: Option<Instant>,
 }
 impl RevLimiter {
     /// call the callback, automatically calculating delta time
@@ -81,6 +376,16 @@ impl RevLimiter {
 
     /// get the time to wait until the next loop iteration should run
     fn get_wait(&self, current_elapsed: Duration) -> Duration {
+        if let Some(ref accumulator) = self.accumulator {
+            // sleep until the next tick is due, in real time
+            let remaining = self.interval.saturating_sub(accumulator.remainder());
+            let remaining = if self.speed > 0.0 {
+                remaining.div_f64(self.speed)
+            } else {
+                self.interval
+            };
+            return remaining.saturating_sub(current_elapsed);
+        }
         Self::calculate_wait(current_elapsed, self.interval, self.lag)
     }
 
@@ -115,19 +420,189 @@ impl RevLimiter {
 
     /// signal that execution for this iteration of the loop has started, mainly for the purpose of starting a timer
     pub fn begin(&mut self) -> f64 {
-        let delta = self.get_delta(self.clock.elapsed());
-        self.clock.reset();
+        let lap = self.clock.lap();
+        let delta = self.get_delta(lap);
+        // timers advance by the whole iteration, including the work since the previous begin
+        let frame = self.record_begin().unwrap_or(lap);
+        if !self.timers.is_empty() {
+            self.timers
+                .tick(Duration::from_secs_f64(self.get_delta(frame)));
+        }
         delta
     }
 
+    /// share the time the iteration began with the rest of the thread, returning the time since
+    /// the previous iteration began, if there was one (recording it, if recording statistics)
+    fn record_begin(&mut self) -> Option<Duration> {
+        let now = self.clock.reset_time.get();
+        FRAME_TIME.with(|frame_time| frame_time.set(Some(now)));
+        let frame = self
+            .last_begin
+            .replace(now)
+            .map(|last_begin| now - last_begin);
+        if let (Some(ref stats), Some(frame)) = (&self.stats, frame) {
+            stats.record_frame(frame, self.interval);
+        }
+        frame
+    }
+
     /// signal that execution for this iteration of the loop has completed, and prepare for the next iteration
     pub fn end(&mut self) -> Duration {
-        let wait = self.get_wait(self.clock.elapsed());
+        let work_time = self.clock.lap();
+        let wait = self.get_wait(work_time);
+        if self.accumulator.is_none() {
+            self.update_lag(wait);
+        }
+        self.apply_overload_policy();
+        if let Some(ref stats) = self.stats {
+            stats.record_work(work_time, wait, self.lag);
+        }
+        wait
+    }
+
+    /// signal that the loop has woken, returning how many ticks to run (each advancing by
+    /// `tick_delta`), which is one without a fixed-timestep accumulator
+    pub fn begin_ticks(&mut self) -> u32 {
         self.clock.reset();
-        self.update_lag(wait);
+        self.record_begin();
+        let now = self.clock.reset_time.get();
+        let (interval, speed) = (self.interval, self.speed);
+        match self.accumulator {
+            Some(ref mut accumulator) => {
+                // the first wake runs a tick straight away
+                let elapsed = accumulator
+                    .last_wake
+                    .map_or(interval, |last_wake| (now - last_wake).mul_f64(speed));
+                accumulator.last_wake = Some(now);
+                let dropped_ticks = accumulator.dropped_ticks;
+                let ticks = accumulator.accumulate(elapsed, interval);
+                // the lag is how far behind the loop was when it woke, beyond a single tick
+                let behind = u64::from(ticks) + (accumulator.dropped_ticks - dropped_ticks);
+                self.lag = interval * behind.saturating_sub(1).min(u64::from(u32::MAX)) as u32;
+                ticks
+            }
+            None => 1,
+        }
+    }
+
+    /// count overloaded iterations, and degrade or restore the loop according to the policy
+    fn apply_overload_policy(&mut self) {
+        let policy = match self.overload_policy {
+            Some(ref mut policy) => policy,
+            None => return,
+        };
+        if self.lag > policy.threshold {
+            policy.overloaded += 1;
+            policy.healthy = 0;
+        } else {
+            policy.overloaded = 0;
+            if self.lag <= policy.threshold / 2 {
+                policy.healthy += 1;
+            } else {
+                policy.healthy = 0;
+            }
+        }
+        if policy.overloaded >= policy.sustain {
+            policy.overloaded = 0;
+            if policy.steps == 0 {
+                policy.base = (self.interval, self.speed);
+            }
+            if policy.strategy != OverloadStrategy::DropTicks {
+                let (interval, speed) = policy.degraded(policy.steps + 1);
+                // once the loop is degraded as far as it goes, another step would change nothing
+                // and only delay recovery
+                if (interval, speed) != policy.degraded(policy.steps) {
+                    policy.steps += 1;
+                }
+                self.interval = interval;
+                self.speed = speed;
+            }
+            let lag = self.lag;
+            self.lag = Duration::new(0, 0);
+            if let Some(ref mut accumulator) = self.accumulator {
+                accumulator.remainder = Duration::new(0, 0);
+            }
+            policy.notify_observers(OverloadEvent::Overloaded {
+                lag,
+                interval: self.interval,
+                speed: self.speed,
+            });
+        } else if policy.steps > 0 && policy.healthy >= policy.recover {
+            policy.healthy = 0;
+            policy.steps -= 1;
+            let (interval, speed) = policy.degraded(policy.steps);
+            self.interval = interval;
+            self.speed = speed;
+            policy.notify_observers(OverloadEvent::Recovered {
+                interval: self.interval,
+                speed: self.speed,
+            });
+        }
+    }
+
+    /// the delta time of each tick run by a fixed-timestep loop, in seconds
+    pub fn tick_delta(&self) -> f64 {
+        self.interval.as_secs_f64()
+    }
+
+    /// how far the loop is between its last tick and the next, from 0.0 to 1.0 (always 1.0
+    /// without a fixed-timestep accumulator)
+    pub fn alpha(&self) -> f64 {
+        match self.accumulator {
+            Some(ref accumulator) => {
+                (accumulator.remainder().as_secs_f64() / self.interval.as_secs_f64()).min(1.0)
+            }
+            None => 1.0,
+        }
+    }
+
+    /// signal that execution for this iteration of the loop has completed, and block the thread
+    /// until the next iteration should run, using the wait strategy (returning the duration that
+    /// was waited for)
+    pub fn wait(&mut self) -> Duration {
+        let wait = self.end();
+        self.wait_until(self.clock.reset_time.get() + wait);
         wait
     }
 
+    /// the current time, according to the loop's clock
+    pub fn now(&self) -> Instant {
+        self.clock.now()
+    }
+
+    /// block the thread until a deadline, using the wait strategy (or advance the clock to the
+    /// deadline without blocking, if it reads from a virtual time source)
+    pub fn wait_until(&mut self, deadline: Instant) {
+        if self.clock.source.is_virtual() {
+            self.clock.source.advance_to(deadline);
+            return;
+        }
+        self.wait_until_deadline(deadline);
+        if let Some(ref stats) = self.stats {
+            stats.record_oversleep(Instant::now().saturating_duration_since(deadline));
+        }
+    }
+
+    fn wait_until_deadline(&mut self, deadline: Instant) {
+        if self.wait_strategy == WaitStrategy::Sleep {
+            sleep(deadline.saturating_duration_since(Instant::now()));
+            return;
+        }
+        if self.wait_strategy == WaitStrategy::Hybrid {
+            let start = Instant::now();
+            let requested = deadline
+                .saturating_duration_since(start)
+                .saturating_sub(self.sleep_estimate.margin());
+            if requested > Duration::new(0, 0) {
+                sleep(requested);
+                self.sleep_estimate.record(requested, start.elapsed());
+            }
+        }
+        while Instant::now() < deadline {
+            yield_now();
+        }
+    }
+
     /// set the interval in seconds
     pub fn set_interval(&mut self, seconds: f64) {
         self.interval = Duration::from_nanos((seconds * 1_000_000_000.0) as u64);
@@ -155,6 +630,13 @@ impl RevLimiterBuilder {
                 clock: Clock::new(),
                 lag: Duration::new(0, 0),
                 speed: 1.0,
+                wait_strategy: WaitStrategy::Sleep,
+                sleep_estimate: SleepEstimate::default(),
+                accumulator: None,
+                stats: None,
+                overload_policy: None,
+                timers: Default::default(),
+                last_begin: None,
             },
         }
     }
@@ -169,6 +651,13 @@ impl RevLimiterBuilder {
                 clock: Clock::new(),
                 lag: Duration::new(0, 0),
                 speed: 1.0,
+                wait_strategy: WaitStrategy::Sleep,
+                sleep_estimate: SleepEstimate::default(),
+                accumulator: None,
+                stats: None,
+                overload_policy: None,
+                timers: Default::default(),
+                last_begin: None,
             },
         }
     }
@@ -197,6 +686,46 @@ impl RevLimiterBuilder {
         self
     }
 
+    /// enable fixed-timestep functionality: each wake runs as many ticks of exactly one interval
+    /// as the elapsed time covers, up to `max_ticks` (see `RevLimiter::begin_ticks`)
+    pub fn enable_fixed_timestep(mut self, max_ticks: u32) -> Self {
+        self.wrapped.accumulator = Some(Accumulator::new(max_ticks));
+        self
+    }
+
+    /// disable fixed-timestep functionality: each wake runs a single iteration
+    pub fn disable_fixed_timestep(mut self) -> Self {
+        self.wrapped.accumulator = None;
+        self
+    }
+
+    /// record the timings of each iteration into frame statistics, which can be read from any
+    /// thread while the loop runs
+    pub fn with_stats(mut self, stats: Arc<FrameStats>) -> Self {
+        self.wrapped.stats = Some(stats);
+        self
+    }
+
+    /// read the time from a source instead of the system's clock (e.g. a `VirtualClock` for
+    /// running without waiting, or a `ReplayClock` for replaying a recorded session)
+    pub fn with_time_source(mut self, source: Arc<dyn TimeSource>) -> Self {
+        self.wrapped.clock = Clock::with_source(source);
+        self
+    }
+
+    /// schedule a timer on the loop
+    pub fn with_timer(mut self, timer: F64Timer) -> Self {
+        self.wrapped.timers.add(timer);
+        self
+    }
+
+    /// degrade the loop gracefully when it falls behind for a sustained period, instead of
+    /// catching up without bound (see `OverloadPolicy`)
+    pub fn with_overload_policy(mut self, overload_policy: OverloadPolicy) -> Self {
+        self.wrapped.overload_policy = Some(overload_policy);
+        self
+    }
+
     /// set the initial lag in seconds
     pub fn with_lag_secs(mut self, secs: f64) -> Self {
         self.wrapped.lag = Duration::from_secs_f64(secs);
@@ -209,22 +738,241 @@ impl RevLimiterBuilder {
         self
     }
 
+    /// set how the remainder of each iteration is waited out (see `WaitStrategy`)
+    pub fn with_wait_strategy(mut self, wait_strategy: WaitStrategy) -> Self {
+        self.wrapped.wait_strategy = wait_strategy;
+        self
+    }
+
     /// build the RevLimiter, disposing of the builder and returning the RevLimiter struct
     pub fn build(self) -> RevLimiter {
         self.wrapped
     }
 }
 
-/// a timer that generates continuous timing events which can be observed
-#[derive(Default)]
+/// the phase of a fixed-timestep loop, published by the loop after each wake so that another
+/// thread (such as the render loop) can tell how far the simulation is between two ticks
+pub struct TickPhase {
+    /// the instant that the published times are measured from
+    origin: Instant,
+    /// when the latest tick began in real time, in nanoseconds from the origin (which is negative
+    /// if the loop's clock reads earlier than the origin, as a virtual clock might)
+    tick_start: AtomicI64,
+    /// the real time between ticks in nanoseconds, or zero if nothing has been published
+    step: AtomicU64,
+}
+impl Default for TickPhase {
+    fn default() -> Self {
+        Self {
+            origin: Instant::now(),
+            tick_start: AtomicI64::new(0),
+            step: AtomicU64::new(0),
+        }
+    }
+}
+impl TickPhase {
+    /// the nanoseconds from the origin to an instant
+    fn offset(&self, instant: Instant) -> i64 {
+        match instant.checked_duration_since(self.origin) {
+            Some(after) => after.as_nanos() as i64,
+            None => -(self.origin.saturating_duration_since(instant).as_nanos() as i64),
+        }
+    }
+
+    /// publish the phase of a fixed-timestep loop after it has run the ticks of the wake which
+    /// began at `now` (read from the loop's clock)
+    pub fn publish(&self, rev_limiter: &RevLimiter, now: Instant) {
+        let speed = if rev_limiter.speed > 0.0 {
+            rev_limiter.speed
+        } else {
+            1.0
+        };
+        let remainder = match rev_limiter.accumulator {
+            Some(ref accumulator) => accumulator.remainder().div_f64(speed),
+            None => Duration::new(0, 0),
+        };
+        let tick_start = self.offset(now) - remainder.as_nanos() as i64;
+        self.tick_start.store(tick_start, Ordering::Relaxed);
+        self.step.store(
+            rev_limiter.interval.div_f64(speed).as_nanos() as u64,
+            Ordering::Relaxed,
+        );
+    }
+
+    /// how far the loop is between its latest tick and the next at `now` (such as the time the
+    /// reading loop's frame began), from 0.0 to 1.0, for interpolating between the previous and
+    /// current simulation state (1.0 if nothing has been published yet)
+    pub fn alpha(&self, now: Instant) -> f64 {
+        let step = self.step.load(Ordering::Relaxed);
+        if step == 0 {
+            return 1.0;
+        }
+        let since_tick = self.offset(now) - self.tick_start.load(Ordering::Relaxed);
+        (since_tick.max(0) as f64 / step as f64).min(1.0)
+    }
+}
+
+/// when a timer fires
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum TimerSchedule {
+    /// once, after a length of loop time
+    Once(Duration),
+    /// every time a length of loop time passes
+    Repeating(Duration),
+    /// every given number of frames (iterations, or ticks of a fixed-timestep loop)
+    Frames(u32),
+}
+
+/// a timer which notifies its observers with the loop time in seconds since it was added or last
+/// fired, whenever it fires on the thread running its loop (see `Timers`)
 pub struct F64Timer {
-    observer_storage: VecObserverStorage<f64>,
+    schedule: TimerSchedule,
+    /// observers notified each time the timer fires
+    pub observers: VecObserverStorage<f64>,
+    /// the loop time the timer was added or last fired at
+    last_fired: Duration,
+}
+impl F64Timer {
+    /// create a timer which fires on a schedule
+    pub fn new(schedule: TimerSchedule) -> Self {
+        Self {
+            schedule,
+            observers: Default::default(),
+            last_fired: Duration::new(0, 0),
+        }
+    }
+
+    /// when the timer fires
+    pub fn schedule(&self) -> TimerSchedule {
+        self.schedule
+    }
+
+    fn fire(&mut self, now: Duration) {
+        let elapsed = now.saturating_sub(self.last_fired);
+        self.last_fired = now;
+        self.notify_observers(elapsed.as_secs_f64());
+    }
 }
 impl Observable for F64Timer {
     type NotificationType = f64;
 
     fn notify_observers(&self, notification: Self::NotificationType) {
-        self.observer_storage.notify_observers(notification)
+        self.observers.notify_observers(notification)
+    }
+}
+
+/// identifies a timer added to a `Timers`, for as long as it is scheduled
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub struct TimerHandle {
+    frame_aligned: bool,
+    key: WheelKey,
+}
+
+/// the timers of a loop, scheduled on hierarchical timing wheels so that each frame costs the
+/// same however many timers are waiting
+pub struct Timers {
+    /// the length of a tick of the time wheel, which timers are rounded up to
+    resolution: Duration,
+    /// the loop time which has passed
+    now: Duration,
+    /// timers scheduled in ticks of the resolution
+    time_wheel: TimerWheel<F64Timer>,
+    /// timers scheduled in frames
+    frame_wheel: TimerWheel<F64Timer>,
+}
+impl Default for Timers {
+    /// create timers with a resolution of a millisecond
+    fn default() -> Self {
+        Self::new(Duration::from_millis(1))
+    }
+}
+impl Timers {
+    /// create timers which fire to within a resolution
+    pub fn new(resolution: Duration) -> Self {
+        Self {
+            resolution: resolution.max(Duration::from_nanos(1)),
+            now: Duration::new(0, 0),
+            time_wheel: Default::default(),
+            frame_wheel: Default::default(),
+        }
+    }
+
+    /// the number of ticks of the resolution in a duration, rounded up
+    fn ticks(&self, duration: Duration) -> u64 {
+        let resolution = self.resolution.as_nanos();
+        duration.as_nanos().div_ceil(resolution) as u64
+    }
+
+    /// the loop time which has passed
+    pub fn now(&self) -> Duration {
+        self.now
+    }
+
+    /// the number of scheduled timers
+    pub fn len(&self) -> usize {
+        self.time_wheel.len() + self.frame_wheel.len()
+    }
+
+    /// whether there are no scheduled timers
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// schedule a timer, starting from now
+    pub fn add(&mut self, mut timer: F64Timer) -> TimerHandle {
+        timer.last_fired = self.now;
+        match timer.schedule {
+            TimerSchedule::Once(after) | TimerSchedule::Repeating(after) => {
+                let deadline = self.ticks(self.now + after);
+                TimerHandle {
+                    frame_aligned: false,
+                    key: self.time_wheel.insert(deadline, timer),
+                }
+            }
+            TimerSchedule::Frames(frames) => {
+                let deadline = self.frame_wheel.now() + u64::from(frames);
+                TimerHandle {
+                    frame_aligned: true,
+                    key: self.frame_wheel.insert(deadline, timer),
+                }
+            }
+        }
+    }
+
+    /// cancel a timer, returning it if it was still scheduled
+    pub fn cancel(&mut self, handle: TimerHandle) -> Option<F64Timer> {
+        match handle.frame_aligned {
+            true => self.frame_wheel.remove(handle.key),
+            false => self.time_wheel.remove(handle.key),
+        }
+    }
+
+    /// advance by a frame and a length of loop time, firing every timer which falls due
+    pub fn tick(&mut self, elapsed: Duration) {
+        self.now += elapsed;
+        let now = self.now;
+        let resolution = self.resolution;
+        let to = (now.as_nanos() / resolution.as_nanos()) as u64;
+        self.time_wheel
+            .advance(to, |deadline, timer| match timer.schedule {
+                TimerSchedule::Repeating(period) if period > Duration::new(0, 0) => {
+                    timer.fire(now);
+                    let period_ticks = period.as_nanos().div_ceil(resolution.as_nanos());
+                    Some(deadline + period_ticks as u64)
+                }
+                _ => {
+                    timer.fire(now);
+                    None
+                }
+            });
+        let frame = self.frame_wheel.now() + 1;
+        self.frame_wheel.advance(frame, |deadline, timer| {
+            timer.fire(now);
+            match timer.schedule {
+                TimerSchedule::Frames(frames) => Some(deadline + u64::from(frames.max(1))),
+                _ => None,
+            }
+        });
     }
 }
 
@@ -315,3 +1063,338 @@ fn revlimiter_has_no_lag_without_catchup() {
         Duration::from_millis(0)
     );
 }
+
+#[test]
+fn sleep_estimate_converges_on_overshoot() {
+    let mut estimate = SleepEstimate::default();
+    for _ in 0..100 {
+        estimate.record(Duration::from_millis(10), Duration::from_micros(10_200));
+    }
+    let margin = estimate.margin();
+    assert!(margin >= Duration::from_micros(190) && margin <= Duration::from_micros(250));
+}
+
+#[test]
+fn sleep_estimate_margin_is_capped() {
+    let mut estimate = SleepEstimate::default();
+    for _ in 0..100 {
+        estimate.record(Duration::from_millis(1), Duration::from_millis(20));
+    }
+    assert_eq!(estimate.margin(), SleepEstimate::MAX_MARGIN);
+}
+
+#[test]
+fn revlimiter_hybrid_wait_never_wakes_early() {
+    let mut rev_limiter = RevLimiterBuilder::new_from_frequency(500.0)
+        .with_wait_strategy(WaitStrategy::Hybrid)
+        .build();
+    for _ in 0..20 {
+        let deadline = Instant::now() + Duration::from_millis(2);
+        rev_limiter.wait_until(deadline);
+        assert!(Instant::now() >= deadline);
+    }
+}
+
+#[test]
+fn accumulator_carries_remainder() {
+    let mut accumulator = Accumulator::new(5);
+    let step = Duration::from_millis(10);
+    assert_eq!(accumulator.accumulate(Duration::from_millis(25), step), 2);
+    assert_eq!(accumulator.remainder(), Duration::from_millis(5));
+    assert_eq!(accumulator.accumulate(Duration::from_millis(6), step), 1);
+    assert_eq!(accumulator.remainder(), Duration::from_millis(1));
+}
+
+#[test]
+fn accumulator_limits_catchup_ticks() {
+    let mut accumulator = Accumulator::new(3);
+    let step = Duration::from_millis(10);
+    assert_eq!(accumulator.accumulate(Duration::from_millis(104), step), 3);
+    assert_eq!(accumulator.dropped_ticks(), 7);
+    assert_eq!(accumulator.remainder(), Duration::from_millis(4));
+}
+
+#[cfg(test)]
+static OVERLOAD_EVENTS: AtomicU64 = AtomicU64::new(0);
+
+#[test]
+fn revlimiter_degrades_and_recovers_under_overload() {
+    use crate::event::MultipleObserverStorage;
+
+    let mut policy = OverloadPolicy::new(
+        OverloadStrategy::DegradeRate {
+            factor: 2.0,
+            min_frequency: 15.0,
+        },
+        Duration::from_millis(50),
+        3,
+    )
+    .with_recovery(2);
+    policy
+        .observers
+        .add_observer_owned(Box::new(|_: &OverloadEvent| {
+            OVERLOAD_EVENTS.fetch_add(1, Ordering::Relaxed);
+        }));
+    let mut rev_limiter = RevLimiterBuilder::new_from_frequency(50.0)
+        .enable_catchup()
+        .with_overload_policy(policy)
+        .build();
+
+    let overload = |rev_limiter: &mut RevLimiter, iterations: u32| {
+        for _ in 0..iterations {
+            rev_limiter.lag = Duration::from_millis(100);
+            rev_limiter.apply_overload_policy();
+        }
+    };
+    overload(&mut rev_limiter, 2);
+    assert_eq!(rev_limiter.interval, Duration::from_millis(20));
+    overload(&mut rev_limiter, 1);
+    assert_eq!(rev_limiter.interval, Duration::from_millis(40));
+    assert_eq!(rev_limiter.lag, Duration::new(0, 0));
+    overload(&mut rev_limiter, 6);
+    assert_eq!(rev_limiter.interval, Duration::from_secs_f64(1.0 / 15.0));
+
+    for _ in 0..6 {
+        rev_limiter.lag = Duration::new(0, 0);
+        rev_limiter.apply_overload_policy();
+    }
+    assert_eq!(rev_limiter.interval, Duration::from_millis(20));
+    assert_eq!(OVERLOAD_EVENTS.load(Ordering::Relaxed), 5);
+}
+
+#[test]
+fn revlimiter_stops_degrading_at_its_limit() {
+    let strategies = [
+        OverloadStrategy::DegradeRate {
+            factor: 2.0,
+            min_frequency: 15.0,
+        },
+        OverloadStrategy::DegradeRate {
+            factor: 2.0,
+            min_frequency: 0.0,
+        },
+        OverloadStrategy::ScaleSpeed {
+            factor: 0.5,
+            min_speed: 0.25,
+        },
+    ];
+    for &strategy in strategies.iter() {
+        let policy = OverloadPolicy::new(strategy, Duration::from_millis(50), 1).with_recovery(1);
+        let mut rev_limiter = RevLimiterBuilder::new_from_frequency(50.0)
+            .enable_catchup()
+            .with_overload_policy(policy)
+            .build();
+        for _ in 0..500 {
+            rev_limiter.lag = Duration::from_millis(100);
+            rev_limiter.apply_overload_policy();
+        }
+        let steps = rev_limiter
+            .overload_policy
+            .as_ref()
+            .map_or(0, OverloadPolicy::steps);
+        assert!(
+            steps > 0 && steps < 100,
+            "{:?} took {} steps",
+            strategy,
+            steps
+        );
+
+        // every step taken changed the loop, so recovering takes one iteration per step
+        for _ in 0..steps {
+            rev_limiter.lag = Duration::new(0, 0);
+            rev_limiter.apply_overload_policy();
+        }
+        assert_eq!(rev_limiter.interval, Duration::from_millis(20));
+        assert_eq!(rev_limiter.speed, 1.0);
+    }
+}
+
+#[test]
+fn revlimiter_never_degrades_past_its_base() {
+    // loops which already run beyond the policy's limit are left as they are
+    let strategies = [
+        OverloadStrategy::DegradeRate {
+            factor: 2.0,
+            min_frequency: 15.0,
+        },
+        OverloadStrategy::ScaleSpeed {
+            factor: 0.5,
+            min_speed: 0.25,
+        },
+    ];
+    for &strategy in strategies.iter() {
+        let policy = OverloadPolicy::new(strategy, Duration::from_millis(50), 1).with_recovery(1);
+        let mut rev_limiter = RevLimiterBuilder::new_from_frequency(10.0)
+            .enable_catchup()
+            .with_speed(0.125)
+            .with_overload_policy(policy)
+            .build();
+        for _ in 0..10 {
+            rev_limiter.lag = Duration::from_millis(200);
+            rev_limiter.apply_overload_policy();
+            assert_eq!(rev_limiter.interval, Duration::from_millis(100));
+            assert_eq!(rev_limiter.speed, 0.125);
+        }
+        for _ in 0..10 {
+            rev_limiter.lag = Duration::new(0, 0);
+            rev_limiter.apply_overload_policy();
+            assert_eq!(rev_limiter.interval, Duration::from_millis(100));
+            assert_eq!(rev_limiter.speed, 0.125);
+        }
+    }
+}
+
+#[test]
+fn revlimiter_drops_ticks_under_overload() {
+    let mut rev_limiter = RevLimiterBuilder::new_from_frequency(100.0)
+        .enable_fixed_timestep(100)
+        .with_overload_policy(OverloadPolicy::new(
+            OverloadStrategy::DropTicks,
+            Duration::from_millis(5),
+            1,
+        ))
+        .build();
+    if let Some(ref mut accumulator) = rev_limiter.accumulator {
+        accumulator.accumulate(Duration::from_millis(5), Duration::from_millis(10));
+    }
+    rev_limiter.lag = Duration::from_millis(30);
+    rev_limiter.apply_overload_policy();
+    assert_eq!(rev_limiter.lag, Duration::new(0, 0));
+    assert_eq!(rev_limiter.alpha(), 0.0);
+    assert_eq!(rev_limiter.interval, Duration::from_millis(10));
+}
+
+#[cfg(test)]
+static TIMER_FIRINGS: AtomicU64 = AtomicU64::new(0);
+
+#[test]
+fn timers_fire_once_repeating_and_frame_aligned() {
+    use crate::event::MultipleObserverStorage;
+
+    fn count(_: &f64) {
+        TIMER_FIRINGS.fetch_add(1, Ordering::Relaxed);
+    }
+    let mut timers = Timers::default();
+    let mut once = F64Timer::new(TimerSchedule::Once(Duration::from_millis(25)));
+    once.observers.add_observer_owned(Box::new(count));
+    let once = timers.add(once);
+    let mut repeating = F64Timer::new(TimerSchedule::Repeating(Duration::from_millis(10)));
+    repeating.observers.add_observer_owned(Box::new(count));
+    timers.add(repeating);
+    let mut frames = F64Timer::new(TimerSchedule::Frames(3));
+    frames.observers.add_observer_owned(Box::new(count));
+    let frames = timers.add(frames);
+    assert_eq!(timers.len(), 3);
+
+    // 12 frames of 5ms: the one-shot fires once, the repeating timer 6 times, and the
+    // frame-aligned timer 4 times
+    for _ in 0..12 {
+        timers.tick(Duration::from_millis(5));
+    }
+    assert_eq!(TIMER_FIRINGS.load(Ordering::Relaxed), 11);
+    assert!(timers.cancel(once).is_none());
+    assert_eq!(
+        timers.cancel(frames).map(|timer| timer.schedule()),
+        Some(TimerSchedule::Frames(3))
+    );
+    assert_eq!(timers.len(), 1);
+}
+
+#[test]
+fn revlimiter_ticks_timers_by_the_whole_iteration() {
+    use crate::event::source::VirtualClock;
+
+    let source = Arc::new(VirtualClock::new());
+    let mut rev_limiter = RevLimiterBuilder::new_from_frequency(50.0)
+        .with_time_source(source.clone())
+        .with_timer(F64Timer::new(TimerSchedule::Repeating(
+            Duration::from_millis(20),
+        )))
+        .build();
+    rev_limiter.begin();
+    // each iteration works for 5ms and waits out the other 15ms
+    for _ in 0..10 {
+        source.advance(Duration::from_millis(5));
+        assert_eq!(rev_limiter.wait(), Duration::from_millis(15));
+        rev_limiter.begin();
+    }
+    assert_eq!(rev_limiter.timers.now(), Duration::from_millis(200));
+}
+
+#[test]
+fn tick_phase_follows_the_loop_clock() {
+    use crate::event::source::VirtualClock;
+
+    let source = Arc::new(VirtualClock::new());
+    let mut rev_limiter = RevLimiterBuilder::new_from_frequency(100.0)
+        .enable_fixed_timestep(5)
+        .with_time_source(source.clone())
+        .build();
+    // the phase's origin is later than the virtual clock's readings
+    let phase = TickPhase::default();
+    assert_eq!(phase.alpha(rev_limiter.now()), 1.0);
+    rev_limiter.begin_ticks();
+    source.advance(Duration::from_millis(15));
+    assert_eq!(rev_limiter.begin_ticks(), 1);
+    let now = rev_limiter.clock.reset_time();
+    phase.publish(&rev_limiter, now);
+    assert_eq!(phase.alpha(now), 0.5);
+    assert_eq!(phase.alpha(now + Duration::from_micros(2500)), 0.75);
+    assert_eq!(phase.alpha(now + Duration::from_secs(1)), 1.0);
+}
+
+#[test]
+fn revlimiter_runs_without_waiting_on_a_virtual_clock() {
+    use crate::event::source::VirtualClock;
+
+    let source = Arc::new(VirtualClock::new());
+    let mut rev_limiter = RevLimiterBuilder::new_from_frequency(50.0)
+        .with_time_source(source.clone())
+        .build();
+    let start = Instant::now();
+    rev_limiter.begin();
+    for _ in 0..500 {
+        rev_limiter.wait();
+        assert_eq!(rev_limiter.begin(), 0.02);
+    }
+    assert_eq!(source.elapsed(), Duration::from_secs(10));
+    assert!(start.elapsed() < Duration::from_secs(1));
+}
+
+#[test]
+fn revlimiter_replays_recorded_deltas() {
+    use crate::event::source::{RecordingClock, ReplayClock};
+
+    let run = |source: Arc<dyn TimeSource>| {
+        let mut rev_limiter = RevLimiterBuilder::new_from_frequency(500.0)
+            .with_time_source(source)
+            .build();
+        (0..20)
+            .map(|_| {
+                let delta = rev_limiter.begin();
+                rev_limiter.wait();
+                delta
+            })
+            .collect::<Vec<f64>>()
+    };
+    let recording = Arc::new(RecordingClock::new());
+    let recorded = run(recording.clone());
+    let replay = Arc::new(ReplayClock::new(recording.readings()));
+    assert_eq!(run(replay.clone()), recorded);
+    assert!(replay.is_finished());
+}
+
+#[test]
+fn revlimiter_shares_a_single_clock_reading_per_boundary() {
+    use crate::event::source::RecordingClock;
+
+    let source = Arc::new(RecordingClock::new());
+    let mut rev_limiter = RevLimiterBuilder::new_from_frequency(1000.0)
+        .with_time_source(source.clone())
+        .build();
+    let readings = source.readings().len();
+    rev_limiter.begin();
+    assert_eq!(frame_time(), Some(rev_limiter.clock.reset_time()));
+    rev_limiter.end();
+    assert_eq!(source.readings().len(), readings + 2);
+}
@@ -0,0 +1,257 @@
+//! a hierarchical timing wheel, which schedules any number of entries by tick with O(1) insertion,
+//! cancellation and expiry (amortized over the ticks each entry waits for)
+//!
+//! Entries within 64 ticks of the current tick are kept in the slot for their tick on the lowest
+//! level. Entries further away are kept on a higher level, where each slot spans 64 times as many
+//! ticks as a slot on the level below, and are moved down a level (cascaded) when the wheel reaches
+//! the start of their slot. Entries beyond the highest level wait in an overflow list.
+
+/// log2 of the number of slots per level
+const SLOT_BITS: u32 = 6;
+/// the number of slots per level
+const SLOTS: usize = 1 << SLOT_BITS;
+/// the number of levels, which together span 2^24 ticks
+const LEVELS: usize = 4;
+/// the index of the overflow list, after every level's slots
+const OVERFLOW: usize = LEVELS * SLOTS;
+
+/// identifies an entry in a timing wheel, for as long as the entry is scheduled
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub struct WheelKey {
+    index: usize,
+    generation: u32,
+}
+
+struct Entry<T> {
+    value: Option<T>,
+    deadline: u64,
+    generation: u32,
+    /// the slot list the entry is in
+    slot: usize,
+    /// the previous entry in the slot list, or the next free entry if the entry is vacant
+    previous: Option<usize>,
+    next: Option<usize>,
+}
+
+/// a hierarchical timing wheel of values due at a tick
+pub struct TimerWheel<T> {
+    now: u64,
+    /// the first entry in each slot list (including the overflow list)
+    slots: Box<[Option<usize>]>,
+    entries: Vec<Entry<T>>,
+    /// the first vacant entry
+    free: Option<usize>,
+    len: usize,
+}
+impl<T> Default for TimerWheel<T> {
+    fn default() -> Self {
+        Self {
+            now: 0,
+            slots: vec![None; OVERFLOW + 1].into_boxed_slice(),
+            entries: Vec::new(),
+            free: None,
+            len: 0,
+        }
+    }
+}
+impl<T> TimerWheel<T> {
+    /// create an empty timing wheel at tick zero
+    pub fn new() -> Self {
+        Default::default()
+    }
+
+    /// the current tick
+    pub fn now(&self) -> u64 {
+        self.now
+    }
+
+    /// the number of scheduled entries
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// whether there are no scheduled entries
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// the slot list for an entry due at a tick, relative to the current tick
+    fn slot_for(&self, deadline: u64) -> usize {
+        let differing = deadline ^ self.now;
+        if differing < SLOTS as u64 {
+            return (deadline as usize) & (SLOTS - 1);
+        }
+        let level = ((63 - differing.leading_zeros()) / SLOT_BITS) as usize;
+        if level >= LEVELS {
+            return OVERFLOW;
+        }
+        level * SLOTS + ((deadline >> (level as u32 * SLOT_BITS)) as usize & (SLOTS - 1))
+    }
+
+    fn link(&mut self, index: usize) {
+        let slot = self.slot_for(self.entries[index].deadline);
+        let head = self.slots[slot];
+        if let Some(head) = head {
+            self.entries[head].previous = Some(index);
+        }
+        let entry = &mut self.entries[index];
+        entry.slot = slot;
+        entry.previous = None;
+        entry.next = head;
+        self.slots[slot] = Some(index);
+    }
+
+    fn unlink(&mut self, index: usize) {
+        let (slot, previous, next) = {
+            let entry = &self.entries[index];
+            (entry.slot, entry.previous, entry.next)
+        };
+        match previous {
+            Some(previous) => self.entries[previous].next = next,
+            None => self.slots[slot] = next,
+        }
+        if let Some(next) = next {
+            self.entries[next].previous = previous;
+        }
+    }
+
+    /// schedule a value for a tick (entries due at or before the current tick are due at the next)
+    pub fn insert(&mut self, deadline: u64, value: T) -> WheelKey {
+        let deadline = deadline.max(self.now + 1);
+        let index = match self.free {
+            Some(index) => {
+                self.free = self.entries[index].previous;
+                let entry = &mut self.entries[index];
+                entry.value = Some(value);
+                entry.deadline = deadline;
+                index
+            }
+            None => {
+                self.entries.push(Entry {
+                    value: Some(value),
+                    deadline,
+                    generation: 0,
+                    slot: 0,
+                    previous: None,
+                    next: None,
+                });
+                self.entries.len() - 1
+            }
+        };
+        self.link(index);
+        self.len += 1;
+        WheelKey {
+            index,
+            generation: self.entries[index].generation,
+        }
+    }
+
+    /// the tick an entry is due at, if it is still scheduled
+    pub fn deadline(&self, key: WheelKey) -> Option<u64> {
+        self.entries
+            .get(key.index)
+            .filter(|entry| entry.generation == key.generation && entry.value.is_some())
+            .map(|entry| entry.deadline)
+    }
+
+    /// cancel an entry, returning its value if it was still scheduled
+    pub fn remove(&mut self, key: WheelKey) -> Option<T> {
+        self.deadline(key)?;
+        self.unlink(key.index);
+        Some(self.vacate(key.index))
+    }
+
+    fn vacate(&mut self, index: usize) -> T {
+        let entry = &mut self.entries[index];
+        entry.generation = entry.generation.wrapping_add(1);
+        entry.previous = self.free;
+        self.free = Some(index);
+        self.len -= 1;
+        entry.value.take().expect("timer wheel entry is vacant")
+    }
+
+    /// move every entry in a slot list to the slot for its deadline
+    fn cascade(&mut self, slot: usize) {
+        let mut next = self.slots[slot].take();
+        while let Some(index) = next {
+            next = self.entries[index].next;
+            self.link(index);
+        }
+    }
+
+    /// advance the wheel to a tick, calling `expire` with the deadline and value of each entry as
+    /// it falls due, which either returns a later tick to reschedule the entry for (keeping its
+    /// key), or `None` to remove it
+    pub fn advance(&mut self, to: u64, mut expire: impl FnMut(u64, &mut T) -> Option<u64>) {
+        while self.now < to {
+            if self.is_empty() {
+                self.now = to;
+                return;
+            }
+            self.now += 1;
+            let now = self.now;
+            for level in (1..=LEVELS).rev() {
+                let shift = level as u32 * SLOT_BITS;
+                if now & ((1 << shift) - 1) != 0 {
+                    continue;
+                }
+                match level {
+                    LEVELS => self.cascade(OVERFLOW),
+                    _ => self.cascade(level * SLOTS + ((now >> shift) as usize & (SLOTS - 1))),
+                }
+            }
+            let mut next = self.slots[now as usize & (SLOTS - 1)].take();
+            while let Some(index) = next {
+                next = self.entries[index].next;
+                let entry = &mut self.entries[index];
+                let value = entry.value.as_mut().expect("timer wheel entry is vacant");
+                match expire(entry.deadline, value) {
+                    Some(deadline) => {
+                        entry.deadline = deadline.max(now + 1);
+                        self.link(index);
+                    }
+                    None => {
+                        self.vacate(index);
+                    }
+                }
+            }
+        }
+    }
+}
+
+#[test]
+fn timer_wheel_expires_entries_at_their_deadline() {
+    let mut wheel = TimerWheel::new();
+    let deadlines = [1u64, 63, 64, 65, 4095, 4096, 300_000, 20_000_000];
+    for &deadline in deadlines.iter() {
+        wheel.insert(deadline, deadline);
+    }
+    let cancelled = wheel.insert(100, 100);
+    assert_eq!(wheel.remove(cancelled), Some(100));
+    assert_eq!(wheel.remove(cancelled), None);
+
+    let mut expired = Vec::new();
+    let mut now = 0;
+    while !wheel.is_empty() {
+        now += 997;
+        wheel.advance(now, |deadline, &mut value| {
+            assert_eq!(deadline, value);
+            expired.push(value);
+            None
+        });
+        assert!(expired.iter().all(|&deadline| deadline <= now));
+    }
+    assert_eq!(expired, deadlines);
+}
+
+#[test]
+fn timer_wheel_reschedules_repeating_entries() {
+    let mut wheel = TimerWheel::new();
+    let key = wheel.insert(10, 0u32);
+    wheel.advance(1000, |deadline, count| {
+        *count += 1;
+        Some(deadline + 10)
+    });
+    assert_eq!(wheel.deadline(key), Some(1010));
+    assert_eq!(wheel.remove(key), Some(100));
+}
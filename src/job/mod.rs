@@ -0,0 +1,316 @@
+//! the job subsystem: a work-stealing pool of worker threads, for spreading work over every core
+//! from within the game loops
+
+use std::any::Any;
+use std::cell::Cell;
+use std::collections::VecDeque;
+use std::marker::PhantomData;
+use std::mem::transmute;
+use std::panic::{catch_unwind, resume_unwind, AssertUnwindSafe};
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::{Arc, Condvar, Mutex, OnceLock};
+use std::thread::{available_parallelism, yield_now, Builder, JoinHandle};
+use std::time::{Duration, Instant};
+
+#[cfg(test)]
+mod test;
+
+/// a unit of work queued on a job pool
+type Job = Box<dyn FnOnce() + Send + 'static>;
+
+/// a function run at the start of each worker thread
+type ThreadStart = Arc<dyn Fn() + Send + Sync>;
+
+/// the longest an idle worker sleeps before checking the queues again
+const IDLE_TIMEOUT: Duration = Duration::from_millis(10);
+
+/// the number of chunks per thread that `parallel_for` splits its items into, for balancing
+const CHUNKS_PER_THREAD: usize = 4;
+
+/// the source of unique job pool ids, so a worker thread can tell its own pool from another
+static NEXT_POOL_ID: AtomicUsize = AtomicUsize::new(1);
+
+thread_local! {
+    /// the pool id and deque index of the worker running on this thread, or a pool id of zero
+    static WORKER: Cell<(usize, usize)> = const { Cell::new((0, 0)) };
+}
+
+/// state shared between a job pool and its workers
+struct Shared {
+    id: usize,
+    /// one deque per worker (popped from the back by its owner, and stolen from the front by
+    /// every other thread), followed by one for jobs queued from outside the pool
+    deques: Box<[Mutex<VecDeque<Job>>]>,
+    /// the number of jobs in all of the deques
+    queued: AtomicUsize,
+    /// the number of workers waiting for jobs
+    sleeping: AtomicUsize,
+    sleep_lock: Mutex<()>,
+    wake: Condvar,
+    shutdown: AtomicBool,
+}
+impl Shared {
+    /// the deque index of the calling thread, if it is one of this pool's workers
+    fn worker_index(&self) -> Option<usize> {
+        let (id, index) = WORKER.with(Cell::get);
+        if id == self.id {
+            Some(index)
+        } else {
+            None
+        }
+    }
+
+    fn push(&self, job: Job) {
+        let index = self.worker_index().unwrap_or_else(|| self.deques.len() - 1);
+        self.deques[index]
+            .lock()
+            .expect("job deque is poisoned")
+            .push_back(job);
+        self.queued.fetch_add(1, Ordering::SeqCst);
+        if self.sleeping.load(Ordering::SeqCst) > 0 {
+            let _lock = self.sleep_lock.lock().expect("job sleep lock is poisoned");
+            self.wake.notify_one();
+        }
+    }
+
+    /// take a job: the newest from the calling worker's own deque, or else the oldest from any
+    /// other deque
+    fn find(&self) -> Option<Job> {
+        if self.queued.load(Ordering::SeqCst) == 0 {
+            return None;
+        }
+        let count = self.deques.len();
+        let own = self.worker_index();
+        if let Some(index) = own {
+            if let Some(job) = self.deques[index]
+                .lock()
+                .expect("job deque is poisoned")
+                .pop_back()
+            {
+                self.queued.fetch_sub(1, Ordering::SeqCst);
+                return Some(job);
+            }
+        }
+        let start = own.map_or(count - 1, |index| index + 1);
+        for offset in 0..count {
+            let index = (start + offset) % count;
+            if Some(index) == own {
+                continue;
+            }
+            if let Some(job) = self.deques[index]
+                .lock()
+                .expect("job deque is poisoned")
+                .pop_front()
+            {
+                self.queued.fetch_sub(1, Ordering::SeqCst);
+                return Some(job);
+            }
+        }
+        None
+    }
+
+    fn work(&self, index: usize) {
+        WORKER.with(|worker| worker.set((self.id, index)));
+        while !self.shutdown.load(Ordering::SeqCst) {
+            match self.find() {
+                Some(job) => job(),
+                None => {
+                    let lock = self.sleep_lock.lock().expect("job sleep lock is poisoned");
+                    self.sleeping.fetch_add(1, Ordering::SeqCst);
+                    if self.queued.load(Ordering::SeqCst) == 0
+                        && !self.shutdown.load(Ordering::SeqCst)
+                    {
+                        let _ = self
+                            .wake
+                            .wait_timeout(lock, IDLE_TIMEOUT)
+                            .expect("job sleep lock is poisoned");
+                    }
+                    self.sleeping.fetch_sub(1, Ordering::SeqCst);
+                }
+            }
+        }
+    }
+}
+
+/// a pool of worker threads which run jobs, each worker keeping its own deque of jobs and
+/// stealing from the others when it runs out (the workers are started by the first job)
+pub struct JobPool {
+    shared: Arc<Shared>,
+    workers: OnceLock<Vec<JoinHandle<()>>>,
+    thread_start: Mutex<Option<ThreadStart>>,
+}
+impl Default for JobPool {
+    /// create a job pool with a worker for every core but one (which is left to the game loops)
+    fn default() -> Self {
+        let cores = available_parallelism().map_or(1, |cores| cores.get());
+        Self::new(cores.saturating_sub(1).max(1))
+    }
+}
+impl JobPool {
+    /// create a job pool with a given number of worker threads
+    pub fn new(threads: usize) -> Self {
+        Self {
+            shared: Arc::new(Shared {
+                id: NEXT_POOL_ID.fetch_add(1, Ordering::Relaxed),
+                deques: (0..=threads.max(1)).map(|_| Default::default()).collect(),
+                queued: AtomicUsize::new(0),
+                sleeping: AtomicUsize::new(0),
+                sleep_lock: Mutex::new(()),
+                wake: Condvar::new(),
+                shutdown: AtomicBool::new(false),
+            }),
+            workers: OnceLock::new(),
+            thread_start: Mutex::new(None),
+        }
+    }
+
+    /// run a function at the start of each worker thread (e.g. to register the thread with a
+    /// log), which only applies to workers started by jobs spawned afterwards
+    pub fn set_thread_start(&self, thread_start: impl Fn() + Send + Sync + 'static) {
+        *self.thread_start.lock().expect("thread start is poisoned") = Some(Arc::new(thread_start));
+    }
+
+    /// the number of worker threads
+    pub fn threads(&self) -> usize {
+        self.shared.deques.len() - 1
+    }
+
+    fn start(&self) {
+        self.workers.get_or_init(|| {
+            let thread_start = self
+                .thread_start
+                .lock()
+                .expect("thread start is poisoned")
+                .clone();
+            (0..self.threads())
+                .map(|index| {
+                    let shared = self.shared.clone();
+                    let thread_start = thread_start.clone();
+                    Builder::new()
+                        .name(format!("job-worker-{}", index))
+                        .spawn(move || {
+                            if let Some(thread_start) = thread_start {
+                                thread_start();
+                            }
+                            shared.work(index)
+                        })
+                        .expect("failed to spawn a job worker")
+                })
+                .collect()
+        });
+    }
+
+    /// queue a job which outlives the caller (a panic in the job is caught and discarded)
+    pub fn spawn(&self, job: impl FnOnce() + Send + 'static) {
+        self.start();
+        self.shared.push(Box::new(move || {
+            let _ = catch_unwind(AssertUnwindSafe(job));
+        }));
+    }
+
+    /// run one queued job on the calling thread, if there is one
+    pub fn run_one(&self) -> bool {
+        match self.shared.find() {
+            Some(job) => {
+                job();
+                true
+            }
+            None => false,
+        }
+    }
+
+    /// run queued jobs on the calling thread until there are none left or the deadline has passed
+    /// (used by the game loops instead of sleeping, so jobs should be short)
+    pub fn help_until(&self, deadline: Instant) {
+        while Instant::now() < deadline && self.run_one() {}
+    }
+
+    /// run a function which may spawn jobs borrowing from the caller's stack, and wait for every
+    /// job to finish (running queued jobs on the calling thread while it waits), re-raising the
+    /// first panic from the function or its jobs
+    pub fn scope<'scope, R>(&'scope self, function: impl FnOnce(&Scope<'scope>) -> R) -> R {
+        let scope = Scope {
+            pool: self,
+            state: Default::default(),
+            marker: PhantomData,
+        };
+        let result = catch_unwind(AssertUnwindSafe(|| function(&scope)));
+        while scope.state.pending.load(Ordering::Acquire) > 0 {
+            if !self.run_one() {
+                yield_now();
+            }
+        }
+        let result = result.unwrap_or_else(|payload| resume_unwind(payload));
+        if let Some(payload) = scope.state.panic.lock().expect("scope is poisoned").take() {
+            resume_unwind(payload);
+        }
+        result
+    }
+
+    /// call a function on every item of a slice, split into chunks over the pool
+    pub fn parallel_for<T: Send>(&self, items: &mut [T], function: impl Fn(&mut T) + Sync) {
+        let chunks = (self.threads() + 1) * CHUNKS_PER_THREAD;
+        let chunk_size = items.len().div_ceil(chunks).max(1);
+        let function = &function;
+        self.scope(|scope| {
+            for chunk in items.chunks_mut(chunk_size) {
+                scope.spawn(move || chunk.iter_mut().for_each(function));
+            }
+        });
+    }
+}
+impl Drop for JobPool {
+    fn drop(&mut self) {
+        self.shared.shutdown.store(true, Ordering::SeqCst);
+        {
+            let _lock = self
+                .shared
+                .sleep_lock
+                .lock()
+                .expect("job sleep lock is poisoned");
+            self.shared.wake.notify_all();
+        }
+        if let Some(workers) = self.workers.take() {
+            for worker in workers {
+                let _ = worker.join();
+            }
+        }
+    }
+}
+
+/// the jobs spawned in a scope which are yet to finish
+#[derive(Default)]
+struct ScopeState {
+    pending: AtomicUsize,
+    panic: Mutex<Option<Box<dyn Any + Send>>>,
+}
+
+/// a fork-join scope, whose jobs may borrow anything which outlives it
+pub struct Scope<'scope> {
+    pool: &'scope JobPool,
+    state: Arc<ScopeState>,
+    /// makes the scope invariant over its lifetime, so jobs cannot borrow anything shorter
+    marker: PhantomData<&'scope mut &'scope ()>,
+}
+impl<'scope> Scope<'scope> {
+    /// queue a job which finishes before the scope returns
+    pub fn spawn(&self, job: impl FnOnce() + Send + 'scope) {
+        self.pool.start();
+        let state = self.state.clone();
+        state.pending.fetch_add(1, Ordering::Relaxed);
+        let job: Box<dyn FnOnce() + Send + 'scope> = Box::new(move || {
+            if let Err(payload) = catch_unwind(AssertUnwindSafe(job)) {
+                state
+                    .panic
+                    .lock()
+                    .expect("scope is poisoned")
+                    .get_or_insert(payload);
+            }
+            state.pending.fetch_sub(1, Ordering::Release);
+        });
+        // SAFETY: the scope waits for every job it spawned to finish before it returns, so
+        // nothing the job borrows can be dropped while it is queued or running
+        let job: Job = unsafe { transmute(job) };
+        self.pool.shared.push(job);
+    }
+}
@@ -0,0 +1,98 @@
+//! tests for the job subsystem
+
+use crate::job::JobPool;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::mpsc::channel;
+use std::time::{Duration, Instant};
+
+#[test]
+fn test_scope_joins_borrowing_jobs() {
+    let pool = JobPool::new(3);
+    let total = AtomicUsize::new(0);
+    let values = [1, 2, 3, 4, 5, 6, 7, 8];
+    pool.scope(|scope| {
+        for value in &values {
+            let total = &total;
+            scope.spawn(move || {
+                total.fetch_add(*value, Ordering::Relaxed);
+            });
+        }
+    });
+    assert_eq!(total.load(Ordering::Relaxed), 36);
+}
+
+#[test]
+fn test_nested_scopes_do_not_deadlock() {
+    let pool = JobPool::new(2);
+    let total = AtomicUsize::new(0);
+    pool.scope(|scope| {
+        for _ in 0..8 {
+            scope.spawn(|| {
+                pool.scope(|inner| {
+                    for _ in 0..8 {
+                        inner.spawn(|| {
+                            total.fetch_add(1, Ordering::Relaxed);
+                        });
+                    }
+                });
+            });
+        }
+    });
+    assert_eq!(total.load(Ordering::Relaxed), 64);
+}
+
+#[test]
+fn test_parallel_for_visits_every_item() {
+    let pool = JobPool::new(4);
+    let mut items: Vec<u64> = (0..10_000).collect();
+    pool.parallel_for(&mut items, |item| *item *= 2);
+    assert!(items
+        .iter()
+        .enumerate()
+        .all(|(index, item)| *item == index as u64 * 2));
+}
+
+#[test]
+fn test_scope_propagates_panics() {
+    let pool = JobPool::new(2);
+    let result = std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| {
+        pool.scope(|scope| {
+            scope.spawn(|| panic!("job failed"));
+        });
+    }));
+    assert!(result.is_err());
+    // the pool keeps working afterwards
+    let (sender, receiver) = channel();
+    pool.spawn(move || sender.send(1).expect("receiver is gone"));
+    assert_eq!(receiver.recv_timeout(Duration::from_secs(5)), Ok(1));
+}
+
+#[test]
+fn test_help_until_runs_queued_jobs() {
+    let pool = JobPool::new(1);
+    let count = std::sync::Arc::new(AtomicUsize::new(0));
+    for _ in 0..100 {
+        let count = count.clone();
+        pool.spawn(move || {
+            count.fetch_add(1, Ordering::Relaxed);
+        });
+    }
+    pool.help_until(Instant::now() + Duration::from_secs(5));
+    assert_eq!(count.load(Ordering::Relaxed), 100);
+}
+
+#[test]
+fn test_workers_run_thread_start() {
+    let pool = JobPool::new(2);
+    let started = std::sync::Arc::new(AtomicUsize::new(0));
+    let thread_started = started.clone();
+    pool.set_thread_start(move || {
+        thread_started.fetch_add(1, Ordering::SeqCst);
+    });
+    pool.spawn(|| {});
+    let deadline = Instant::now() + Duration::from_secs(10);
+    while started.load(Ordering::SeqCst) < 2 && Instant::now() < deadline {
+        std::thread::yield_now();
+    }
+    assert_eq!(started.load(Ordering::SeqCst), 2);
+}
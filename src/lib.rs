@@ -6,33 +6,42 @@
 pub mod color;
 pub mod event;
 pub mod input;
+pub mod job;
 pub mod lifecycle;
 pub mod log;
 
-use crate::event::timing::RevLimiterBuilder;
+use crate::event::source::TimeSource;
+use crate::event::stats::FrameStats;
+use crate::event::timing::{F64Timer, OverloadPolicy, RevLimiterBuilder, TickPhase, WaitStrategy};
+use crate::job::JobPool;
+use crate::lifecycle::active::ActiveContext;
+use crate::lifecycle::scheduler::{
+    Affinity, Frame, ScheduledLoop, ScheduledLoopBuilder, Scheduler,
+};
 use crate::lifecycle::{Command, Context};
+use crate::log::event::{Event, Severity};
+use crate::log::ring::RingReceiver;
 use crate::log::Log;
-use std::mem::swap;
-use std::sync::{Arc, RwLock};
-use std::thread::{sleep, spawn};
+use std::panic::{set_hook, take_hook};
+use std::sync::{Arc, Mutex};
 
 /// container for state that is shared among all loop threads
 #[derive(Default)]
 pub struct GlobalState {
     /// the context that the game is currently running, or `None` to signify that the game has stopped
-    pub active_context: RwLock<Option<Box<dyn Context + Send + Sync>>>,
+    pub active_context: ActiveContext,
+    /// the phase of the update loop, from which the render loop interpolates
+    pub tick_phase: TickPhase,
+    /// timing statistics for the update loop
+    pub update_stats: Arc<FrameStats>,
+    /// timing statistics for the render loop
+    pub render_stats: Arc<FrameStats>,
 }
 impl GlobalState {
-    /// change the context, giving ownership of the previous context to the new one
-    pub fn change_context(&self, mut context: Option<Box<dyn Context + Send + Sync>>) {
-        let mut lock = self
-            .active_context
-            .write()
-            .expect("active_context is poisoned");
-        swap(&mut *lock, &mut context);
-        if let Some(ref new_context) = *lock {
-            new_context.take_ownership(context);
-        }
+    /// change the context, giving ownership of the previous context to the new one once the game
+    /// loops have stopped using it (without blocking them)
+    pub fn change_context(&self, context: Option<Box<dyn Context + Send + Sync>>) {
+        self.active_context.swap(context);
     }
 }
 
@@ -41,6 +50,9 @@ impl GlobalState {
 pub struct ServiceLocator {
     /// logging service
     pub log: Log,
+    /// work-stealing job pool, for running work in parallel from the game loops (which also run
+    /// queued jobs while they wait for their next iteration)
+    pub jobs: JobPool,
 }
 impl ServiceLocator {
     /// create a new service locator (and associated services)
@@ -50,11 +62,40 @@ impl ServiceLocator {
 }
 
 /// represents a game as collection of subsystems
-#[derive(Default)]
 pub struct App {
     /// service locator for accessing common game service
     pub services: Arc<ServiceLocator>,
     state: Arc<GlobalState>,
+    /// the most update ticks run to catch up in a single wake of the update loop
+    max_catchup_ticks: u32,
+    /// how the update loop degrades when it falls behind, if at all
+    overload_policy: Mutex<Option<OverloadPolicy>>,
+    /// timers to schedule on the update loop
+    timers: Mutex<Vec<F64Timer>>,
+    /// where the update and render loops read the time from, if not the system's clock
+    time_source: Option<Arc<dyn TimeSource>>,
+    /// additional loops to run alongside the update and render loops
+    loops: Mutex<Vec<ScheduledLoop>>,
+}
+impl Default for App {
+    fn default() -> Self {
+        let services: Arc<ServiceLocator> = Default::default();
+        let log_services = Arc::downgrade(&services);
+        services.jobs.set_thread_start(move || {
+            if let Some(services) = log_services.upgrade() {
+                services.log.register_thread();
+            }
+        });
+        Self {
+            services,
+            state: Default::default(),
+            max_catchup_ticks: 5,
+            overload_policy: Default::default(),
+            timers: Default::default(),
+            time_source: None,
+            loops: Default::default(),
+        }
+    }
 }
 impl App {
     /// create a new game
@@ -72,7 +113,56 @@ impl App {
         &self.services
     }
 
-    /// run the game!
+    /// set the most update ticks run to catch up in a single wake of the update loop, beyond which
+    /// the backlog is discarded and the game slows down instead (5 by default)
+    pub fn set_max_catchup_ticks(&mut self, ticks: u32) {
+        self.max_catchup_ticks = ticks;
+    }
+
+    /// degrade the update loop gracefully when it falls behind for a sustained period the next
+    /// time the game is run (e.g. lowering the tick rate of a server under load)
+    pub fn set_overload_policy(&self, overload_policy: OverloadPolicy) {
+        *self
+            .overload_policy
+            .lock()
+            .expect("overload policy is poisoned") = Some(overload_policy);
+    }
+
+    /// read the time for the update and render loops from a source instead of the system's clock
+    /// (e.g. a `VirtualClock` for a headless run which simulates ticks as fast as possible, or a
+    /// `RecordingClock` and then a `ReplayClock`, in which case both loops run on the calling
+    /// thread, so they read the source and wake in a deterministic order)
+    pub fn set_time_source(&mut self, source: Arc<dyn TimeSource>) {
+        self.time_source = Some(source);
+    }
+
+    /// schedule a timer on the update loop the next time the game is run, whose observers are
+    /// notified on the update thread
+    pub fn add_timer(&self, timer: F64Timer) {
+        self.timers.lock().expect("timers is poisoned").push(timer);
+    }
+
+    /// add a loop to run alongside the update and render loops the next time the game is run
+    /// (e.g. physics at 120Hz on a dedicated thread, or AI at 10Hz on the shared pool)
+    pub fn add_loop(&self, scheduled: ScheduledLoop) {
+        self.loops
+            .lock()
+            .expect("loops is poisoned")
+            .push(scheduled);
+    }
+
+    /// install a panic hook which records the panic into a ring log receiver and writes the ring
+    /// to its dump file, before deferring to the previously installed panic hook
+    pub fn dump_log_on_panic(&self, ring: RingReceiver) {
+        let previous_hook = take_hook();
+        set_hook(Box::new(move |info| {
+            ring.record_and_dump_on_panic(&Event::now(Severity::Fatal, "panic", info.to_string()));
+            previous_hook(info);
+        }));
+    }
+
+    /// run the game, with an update loop on its own thread, the render loop on the calling thread,
+    /// and any loops added with `add_loop`, until one of them stops
     pub fn run(
         &self,
         context: Box<dyn Context + Send + Sync>,
@@ -82,72 +172,71 @@ impl App {
         self.state.change_context(None);
         self.state.change_context(Some(context));
 
-        // start the update loop (on another thread)
         let services = self.services.clone();
-        let state = self.state.clone();
-        let update_loop = spawn(move || {
-            let mut rev_limiter = RevLimiterBuilder::new_from_frequency(ticks_per_second as f64)
-                .enable_lockstep()
-                .enable_catchup()
-                .with_speed(1.0)
-                .with_lag_secs(0.0)
-                .build();
-            loop {
-                let delta = rev_limiter.begin();
-                let mut stop = false;
-                {
-                    // read lock scope
-                    let read_lock = state
-                        .active_context
-                        .read()
-                        .expect("active_context is poisoned");
-                    if let Some(ref context) = *read_lock {
-                        if let Command::Stop = context.update(delta, &services, &state) {
-                            stop = true;
-                        }
-                    }
-                }
-                if stop {
-                    // write lock scope
-                    state.change_context(None);
-                    break;
-                }
-                let wait = rev_limiter.end();
-                sleep(wait);
-            }
-        });
+        let update = move |frame: &Frame<'_>| match frame.context {
+            Some(context) => context.update(frame.delta, &services, frame.state),
+            None => Command::Continue,
+        };
+        let services = self.services.clone();
+        let render = move |frame: &Frame<'_>| match frame.context {
+            Some(context) => context.render(
+                frame.delta,
+                frame.state.tick_phase.alpha(frame.time),
+                &services,
+            ),
+            None => Command::Continue,
+        };
 
-        let mut rev_limiter = RevLimiterBuilder::new_from_frequency(frames_per_second as f64)
-            .disable_lockstep()
-            .disable_catchup()
+        let mut update_rev_limiter = RevLimiterBuilder::new_from_frequency(ticks_per_second as f64)
+            .enable_fixed_timestep(self.max_catchup_ticks)
             .with_speed(1.0)
-            .build();
-        loop {
-            let delta = rev_limiter.begin();
-            let mut stop = false;
-            {
-                // read lock scope
-                let read_lock = self
-                    .state
-                    .active_context
-                    .read()
-                    .expect("active_context is poisoned");
-                if let Some(ref context) = *read_lock {
-                    if let Command::Stop = context.render(delta, &self.services) {
-                        stop = true;
-                    }
-                }
-            }
-            if stop {
-                // write lock scope
-                self.state.change_context(None);
-                break;
+            .with_wait_strategy(WaitStrategy::Hybrid)
+            .with_stats(self.state.update_stats.clone());
+        if let Some(overload_policy) = self
+            .overload_policy
+            .lock()
+            .expect("overload policy is poisoned")
+            .take()
+        {
+            update_rev_limiter = update_rev_limiter.with_overload_policy(overload_policy);
+        }
+        for timer in self.timers.lock().expect("timers is poisoned").drain(..) {
+            update_rev_limiter = update_rev_limiter.with_timer(timer);
+        }
+        let mut render_rev_limiter =
+            RevLimiterBuilder::new_from_frequency(frames_per_second as f64)
+                .with_wait_strategy(WaitStrategy::Hybrid)
+                .with_stats(self.state.render_stats.clone());
+        let mut update_affinity = Affinity::Dedicated;
+        if let Some(ref source) = self.time_source {
+            update_rev_limiter = update_rev_limiter.with_time_source(source.clone());
+            render_rev_limiter = render_rev_limiter.with_time_source(source.clone());
+            if source.is_deterministic() {
+                update_affinity = Affinity::Main;
             }
-            let wait = rev_limiter.end();
-            sleep(wait);
         }
 
-        // make sure the threads don't outlive the game
-        let _ = update_loop.join();
+        let services = self.services.clone();
+        let mut scheduler =
+            Scheduler::new().with_thread_start(move || services.log.register_thread());
+        scheduler.add_loop(
+            ScheduledLoopBuilder::new("update", ticks_per_second as f64, update)
+                .with_rev_limiter(update_rev_limiter.build())
+                .with_affinity(update_affinity)
+                .publish_tick_phase()
+                .build(),
+        );
+        scheduler.add_loop(
+            ScheduledLoopBuilder::new("render", frames_per_second as f64, render)
+                .with_rev_limiter(render_rev_limiter.build())
+                .with_affinity(Affinity::Main)
+                .build(),
+        );
+        for scheduled in self.loops.lock().expect("loops is poisoned").drain(..) {
+            scheduler.add_loop(scheduled);
+        }
+
+        scheduler.run(&self.state, Some(&self.services.jobs));
+        self.state.change_context(None);
     }
 }
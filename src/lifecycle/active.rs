@@ -0,0 +1,362 @@
+//! lock-free publication of the active context to the game loops
+//!
+//! The active context is published through an atomic pointer, and reclaimed with quiescent-state
+//! based reclamation: each loop thread holds a `ContextReader`, reads the context with a single
+//! atomic load, and announces a quiescent state between iterations (when it holds no reference to
+//! the context). A replaced context is only handed to its successor (or dropped) once every
+//! reader has announced a quiescent state since the swap, so neither readers nor writers wait.
+
+use super::Context;
+use std::collections::VecDeque;
+use std::ptr::null_mut;
+use std::sync::atomic::{AtomicPtr, AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex, TryLockError};
+
+/// the heap slot holding a published context
+type Slot = Option<Box<dyn Context + Send + Sync>>;
+
+/// a reader's announced epoch for a reader which holds no references to the context
+const OFFLINE: u64 = 0;
+
+/// a context which was replaced, waiting for every reader to stop using it
+struct Retired {
+    /// the slot which was replaced
+    slot: *mut Slot,
+    /// the slot which replaced it, to be given ownership of its context
+    successor: *mut Slot,
+    /// the epoch every reader must reach before the slot can be reclaimed
+    epoch: u64,
+}
+
+// SAFETY: the slots are only dereferenced by the reclaiming thread, once no reader can reach them
+unsafe impl Send for Retired {}
+
+/// the context that the game is currently running, readable by the game loops without locks
+pub struct ActiveContext {
+    /// the current slot (never null)
+    current: AtomicPtr<Slot>,
+    /// incremented by each swap, starting from 1
+    epoch: AtomicU64,
+    /// the announced epoch of each registered reader
+    readers: Mutex<Vec<Arc<AtomicU64>>>,
+    /// replaced slots, in the order they were replaced
+    retired: Mutex<VecDeque<Retired>>,
+    /// the number of retired slots, so readers can skip reclamation without taking a lock
+    pending: AtomicUsize,
+    /// held while retired contexts are handed over or dropped (without holding `retired`, so a
+    /// context may change the active context from `take_ownership`), so that a slot is never
+    /// freed while an earlier retired slot is being handed to it
+    reclaiming: Mutex<()>,
+}
+impl Default for ActiveContext {
+    fn default() -> Self {
+        Self {
+            current: AtomicPtr::new(Box::into_raw(Box::new(None))),
+            epoch: AtomicU64::new(1),
+            readers: Default::default(),
+            retired: Default::default(),
+            pending: AtomicUsize::new(0),
+            reclaiming: Mutex::new(()),
+        }
+    }
+}
+impl ActiveContext {
+    /// register the calling thread as a reader of the active context
+    pub fn register(&self) -> ContextReader<'_> {
+        let mut readers = self.readers.lock().expect("context readers is poisoned");
+        let epoch = Arc::new(AtomicU64::new(self.epoch.load(Ordering::SeqCst)));
+        readers.push(epoch.clone());
+        ContextReader {
+            active: self,
+            epoch,
+        }
+    }
+
+    /// replace the active context without waiting for readers; the previous context is given to
+    /// the new context's `take_ownership` (or dropped, if there is no new context) once every
+    /// reader has stopped using it, which is immediately if no readers are registered
+    pub fn swap(&self, context: Slot) {
+        let slot = Box::into_raw(Box::new(context));
+        {
+            let mut retired = self.retired.lock().expect("retired contexts is poisoned");
+            let previous = self.current.swap(slot, Ordering::AcqRel);
+            let epoch = self.epoch.fetch_add(1, Ordering::SeqCst) + 1;
+            retired.push_back(Retired {
+                slot: previous,
+                successor: slot,
+                epoch,
+            });
+            self.pending.store(retired.len(), Ordering::Relaxed);
+        }
+        // a swap from a context's `take_ownership` leaves its slot to the reclaim already running
+        self.reclaim(false);
+    }
+
+    /// take every retired slot which no reader can still be using
+    fn take_reclaimable(&self) -> Vec<Retired> {
+        let safe_epoch = self
+            .readers
+            .lock()
+            .expect("context readers is poisoned")
+            .iter()
+            .map(|epoch| epoch.load(Ordering::SeqCst))
+            .filter(|&epoch| epoch != OFFLINE)
+            .min()
+            .unwrap_or(u64::MAX);
+        let mut retired = self.retired.lock().expect("retired contexts is poisoned");
+        let mut reclaimable = Vec::new();
+        while retired
+            .front()
+            .is_some_and(|front| front.epoch <= safe_epoch)
+        {
+            reclaimable.extend(retired.pop_front());
+        }
+        self.pending.store(retired.len(), Ordering::Relaxed);
+        reclaimable
+    }
+
+    /// reclaim every retired slot which no reader can still be using, unless another thread (or
+    /// a caller further up this thread) is already reclaiming, in which case this waits for it
+    /// if `wait` is set, or returns straight away
+    fn reclaim(&self, wait: bool) {
+        let _reclaiming = match self.reclaiming.try_lock() {
+            Ok(reclaiming) => reclaiming,
+            Err(TryLockError::Poisoned(poisoned)) => poisoned.into_inner(),
+            Err(TryLockError::WouldBlock) if wait => self
+                .reclaiming
+                .lock()
+                .unwrap_or_else(|poisoned| poisoned.into_inner()),
+            Err(TryLockError::WouldBlock) => return,
+        };
+        // contexts retired while handing over earlier ones are reclaimed in later rounds
+        loop {
+            let reclaimable = self.take_reclaimable();
+            if reclaimable.is_empty() {
+                return;
+            }
+            for front in reclaimable {
+                // SAFETY: every reader has announced a quiescent state since the slot was
+                // replaced, and the successor is either current or retired later (and only
+                // reclaimed by this thread, after this), so it is still alive
+                let (context, successor) =
+                    unsafe { (*Box::from_raw(front.slot), &*front.successor) };
+                match *successor {
+                    Some(ref successor) => successor.take_ownership(context),
+                    None => drop(context),
+                }
+            }
+        }
+    }
+}
+impl Drop for ActiveContext {
+    fn drop(&mut self) {
+        // readers borrow the active context, so none are left
+        self.readers
+            .get_mut()
+            .expect("context readers is poisoned")
+            .clear();
+        self.reclaim(true);
+        let current = std::mem::replace(self.current.get_mut(), null_mut());
+        // SAFETY: the current slot is always a valid box, and no reader can reach it anymore
+        drop(unsafe { Box::from_raw(current) });
+    }
+}
+
+/// a thread's handle for reading the active context, which must announce a quiescent state
+/// regularly (e.g. once per loop iteration) for replaced contexts to be reclaimed
+pub struct ContextReader<'a> {
+    active: &'a ActiveContext,
+    /// the latest epoch this reader announced
+    epoch: Arc<AtomicU64>,
+}
+impl<'a> ContextReader<'a> {
+    /// get the active context with a single atomic load, or `None` if the game has stopped (the
+    /// reference cannot outlive the next quiescent state)
+    #[inline]
+    pub fn get(&self) -> Option<&(dyn Context + Send + Sync)> {
+        // SAFETY: the slot cannot be reclaimed until this reader announces a quiescent state,
+        // which needs a mutable borrow of the reader, so it outlives the returned reference
+        let slot = unsafe { &*self.active.current.load(Ordering::Acquire) };
+        slot.as_deref()
+    }
+
+    /// announce that this thread holds no references to the active context, reclaiming any
+    /// replaced contexts which are now unreachable (unless another thread is doing so)
+    #[inline]
+    pub fn quiescent(&mut self) {
+        self.epoch
+            .store(self.active.epoch.load(Ordering::SeqCst), Ordering::SeqCst);
+        if self.active.pending.load(Ordering::Relaxed) > 0 {
+            self.active.reclaim(false);
+        }
+    }
+}
+impl Drop for ContextReader<'_> {
+    fn drop(&mut self) {
+        self.epoch.store(OFFLINE, Ordering::SeqCst);
+        self.active
+            .readers
+            .lock()
+            .expect("context readers is poisoned")
+            .retain(|epoch| !Arc::ptr_eq(epoch, &self.epoch));
+        if self.active.pending.load(Ordering::Relaxed) > 0 {
+            self.active.reclaim(true);
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::ActiveContext;
+    use crate::lifecycle::{Command, Context};
+    use crate::{GlobalState, ServiceLocator};
+    use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+    use std::sync::{Arc, Weak};
+    use std::thread::scope;
+    use winit::Event;
+
+    /// a context which counts how often it was handed a previous context, and dropped
+    struct CountingContext {
+        owned: Arc<AtomicUsize>,
+        dropped: Arc<AtomicUsize>,
+    }
+    impl Context for CountingContext {
+        fn render(&self, _: f64, _: f64, _: &ServiceLocator) -> Command {
+            Command::Continue
+        }
+        fn update(&self, _: f64, _: &ServiceLocator, _: &GlobalState) -> Command {
+            Command::Continue
+        }
+        fn handle_input(&self, _: Event, _: &ServiceLocator, _: &GlobalState) -> Command {
+            Command::Continue
+        }
+        fn take_ownership(&self, context: Option<Box<dyn Context + Send + Sync>>) {
+            if context.is_some() {
+                self.owned.fetch_add(1, Ordering::SeqCst);
+            }
+        }
+    }
+    impl Drop for CountingContext {
+        fn drop(&mut self) {
+            self.dropped.fetch_add(1, Ordering::SeqCst);
+        }
+    }
+
+    fn counting_context(
+        owned: &Arc<AtomicUsize>,
+        dropped: &Arc<AtomicUsize>,
+    ) -> Option<Box<dyn Context + Send + Sync>> {
+        Some(Box::new(CountingContext {
+            owned: owned.clone(),
+            dropped: dropped.clone(),
+        }))
+    }
+
+    #[test]
+    fn test_swap_defers_reclamation_until_quiescent() {
+        let owned = Arc::new(AtomicUsize::new(0));
+        let dropped = Arc::new(AtomicUsize::new(0));
+        let active = ActiveContext::default();
+        active.swap(counting_context(&owned, &dropped));
+        assert_eq!(dropped.load(Ordering::SeqCst), 0);
+
+        let mut reader = active.register();
+        assert!(reader.get().is_some());
+        active.swap(counting_context(&owned, &dropped));
+        assert_eq!(owned.load(Ordering::SeqCst), 0);
+        reader.quiescent();
+        assert_eq!(owned.load(Ordering::SeqCst), 1);
+        assert_eq!(dropped.load(Ordering::SeqCst), 1);
+
+        active.swap(None);
+        assert!(reader.get().is_none());
+        assert_eq!(dropped.load(Ordering::SeqCst), 1);
+        drop(reader);
+        assert_eq!(dropped.load(Ordering::SeqCst), 2);
+    }
+
+    /// a context which ends the game when it is handed a previous context
+    struct StoppingContext {
+        active: Weak<ActiveContext>,
+        dropped: Arc<AtomicUsize>,
+    }
+    impl Context for StoppingContext {
+        fn render(&self, _: f64, _: f64, _: &ServiceLocator) -> Command {
+            Command::Continue
+        }
+        fn update(&self, _: f64, _: &ServiceLocator, _: &GlobalState) -> Command {
+            Command::Continue
+        }
+        fn handle_input(&self, _: Event, _: &ServiceLocator, _: &GlobalState) -> Command {
+            Command::Continue
+        }
+        fn take_ownership(&self, context: Option<Box<dyn Context + Send + Sync>>) {
+            if let (Some(_), Some(active)) = (context, self.active.upgrade()) {
+                active.swap(None);
+            }
+        }
+    }
+    impl Drop for StoppingContext {
+        fn drop(&mut self) {
+            self.dropped.fetch_add(1, Ordering::SeqCst);
+        }
+    }
+
+    #[test]
+    fn test_swap_from_take_ownership() {
+        let owned = Arc::new(AtomicUsize::new(0));
+        let dropped = Arc::new(AtomicUsize::new(0));
+        let active = Arc::new(ActiveContext::default());
+        active.swap(counting_context(&owned, &dropped));
+        active.swap(Some(Box::new(StoppingContext {
+            active: Arc::downgrade(&active),
+            dropped: dropped.clone(),
+        })));
+        // both the counting context and the stopping context which replaced it are reclaimed
+        assert_eq!(dropped.load(Ordering::SeqCst), 2);
+        assert!(active.register().get().is_none());
+
+        // with a reader, the stopping context is reclaimed once the reader is quiescent
+        active.swap(counting_context(&owned, &dropped));
+        let mut reader = active.register();
+        active.swap(Some(Box::new(StoppingContext {
+            active: Arc::downgrade(&active),
+            dropped: dropped.clone(),
+        })));
+        assert_eq!(dropped.load(Ordering::SeqCst), 2);
+        reader.quiescent();
+        assert_eq!(dropped.load(Ordering::SeqCst), 3);
+        assert!(reader.get().is_none());
+        reader.quiescent();
+        assert_eq!(dropped.load(Ordering::SeqCst), 4);
+    }
+
+    #[test]
+    fn test_swap_while_reading_from_other_threads() {
+        let owned = Arc::new(AtomicUsize::new(0));
+        let dropped = Arc::new(AtomicUsize::new(0));
+        let active = ActiveContext::default();
+        let stop = AtomicBool::new(false);
+        scope(|scope| {
+            for _ in 0..2 {
+                scope.spawn(|| {
+                    let services = ServiceLocator::default();
+                    let mut reader = active.register();
+                    while !stop.load(Ordering::Relaxed) {
+                        if let Some(context) = reader.get() {
+                            context.render(0.0, 1.0, &services);
+                        }
+                        reader.quiescent();
+                    }
+                });
+            }
+            for _ in 0..1000 {
+                active.swap(counting_context(&owned, &dropped));
+            }
+            stop.store(true, Ordering::Relaxed);
+        });
+        assert_eq!(owned.load(Ordering::SeqCst), 999);
+        drop(active);
+        assert_eq!(dropped.load(Ordering::SeqCst), 1000);
+    }
+}
@@ -4,6 +4,9 @@ use crate::GlobalState;
 use crate::ServiceLocator;
 use winit::Event;
 
+pub mod active;
+pub mod scheduler;
+
 /// a command that tells one of the game loops what to do before the next iteration.
 #[derive(PartialEq)]
 pub enum Command {
@@ -16,13 +19,17 @@ pub enum Command {
 /// An object that represents a set of subroutines defining how to run the game. It may encapsulate
 /// game state, and it is optionally given ownership of the previous context after a context switch.
 pub trait Context: Send + Sync {
-    /// function that renders the game
-    fn render(&self, delta: f64, services: &ServiceLocator) -> Command;
+    /// function that renders the game, where `alpha` is how far the update loop is between its
+    /// last tick and the next (from 0.0 to 1.0), for interpolating between the previous and
+    /// current game state
+    fn render(&self, delta: f64, alpha: f64, services: &ServiceLocator) -> Command;
     /// function that updates game state
     fn update(&self, delta: f64, services: &ServiceLocator, state: &GlobalState) -> Command;
     /// function that handles inbound window/device events
     fn handle_input(&self, event: Event, services: &ServiceLocator, state: &GlobalState) -> Command;
     /// a function that is called after a context switch, passing ownership of the previous context
     /// into this context (can be used to override the previous context's functionality by proxying)
+    /// once the game loops have stopped using it, so it may be called after this context has
+    /// already started running
     fn take_ownership(&self, _context: Option<Box<dyn Context + Send + Sync>>) {}
 }
@@ -0,0 +1,477 @@
+//! scheduling of any number of named game loops, each at its own rate and on its own thread,
+//! a shared pool of threads, or the main thread
+
+use super::active::ContextReader;
+use super::{Command, Context};
+use crate::event::timing::{F64Timer, RevLimiter, RevLimiterBuilder, WaitStrategy};
+use crate::job::JobPool;
+use crate::GlobalState;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::thread::{scope, Builder};
+use std::time::{Duration, Instant};
+
+/// how long before a loop's deadline its thread stops running jobs, to leave room for the last
+/// job to finish
+const HELP_MARGIN: Duration = Duration::from_micros(500);
+
+/// which thread a scheduled loop runs on
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Affinity {
+    /// a thread of its own, named after the loop
+    Dedicated,
+    /// one of the scheduler's pool threads, shared with other loops (loops are spread over the
+    /// pool in the order they were added)
+    SharedPool,
+    /// the thread which runs the scheduler, shared with other main thread loops (e.g. for
+    /// windowing and rendering APIs which must stay on the main thread)
+    Main,
+}
+
+/// what a scheduled loop is given each time it runs
+pub struct Frame<'a> {
+    /// the name of the loop
+    pub name: &'a str,
+    /// the delta time in seconds (the fixed tick length, for fixed-timestep loops)
+    pub delta: f64,
+    /// when the loop woke, according to its clock
+    pub time: Instant,
+    /// the active context, or `None` if the game has stopped
+    pub context: Option<&'a (dyn Context + Send + Sync)>,
+    /// the game's shared state
+    pub state: &'a GlobalState,
+}
+
+/// the body of a scheduled loop, which stops every loop by returning `Command::Stop`
+pub type LoopBody = Box<dyn FnMut(&Frame<'_>) -> Command + Send>;
+
+/// a named loop, paced by its own RevLimiter
+pub struct ScheduledLoop {
+    name: String,
+    rev_limiter: RevLimiter,
+    affinity: Affinity,
+    publish_tick_phase: bool,
+    body: LoopBody,
+}
+impl ScheduledLoop {
+    /// the name of the loop
+    pub fn name(&self) -> &str {
+        &self.name
+    }
+
+    /// the thread the loop runs on
+    pub fn affinity(&self) -> Affinity {
+        self.affinity
+    }
+
+    /// run the loop's body for a single wake (once, or once per tick for fixed-timestep loops)
+    fn wake(&mut self, reader: &ContextReader<'_>, state: &GlobalState) -> Command {
+        if self.rev_limiter.accumulator.is_none() {
+            let delta = self.rev_limiter.begin();
+            return (self.body)(&Frame {
+                name: &self.name,
+                delta,
+                time: self.rev_limiter.clock.reset_time(),
+                context: reader.get(),
+                state,
+            });
+        }
+        let ticks = self.rev_limiter.begin_ticks();
+        let delta = self.rev_limiter.tick_delta();
+        let time = self.rev_limiter.clock.reset_time();
+        let mut command = Command::Continue;
+        for _ in 0..ticks {
+            if !self.rev_limiter.timers.is_empty() {
+                self.rev_limiter.timers.tick(Duration::from_secs_f64(delta));
+            }
+            command = (self.body)(&Frame {
+                name: &self.name,
+                delta,
+                time,
+                context: reader.get(),
+                state,
+            });
+            if command == Command::Stop {
+                break;
+            }
+        }
+        if self.publish_tick_phase {
+            state.tick_phase.publish(&self.rev_limiter, time);
+        }
+        command
+    }
+}
+
+/// builder for constructing a ScheduledLoop with a fluent API
+pub struct ScheduledLoopBuilder {
+    wrapped: ScheduledLoop,
+    /// timers to schedule on the loop's RevLimiter once it is built (whichever it ends up with)
+    timers: Vec<F64Timer>,
+}
+impl ScheduledLoopBuilder {
+    /// begin building a loop which runs `body` at a frequency (iterations per second), with
+    /// the hybrid wait strategy on a dedicated thread
+    pub fn new(
+        name: impl Into<String>,
+        frequency: f64,
+        body: impl FnMut(&Frame<'_>) -> Command + Send + 'static,
+    ) -> Self {
+        Self {
+            wrapped: ScheduledLoop {
+                name: name.into(),
+                rev_limiter: RevLimiterBuilder::new_from_frequency(frequency)
+                    .with_wait_strategy(WaitStrategy::Hybrid)
+                    .build(),
+                affinity: Affinity::Dedicated,
+                publish_tick_phase: false,
+                body: Box::new(body),
+            },
+            timers: Vec::new(),
+        }
+    }
+
+    /// begin building a loop which runs `body` as often as it can (e.g. a render loop paced by
+    /// presenting at vsync)
+    pub fn new_unlimited(
+        name: impl Into<String>,
+        body: impl FnMut(&Frame<'_>) -> Command + Send + 'static,
+    ) -> Self {
+        let mut builder = Self::new(name, 1.0, body);
+        builder.wrapped.rev_limiter.set_interval(0.0);
+        builder
+    }
+
+    /// pace the loop with a custom RevLimiter (for lockstep, catchup or fixed-timestep policies)
+    pub fn with_rev_limiter(mut self, rev_limiter: RevLimiter) -> Self {
+        self.wrapped.rev_limiter = rev_limiter;
+        self
+    }
+
+    /// schedule a timer on the loop, whose observers are notified on the loop's thread before the
+    /// body runs
+    pub fn with_timer(mut self, timer: F64Timer) -> Self {
+        self.timers.push(timer);
+        self
+    }
+
+    /// set the thread the loop runs on
+    pub fn with_affinity(mut self, affinity: Affinity) -> Self {
+        self.wrapped.affinity = affinity;
+        self
+    }
+
+    /// publish the phase of this fixed-timestep loop to `GlobalState::tick_phase` after each wake,
+    /// for other loops to interpolate from
+    pub fn publish_tick_phase(mut self) -> Self {
+        self.wrapped.publish_tick_phase = true;
+        self
+    }
+
+    /// build the ScheduledLoop, disposing of the builder
+    pub fn build(mut self) -> ScheduledLoop {
+        for timer in self.timers {
+            self.wrapped.rev_limiter.timers.add(timer);
+        }
+        self.wrapped
+    }
+}
+
+/// sets the stop flag when a loop thread exits, even by panicking, so the others follow it
+struct StopOnExit<'a>(&'a AtomicBool);
+impl Drop for StopOnExit<'_> {
+    fn drop(&mut self) {
+        self.0.store(true, Ordering::Relaxed);
+    }
+}
+
+/// runs a set of loops on a single thread, always waking the loop which is due first, and running
+/// queued jobs in between (loops on a thread should share a time source, as their deadlines are
+/// compared with each other)
+fn run_loops(
+    loops: &mut [ScheduledLoop],
+    state: &GlobalState,
+    jobs: Option<&JobPool>,
+    stop: &AtomicBool,
+) {
+    if loops.is_empty() {
+        return;
+    }
+    let _stop_on_exit = StopOnExit(stop);
+    let mut reader = state.active_context.register();
+    let mut due: Vec<Instant> = loops
+        .iter()
+        .map(|scheduled| scheduled.rev_limiter.now())
+        .collect();
+    while !stop.load(Ordering::Relaxed) {
+        for (index, scheduled) in loops.iter_mut().enumerate() {
+            if scheduled.rev_limiter.now() < due[index] {
+                continue;
+            }
+            if scheduled.wake(&reader, state) == Command::Stop {
+                return;
+            }
+            let wait = scheduled.rev_limiter.end();
+            due[index] = scheduled.rev_limiter.clock.reset_time() + wait;
+        }
+        reader.quiescent();
+        let (index, deadline) = due
+            .iter()
+            .enumerate()
+            .min_by_key(|(_, deadline)| **deadline)
+            .map(|(index, deadline)| (index, *deadline))
+            .expect("no loops to run");
+        let is_virtual = loops[index].rev_limiter.clock.source().is_virtual();
+        if let Some(jobs) = jobs.filter(|_| !is_virtual) {
+            if let Some(help_deadline) = deadline.checked_sub(HELP_MARGIN) {
+                jobs.help_until(help_deadline);
+            }
+        }
+        loops[index].rev_limiter.wait_until(deadline);
+    }
+}
+
+/// runs any number of named loops, each paced by its own RevLimiter, until one of them stops
+pub struct Scheduler {
+    loops: Vec<ScheduledLoop>,
+    pool_threads: usize,
+    /// run at the start of every thread which runs loops
+    thread_start: Option<Box<dyn Fn() + Send + Sync>>,
+}
+impl Default for Scheduler {
+    fn default() -> Self {
+        Self {
+            loops: Vec::new(),
+            pool_threads: 1,
+            thread_start: None,
+        }
+    }
+}
+impl Scheduler {
+    /// create a new scheduler with a single pool thread
+    pub fn new() -> Self {
+        Default::default()
+    }
+
+    /// set the number of threads shared by `Affinity::SharedPool` loops
+    pub fn with_pool_threads(mut self, threads: usize) -> Self {
+        self.pool_threads = threads.max(1);
+        self
+    }
+
+    /// run a function at the start of every thread which runs loops, including the calling thread
+    /// (e.g. to register the thread with a log)
+    pub fn with_thread_start(mut self, thread_start: impl Fn() + Send + Sync + 'static) -> Self {
+        self.thread_start = Some(Box::new(thread_start));
+        self
+    }
+
+    /// add a loop to be run
+    pub fn add_loop(&mut self, scheduled: ScheduledLoop) {
+        self.loops.push(scheduled);
+    }
+
+    /// run every loop until one of them returns `Command::Stop` (main thread loops run on the
+    /// calling thread, and a loop only notices another has stopped when it next wakes), letting
+    /// the loop threads run jobs from a job pool while they wait
+    pub fn run(self, state: &GlobalState, jobs: Option<&JobPool>) {
+        let mut main = Vec::new();
+        let mut pools: Vec<Vec<ScheduledLoop>> =
+            (0..self.pool_threads).map(|_| Vec::new()).collect();
+        let mut dedicated = Vec::new();
+        let mut next_pool = 0;
+        let hook = self.thread_start;
+        for scheduled in self.loops {
+            match scheduled.affinity {
+                Affinity::Main => main.push(scheduled),
+                Affinity::SharedPool => {
+                    pools[next_pool].push(scheduled);
+                    next_pool = (next_pool + 1) % pools.len();
+                }
+                Affinity::Dedicated => dedicated.push(vec![scheduled]),
+            }
+        }
+        let stop = AtomicBool::new(false);
+        let thread_start = || {
+            if let Some(ref thread_start) = hook {
+                thread_start();
+            }
+        };
+        scope(|scope| {
+            let threads = dedicated
+                .into_iter()
+                .map(|loops| (loops[0].name.clone(), loops))
+                .chain(
+                    pools
+                        .into_iter()
+                        .enumerate()
+                        .filter(|(_, loops)| !loops.is_empty())
+                        .map(|(index, loops)| (format!("loop-pool-{}", index), loops)),
+                );
+            for (name, mut loops) in threads {
+                let stop = &stop;
+                Builder::new()
+                    .name(name)
+                    .spawn_scoped(scope, move || {
+                        thread_start();
+                        run_loops(&mut loops, state, jobs, stop)
+                    })
+                    .expect("failed to spawn a loop thread");
+            }
+            thread_start();
+            run_loops(&mut main, state, jobs, &stop);
+        });
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::{Affinity, Frame, ScheduledLoopBuilder, Scheduler};
+    use crate::event::timing::{F64Timer, RevLimiterBuilder, TimerSchedule};
+    use crate::lifecycle::Command;
+    use crate::GlobalState;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+    use std::sync::Arc;
+
+    fn counting_loop(
+        name: &str,
+        frequency: f64,
+        affinity: Affinity,
+        count: &Arc<AtomicUsize>,
+    ) -> super::ScheduledLoop {
+        let count = count.clone();
+        ScheduledLoopBuilder::new(name, frequency, move |_: &Frame<'_>| {
+            count.fetch_add(1, Ordering::Relaxed);
+            Command::Continue
+        })
+        .with_affinity(affinity)
+        .build()
+    }
+
+    #[test]
+    fn test_scheduler_runs_loops_at_their_own_rates() {
+        let fast = Arc::new(AtomicUsize::new(0));
+        let slow = Arc::new(AtomicUsize::new(0));
+        let pooled = Arc::new(AtomicUsize::new(0));
+        let mut scheduler = Scheduler::new().with_pool_threads(2);
+        scheduler.add_loop(counting_loop("fast", 200.0, Affinity::Dedicated, &fast));
+        scheduler.add_loop(counting_loop("slow", 20.0, Affinity::SharedPool, &slow));
+        scheduler.add_loop(counting_loop(
+            "pooled",
+            100.0,
+            Affinity::SharedPool,
+            &pooled,
+        ));
+        let mut wakes = 0;
+        scheduler.add_loop(
+            ScheduledLoopBuilder::new("main", 1.0, move |frame: &Frame<'_>| {
+                assert_eq!(frame.name, "main");
+                assert!(frame.context.is_none());
+                wakes += 1;
+                match wakes {
+                    2 => Command::Stop,
+                    _ => Command::Continue,
+                }
+            })
+            .with_rev_limiter(
+                RevLimiterBuilder::new_from_interval_secs(0.25)
+                    .enable_fixed_timestep(1)
+                    .build(),
+            )
+            .with_affinity(Affinity::Main)
+            .publish_tick_phase()
+            .build(),
+        );
+        scheduler.run(&GlobalState::default(), None);
+
+        // the main loop runs its first tick straight away, and its second 250ms later
+        let (fast, slow, pooled) = (
+            fast.load(Ordering::Relaxed),
+            slow.load(Ordering::Relaxed),
+            pooled.load(Ordering::Relaxed),
+        );
+        assert!((25..=60).contains(&fast), "fast loop ran {} times", fast);
+        assert!((3..=8).contains(&slow), "slow loop ran {} times", slow);
+        assert!(
+            (12..=30).contains(&pooled),
+            "pooled loop ran {} times",
+            pooled
+        );
+    }
+
+    #[test]
+    fn test_loops_keep_timers_added_before_their_rev_limiter() {
+        let timer = || F64Timer::new(TimerSchedule::Frames(1));
+        let scheduled = ScheduledLoopBuilder::new("timed", 100.0, |_: &Frame<'_>| Command::Stop)
+            .with_timer(timer())
+            .with_rev_limiter(
+                RevLimiterBuilder::new_from_frequency(50.0)
+                    .with_timer(timer())
+                    .build(),
+            )
+            .with_timer(timer())
+            .build();
+        assert_eq!(scheduled.rev_limiter.timers.len(), 3);
+    }
+
+    #[test]
+    fn test_scheduler_starts_every_loop_thread() {
+        let started = Arc::new(AtomicUsize::new(0));
+        let count = Arc::new(AtomicUsize::new(0));
+        let thread_started = started.clone();
+        let mut scheduler = Scheduler::new().with_thread_start(move || {
+            thread_started.fetch_add(1, Ordering::Relaxed);
+        });
+        scheduler.add_loop(counting_loop(
+            "dedicated",
+            100.0,
+            Affinity::Dedicated,
+            &count,
+        ));
+        scheduler.add_loop(
+            ScheduledLoopBuilder::new("main", 100.0, |_: &Frame<'_>| Command::Stop)
+                .with_affinity(Affinity::Main)
+                .build(),
+        );
+        scheduler.run(&GlobalState::default(), None);
+        assert_eq!(started.load(Ordering::Relaxed), 2);
+    }
+
+    #[test]
+    fn test_scheduler_replays_loops_sharing_a_recording() {
+        use crate::event::source::{RecordingClock, ReplayClock, TimeSource};
+        use std::sync::Mutex;
+
+        let run = |source: Arc<dyn TimeSource>| {
+            assert!(source.is_deterministic());
+            let deltas = Arc::new(Mutex::new(Vec::new()));
+            let mut scheduler = Scheduler::new();
+            for &(name, frequency) in [("update", 400.0), ("render", 150.0)].iter() {
+                let deltas = deltas.clone();
+                let mut frames = 0;
+                scheduler.add_loop(
+                    ScheduledLoopBuilder::new(name, frequency, move |frame: &Frame<'_>| {
+                        deltas.lock().expect("poisoned").push((name, frame.delta));
+                        frames += 1;
+                        match frames {
+                            20 => Command::Stop,
+                            _ => Command::Continue,
+                        }
+                    })
+                    .with_rev_limiter(
+                        RevLimiterBuilder::new_from_frequency(frequency)
+                            .with_time_source(source.clone())
+                            .build(),
+                    )
+                    .with_affinity(Affinity::Main)
+                    .build(),
+                );
+            }
+            scheduler.run(&GlobalState::default(), None);
+            let deltas = deltas.lock().expect("poisoned").clone();
+            deltas
+        };
+        let recording = Arc::new(RecordingClock::new());
+        let recorded = run(recording.clone());
+        let replay = Arc::new(ReplayClock::new(recording.readings()));
+        assert_eq!(run(replay), recorded);
+    }
+}
@@ -0,0 +1,490 @@
+//! a compact binary encoding of log events, and a decoder for reading it back offline
+//!
+//! A stream starts with `MAGIC`, a version byte, and the zigzag varint of the Unix time (in
+//! nanoseconds) of the writer's timestamp anchor, then holds a sequence of records, each
+//! introduced by a tag byte:
+//!
+//! - a context definition: the context id and its name
+//! - a template definition: the template id and its text
+//! - an event: the zigzag varint of monotonic nanoseconds since the previous event (or since the
+//!   anchor, for the first one), a severity byte, a context id, and a message that is either raw
+//!   text or a template id followed by its encoded arguments
+//!
+//! Context and template definitions are written once per stream, the first time they are used,
+//! so that messages are never formatted while logging. Ids are assigned densely from zero in the
+//! order they are defined.
+
+use super::context::ContextId;
+use super::event::{format_template, Argument, Event, Message, Receiver, Severity};
+use super::timestamp::Timestamp;
+use chrono::{DateTime, TimeZone, Utc};
+use std::collections::HashMap;
+use std::convert::TryFrom;
+use std::fmt::{self, Display, Formatter};
+use std::io::{self, Write};
+use std::str::from_utf8;
+
+/// the bytes at the start of every binary log stream
+pub const MAGIC: &[u8; 6] = b"TWLOG\0";
+
+/// the version of the encoding written by this module
+pub const VERSION: u8 = 2;
+
+const TAG_CONTEXT: u8 = 1;
+const TAG_TEMPLATE: u8 = 2;
+const TAG_EVENT: u8 = 3;
+
+const MESSAGE_TEXT: u8 = 0;
+const MESSAGE_TEMPLATE: u8 = 1;
+
+const ARGUMENT_SIGNED: u8 = 0;
+const ARGUMENT_UNSIGNED: u8 = 1;
+const ARGUMENT_FLOAT: u8 = 2;
+const ARGUMENT_BOOL: u8 = 3;
+const ARGUMENT_CHAR: u8 = 4;
+const ARGUMENT_STR: u8 = 5;
+
+/// the number of encoded bytes to collect before handing them to the underlying writer
+const WRITE_THRESHOLD: usize = 64 * 1024;
+
+fn put_varint(buffer: &mut Vec<u8>, mut value: u64) {
+    while value >= 0x80 {
+        buffer.push((value as u8) | 0x80);
+        value >>= 7;
+    }
+    buffer.push(value as u8);
+}
+
+fn put_signed_varint(buffer: &mut Vec<u8>, value: i64) {
+    put_varint(buffer, ((value << 1) ^ (value >> 63)) as u64);
+}
+
+fn put_bytes(buffer: &mut Vec<u8>, bytes: &[u8]) {
+    put_varint(buffer, bytes.len() as u64);
+    buffer.extend_from_slice(bytes);
+}
+
+fn put_argument(buffer: &mut Vec<u8>, argument: &Argument) {
+    match *argument {
+        Argument::Signed(value) => {
+            buffer.push(ARGUMENT_SIGNED);
+            put_signed_varint(buffer, value);
+        }
+        Argument::Unsigned(value) => {
+            buffer.push(ARGUMENT_UNSIGNED);
+            put_varint(buffer, value);
+        }
+        Argument::Float(value) => {
+            buffer.push(ARGUMENT_FLOAT);
+            buffer.extend_from_slice(&value.to_le_bytes());
+        }
+        Argument::Bool(value) => {
+            buffer.push(ARGUMENT_BOOL);
+            buffer.push(value as u8);
+        }
+        Argument::Char(value) => {
+            buffer.push(ARGUMENT_CHAR);
+            put_varint(buffer, u64::from(value));
+        }
+        Argument::Str(value) => {
+            buffer.push(ARGUMENT_STR);
+            put_bytes(buffer, value.as_bytes());
+        }
+    }
+}
+
+/// a receiver that encodes events into the binary log format and streams them to a writer
+pub struct BinaryReceiver<W: Write> {
+    writer: W,
+    buffer: Vec<u8>,
+    last_time: i64,
+    /// the stream id of each context defined so far, by context index (ids are assigned densely
+    /// in the order contexts are defined)
+    contexts: Vec<Option<u64>>,
+    context_count: u64,
+    templates: HashMap<(usize, usize), u64>,
+    flush_severity: Severity,
+}
+impl<W: Write> BinaryReceiver<W> {
+    /// create a binary log receiver, writing the stream header to `writer` straight away
+    pub fn new(mut writer: W) -> io::Result<Self> {
+        let mut header = MAGIC.to_vec();
+        header.push(VERSION);
+        put_signed_varint(&mut header, Timestamp::from_ticks(0).unix_nanoseconds());
+        writer.write_all(&header)?;
+        Ok(Self {
+            writer,
+            buffer: Vec::with_capacity(WRITE_THRESHOLD),
+            last_time: 0,
+            contexts: Vec::new(),
+            context_count: 0,
+            templates: HashMap::new(),
+            flush_severity: Severity::Error,
+        })
+    }
+
+    /// set the severity at and above which events are written out immediately
+    pub fn with_flush_severity(mut self, severity: Severity) -> Self {
+        self.flush_severity = severity;
+        self
+    }
+
+    /// get the id of a context, defining it in the stream if it is new
+    fn define_context(&mut self, context: ContextId) -> u64 {
+        let index = context.index();
+        if index >= self.contexts.len() {
+            self.contexts.resize(index + 1, None);
+        }
+        if let Some(id) = self.contexts[index] {
+            return id;
+        }
+        let id = self.context_count;
+        self.context_count += 1;
+        self.contexts[index] = Some(id);
+        self.buffer.push(TAG_CONTEXT);
+        put_varint(&mut self.buffer, id);
+        put_bytes(&mut self.buffer, context.name().as_bytes());
+        id
+    }
+
+    /// get the id of a template, keyed by its address since templates are static strings
+    fn define_template(&mut self, template: &'static str) -> u64 {
+        let next_id = self.templates.len() as u64;
+        let key = (template.as_ptr() as usize, template.len());
+        let id = *self.templates.entry(key).or_insert(next_id);
+        if id == next_id {
+            self.buffer.push(TAG_TEMPLATE);
+            put_varint(&mut self.buffer, id);
+            put_bytes(&mut self.buffer, template.as_bytes());
+        }
+        id
+    }
+
+    fn encode(&mut self, event: &Event) {
+        let context_id = self.define_context(event.context);
+        let template_id = match event.message {
+            Message::Template(ref template) => self.define_template(template.template()),
+            _ => 0,
+        };
+
+        let time = event.time.ticks();
+        let buffer = &mut self.buffer;
+        buffer.push(TAG_EVENT);
+        put_signed_varint(buffer, time.wrapping_sub(self.last_time));
+        self.last_time = time;
+        buffer.push(event.severity as u8);
+        put_varint(buffer, context_id);
+        match event.message {
+            Message::Static(text) => {
+                buffer.push(MESSAGE_TEXT);
+                put_bytes(buffer, text.as_bytes());
+            }
+            Message::Owned(ref text) => {
+                buffer.push(MESSAGE_TEXT);
+                put_bytes(buffer, text.as_bytes());
+            }
+            Message::Template(ref template) => {
+                buffer.push(MESSAGE_TEMPLATE);
+                put_varint(buffer, template_id);
+                buffer.push(template.arguments().len() as u8);
+                for argument in template.arguments() {
+                    put_argument(buffer, argument);
+                }
+            }
+        }
+    }
+
+    fn write_buffer(&mut self) -> io::Result<()> {
+        let result = self.writer.write_all(&self.buffer);
+        self.buffer.clear();
+        result
+    }
+}
+impl<W: Write> Receiver for BinaryReceiver<W> {
+    fn notify(&mut self, event: &Event) {
+        self.encode(event);
+        if self.buffer.len() >= WRITE_THRESHOLD || event.severity >= self.flush_severity {
+            let _ = self.write_buffer();
+        }
+    }
+
+    fn flush(&mut self) {
+        let _ = self.write_buffer();
+        let _ = self.writer.flush();
+    }
+}
+impl<W: Write> Drop for BinaryReceiver<W> {
+    fn drop(&mut self) {
+        Receiver::flush(self);
+    }
+}
+
+/// an error encountered while decoding a binary log stream
+#[derive(Debug, PartialEq)]
+pub enum DecodeError {
+    /// the stream does not start with `MAGIC`, or has an unsupported version
+    BadHeader,
+    /// the stream ends in the middle of a record
+    Truncated,
+    /// a record has an unrecognized tag or field
+    Malformed,
+    /// a string in the stream is not valid UTF-8
+    BadUtf8,
+    /// an event refers to a context or template that was never defined
+    Undefined,
+}
+impl Display for DecodeError {
+    fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+        f.write_str(match self {
+            DecodeError::BadHeader => "not a binary log stream, or an unsupported version",
+            DecodeError::Truncated => "binary log stream ends in the middle of a record",
+            DecodeError::Malformed => "binary log stream contains a malformed record",
+            DecodeError::BadUtf8 => "binary log stream contains invalid UTF-8",
+            DecodeError::Undefined => "binary log event refers to an undefined context or template",
+        })
+    }
+}
+impl std::error::Error for DecodeError {}
+
+/// an argument decoded from a binary log stream, borrowing from it
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum DecodedArgument<'a> {
+    /// a recorded argument other than a string
+    Value(Argument),
+    /// a recorded string argument
+    Str(&'a str),
+}
+impl Display for DecodedArgument<'_> {
+    fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+        match self {
+            DecodedArgument::Value(value) => Display::fmt(value, f),
+            DecodedArgument::Str(value) => Display::fmt(value, f),
+        }
+    }
+}
+
+/// the message of a decoded record, borrowing from the binary log stream
+#[derive(Debug, PartialEq)]
+pub enum DecodedMessage<'a> {
+    /// raw message text
+    Text(&'a str),
+    /// a template and its arguments
+    Template(&'a str, Vec<DecodedArgument<'a>>),
+}
+impl Display for DecodedMessage<'_> {
+    fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+        match self {
+            DecodedMessage::Text(text) => f.write_str(text),
+            DecodedMessage::Template(template, arguments) => {
+                format_template(f, template, arguments)
+            }
+        }
+    }
+}
+
+/// a log event decoded from a binary log stream, borrowing from it
+#[derive(Debug, PartialEq)]
+pub struct Record<'a> {
+    /// the date and time that the log message was created
+    pub time: DateTime<Utc>,
+    /// the severity level of the log event
+    pub severity: Severity,
+    /// the name of the context of the log event
+    pub context: &'a str,
+    /// the message of the log event
+    pub message: DecodedMessage<'a>,
+}
+impl Record<'_> {
+    /// convert the record back into a log event (interning its context and formatting its
+    /// message), e.g. to render it with the text output subsystem
+    pub fn to_event(&self) -> Event {
+        Event::with_utc_time(
+            self.time,
+            self.severity,
+            self.context,
+            self.message.to_string(),
+        )
+    }
+}
+
+/// a zero-copy decoder over a complete binary log stream held in memory (such as a memory-mapped
+/// file), iterating over the events it contains
+pub struct Decoder<'a> {
+    data: &'a [u8],
+    position: usize,
+    anchor: i64,
+    last_time: i64,
+    contexts: Vec<Option<&'a str>>,
+    templates: Vec<Option<&'a str>>,
+}
+impl<'a> Decoder<'a> {
+    /// begin decoding a binary log stream, checking its header
+    pub fn new(data: &'a [u8]) -> Result<Self, DecodeError> {
+        if data.len() <= MAGIC.len()
+            || &data[..MAGIC.len()] != MAGIC
+            || data[MAGIC.len()] != VERSION
+        {
+            return Err(DecodeError::BadHeader);
+        }
+        let mut decoder = Self {
+            data,
+            position: MAGIC.len() + 1,
+            anchor: 0,
+            last_time: 0,
+            contexts: Vec::new(),
+            templates: Vec::new(),
+        };
+        decoder.anchor = decoder
+            .signed_varint()
+            .map_err(|_| DecodeError::BadHeader)?;
+        Ok(decoder)
+    }
+
+    fn byte(&mut self) -> Result<u8, DecodeError> {
+        let byte = *self.data.get(self.position).ok_or(DecodeError::Truncated)?;
+        self.position += 1;
+        Ok(byte)
+    }
+
+    fn bytes(&mut self, length: usize) -> Result<&'a [u8], DecodeError> {
+        let end = self
+            .position
+            .checked_add(length)
+            .ok_or(DecodeError::Truncated)?;
+        let bytes = self
+            .data
+            .get(self.position..end)
+            .ok_or(DecodeError::Truncated)?;
+        self.position = end;
+        Ok(bytes)
+    }
+
+    fn varint(&mut self) -> Result<u64, DecodeError> {
+        let mut value = 0u64;
+        for shift in (0..64).step_by(7) {
+            let byte = self.byte()?;
+            value |= u64::from(byte & 0x7f) << shift;
+            if byte & 0x80 == 0 {
+                return Ok(value);
+            }
+        }
+        Err(DecodeError::Malformed)
+    }
+
+    fn signed_varint(&mut self) -> Result<i64, DecodeError> {
+        let value = self.varint()?;
+        Ok((value >> 1) as i64 ^ -((value & 1) as i64))
+    }
+
+    fn string(&mut self) -> Result<&'a str, DecodeError> {
+        let length = self.varint()? as usize;
+        from_utf8(self.bytes(length)?).map_err(|_| DecodeError::BadUtf8)
+    }
+
+    /// define an id, which must be at most one past the last id defined (as ids are assigned
+    /// densely), so a corrupt id cannot make the table grow without bound
+    fn define(table: &mut Vec<Option<&'a str>>, id: u64, name: &'a str) -> Result<(), DecodeError> {
+        match usize::try_from(id) {
+            Ok(id) if id < table.len() => table[id] = Some(name),
+            Ok(id) if id == table.len() => table.push(Some(name)),
+            _ => return Err(DecodeError::Malformed),
+        }
+        Ok(())
+    }
+
+    fn lookup(table: &[Option<&'a str>], id: u64) -> Result<&'a str, DecodeError> {
+        table
+            .get(id as usize)
+            .cloned()
+            .flatten()
+            .ok_or(DecodeError::Undefined)
+    }
+
+    fn argument(&mut self) -> Result<DecodedArgument<'a>, DecodeError> {
+        Ok(match self.byte()? {
+            ARGUMENT_SIGNED => DecodedArgument::Value(Argument::Signed(self.signed_varint()?)),
+            ARGUMENT_UNSIGNED => DecodedArgument::Value(Argument::Unsigned(self.varint()?)),
+            ARGUMENT_FLOAT => {
+                let mut bytes = [0u8; 8];
+                bytes.copy_from_slice(self.bytes(8)?);
+                DecodedArgument::Value(Argument::Float(f64::from_le_bytes(bytes)))
+            }
+            ARGUMENT_BOOL => DecodedArgument::Value(Argument::Bool(self.byte()? != 0)),
+            ARGUMENT_CHAR => {
+                let value =
+                    std::char::from_u32(self.varint()? as u32).ok_or(DecodeError::Malformed)?;
+                DecodedArgument::Value(Argument::Char(value))
+            }
+            ARGUMENT_STR => DecodedArgument::Str(self.string()?),
+            _ => return Err(DecodeError::Malformed),
+        })
+    }
+
+    fn event(&mut self) -> Result<Record<'a>, DecodeError> {
+        self.last_time = self.last_time.wrapping_add(self.signed_varint()?);
+        let nanoseconds = self.anchor.wrapping_add(self.last_time);
+        let time = Utc
+            .timestamp_opt(
+                nanoseconds.div_euclid(1_000_000_000),
+                nanoseconds.rem_euclid(1_000_000_000) as u32,
+            )
+            .single()
+            .ok_or(DecodeError::Malformed)?;
+        let severity = Severity::from_u8(self.byte()?).ok_or(DecodeError::Malformed)?;
+        let context_id = self.varint()?;
+        let context = Self::lookup(&self.contexts, context_id)?;
+        let message = match self.byte()? {
+            MESSAGE_TEXT => DecodedMessage::Text(self.string()?),
+            MESSAGE_TEMPLATE => {
+                let template_id = self.varint()?;
+                let template = Self::lookup(&self.templates, template_id)?;
+                let count = self.byte()?;
+                let arguments = (0..count)
+                    .map(|_| self.argument())
+                    .collect::<Result<Vec<_>, _>>()?;
+                DecodedMessage::Template(template, arguments)
+            }
+            _ => return Err(DecodeError::Malformed),
+        };
+        Ok(Record {
+            time,
+            severity,
+            context,
+            message,
+        })
+    }
+
+    fn next_record(&mut self) -> Result<Option<Record<'a>>, DecodeError> {
+        while self.position < self.data.len() {
+            match self.byte()? {
+                TAG_CONTEXT => {
+                    let id = self.varint()?;
+                    let name = self.string()?;
+                    Self::define(&mut self.contexts, id, name)?;
+                }
+                TAG_TEMPLATE => {
+                    let id = self.varint()?;
+                    let template = self.string()?;
+                    Self::define(&mut self.templates, id, template)?;
+                }
+                TAG_EVENT => return self.event().map(Some),
+                _ => return Err(DecodeError::Malformed),
+            }
+        }
+        Ok(None)
+    }
+}
+impl<'a> Iterator for Decoder<'a> {
+    type Item = Result<Record<'a>, DecodeError>;
+
+    /// decode the next event, or stop after the end of the stream or the first error
+    fn next(&mut self) -> Option<Self::Item> {
+        match self.next_record() {
+            Ok(record) => record.map(Ok),
+            Err(error) => {
+                self.position = self.data.len();
+                Some(Err(error))
+            }
+        }
+    }
+}
@@ -0,0 +1,97 @@
+//! interning of log context names into small integer handles
+
+use std::collections::HashMap;
+use std::fmt::{Display, Formatter, Result};
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::{OnceLock, RwLock};
+
+/// the process-wide table of interned context names
+#[derive(Default)]
+struct Registry {
+    names: Vec<&'static str>,
+    ids: HashMap<&'static str, u32>,
+}
+
+fn registry() -> &'static RwLock<Registry> {
+    static REGISTRY: OnceLock<RwLock<Registry>> = OnceLock::new();
+    REGISTRY.get_or_init(Default::default)
+}
+
+/// a handle to an interned log context name, which is cheap to copy, compare and store
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub struct ContextId(u32);
+impl ContextId {
+    /// get the handle for a context name, interning it the first time it is seen (each distinct
+    /// name is allocated exactly once, for the lifetime of the process)
+    pub fn intern(name: &str) -> Self {
+        if let Some(id) = registry()
+            .read()
+            .expect("context registry is poisoned")
+            .ids
+            .get(name)
+        {
+            return ContextId(*id);
+        }
+        let mut registry = registry().write().expect("context registry is poisoned");
+        if let Some(id) = registry.ids.get(name) {
+            return ContextId(*id);
+        }
+        let name: &'static str = Box::leak(name.to_owned().into_boxed_str());
+        let id = registry.names.len() as u32;
+        registry.names.push(name);
+        registry.ids.insert(name, id);
+        ContextId(id)
+    }
+
+    /// the name that this context was interned from
+    pub fn name(self) -> &'static str {
+        registry()
+            .read()
+            .expect("context registry is poisoned")
+            .names[self.0 as usize]
+    }
+
+    /// the dense integer index of this context, in the order contexts were first interned
+    pub fn index(self) -> usize {
+        self.0 as usize
+    }
+}
+impl From<&str> for ContextId {
+    fn from(name: &str) -> Self {
+        ContextId::intern(name)
+    }
+}
+impl Display for ContextId {
+    fn fmt(&self, f: &mut Formatter<'_>) -> Result {
+        f.pad(self.name())
+    }
+}
+
+/// a context name declared in a `static`, which interns itself on first use and then resolves to
+/// its handle with a single atomic load (used by the logging macros at each call site)
+pub struct StaticContext {
+    name: &'static str,
+    /// the interned id plus one, or zero if it has not been interned yet
+    id: AtomicU32,
+}
+impl StaticContext {
+    /// declare a context by name, without interning it yet
+    pub const fn new(name: &'static str) -> Self {
+        Self {
+            name,
+            id: AtomicU32::new(0),
+        }
+    }
+
+    /// get the handle for this context, interning it if needed
+    pub fn id(&self) -> ContextId {
+        match self.id.load(Ordering::Relaxed) {
+            0 => {
+                let id = ContextId::intern(self.name);
+                self.id.store(id.0 + 1, Ordering::Relaxed);
+                id
+            }
+            id => ContextId(id - 1),
+        }
+    }
+}
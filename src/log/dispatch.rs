@@ -0,0 +1,506 @@
+//! background dispatch of log events, keeping slow receivers off of the game loop threads
+
+use super::event::{Event, Receiver};
+use super::limit::ReceiverSlot;
+use std::cell::{RefCell, UnsafeCell};
+use std::collections::VecDeque;
+use std::mem::MaybeUninit;
+use std::ops::Deref;
+use std::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex, RwLock};
+use std::thread::{park_timeout, spawn, yield_now, JoinHandle, Thread};
+use std::time::Duration;
+
+/// the list of receivers owned by a log, shared with its writer thread
+pub(crate) type ReceiverList = RwLock<Vec<RwLock<ReceiverSlot>>>;
+
+/// the maximum number of events the writer thread takes from each thread's buffer per batch
+const BATCH_SIZE: usize = 256;
+
+/// how long the writer thread sleeps when there is nothing to do
+const IDLE_TIMEOUT: Duration = Duration::from_millis(50);
+
+/// what to do with a new event when the dispatch queue is full
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum OverflowPolicy {
+    /// discard the oldest queued event to make room for the new one
+    DropOldest,
+    /// discard the new event, keeping everything that is already queued
+    DropNewest,
+    /// wait for the writer thread to make room (the only policy that never loses events)
+    Block,
+}
+
+/// pads and aligns a value to its own cache line to avoid false sharing between atomics
+#[repr(align(64))]
+#[derive(Default)]
+struct CachePadded<T>(T);
+impl<T> Deref for CachePadded<T> {
+    type Target = T;
+
+    fn deref(&self) -> &T {
+        &self.0
+    }
+}
+
+/// a single cell of the ring queue, stamped with a sequence number that tells who may use it next
+struct Slot<T> {
+    sequence: AtomicUsize,
+    value: UnsafeCell<MaybeUninit<T>>,
+}
+
+/// a bounded, lock-free, multi-producer multi-consumer ring queue (Vyukov's design)
+pub(crate) struct RingQueue<T> {
+    slots: Box<[Slot<T>]>,
+    mask: usize,
+    enqueue_position: CachePadded<AtomicUsize>,
+    dequeue_position: CachePadded<AtomicUsize>,
+}
+unsafe impl<T: Send> Send for RingQueue<T> {}
+unsafe impl<T: Send> Sync for RingQueue<T> {}
+impl<T> RingQueue<T> {
+    /// create a queue holding at least `capacity` values (rounded up to a power of two)
+    pub(crate) fn with_capacity(capacity: usize) -> Self {
+        let capacity = capacity.max(2).next_power_of_two();
+        let slots = (0..capacity)
+            .map(|i| Slot {
+                sequence: AtomicUsize::new(i),
+                value: UnsafeCell::new(MaybeUninit::uninit()),
+            })
+            .collect::<Vec<_>>()
+            .into_boxed_slice();
+        Self {
+            slots,
+            mask: capacity - 1,
+            enqueue_position: Default::default(),
+            dequeue_position: Default::default(),
+        }
+    }
+
+    /// try to enqueue a value, handing it back if the queue is full
+    pub(crate) fn push(&self, value: T) -> Result<(), T> {
+        let mut position = self.enqueue_position.load(Ordering::Relaxed);
+        loop {
+            let slot = &self.slots[position & self.mask];
+            let sequence = slot.sequence.load(Ordering::Acquire);
+            let difference = sequence as isize - position as isize;
+            if difference == 0 {
+                match self.enqueue_position.compare_exchange_weak(
+                    position,
+                    position + 1,
+                    Ordering::Relaxed,
+                    Ordering::Relaxed,
+                ) {
+                    Ok(_) => {
+                        unsafe { (*slot.value.get()).as_mut_ptr().write(value) };
+                        slot.sequence.store(position + 1, Ordering::Release);
+                        return Ok(());
+                    }
+                    Err(current) => position = current,
+                }
+            } else if difference < 0 {
+                return Err(value);
+            } else {
+                position = self.enqueue_position.load(Ordering::Relaxed);
+            }
+        }
+    }
+
+    /// try to dequeue the oldest value, or `None` if the queue is empty
+    pub(crate) fn pop(&self) -> Option<T> {
+        let mut position = self.dequeue_position.load(Ordering::Relaxed);
+        loop {
+            let slot = &self.slots[position & self.mask];
+            let sequence = slot.sequence.load(Ordering::Acquire);
+            let difference = sequence as isize - (position + 1) as isize;
+            if difference == 0 {
+                match self.dequeue_position.compare_exchange_weak(
+                    position,
+                    position + 1,
+                    Ordering::Relaxed,
+                    Ordering::Relaxed,
+                ) {
+                    Ok(_) => {
+                        let value = unsafe { (*slot.value.get()).as_ptr().read() };
+                        slot.sequence
+                            .store(position + self.mask + 1, Ordering::Release);
+                        return Some(value);
+                    }
+                    Err(current) => position = current,
+                }
+            } else if difference < 0 {
+                return None;
+            } else {
+                position = self.dequeue_position.load(Ordering::Relaxed);
+            }
+        }
+    }
+
+    /// whether or not the queue has no values claimed or in flight
+    pub(crate) fn is_empty(&self) -> bool {
+        self.dequeue_position.load(Ordering::SeqCst) >= self.enqueue_position.load(Ordering::SeqCst)
+    }
+}
+impl<T> Drop for RingQueue<T> {
+    fn drop(&mut self) {
+        while self.pop().is_some() {}
+    }
+}
+
+/// the events produced by one thread, waiting for the writer thread
+struct ThreadBuffer {
+    queue: RingQueue<Event>,
+    /// set once the dispatcher is gone, so that threads can forget the buffer
+    closed: AtomicBool,
+    /// set once the thread which owns the buffer has exited, so that the writer can forget it
+    exited: AtomicBool,
+}
+impl ThreadBuffer {
+    fn new(capacity: usize) -> Self {
+        Self {
+            queue: RingQueue::with_capacity(capacity),
+            closed: AtomicBool::new(false),
+            exited: AtomicBool::new(false),
+        }
+    }
+}
+
+/// the buffers a thread has registered, tagged with the id of their dispatcher, which are marked
+/// as exited when the thread exits
+#[derive(Default)]
+struct ThreadBuffers(Vec<(usize, Arc<ThreadBuffer>)>);
+impl Drop for ThreadBuffers {
+    fn drop(&mut self) {
+        for (_, buffer) in self.0.iter() {
+            buffer.exited.store(true, Ordering::SeqCst);
+        }
+    }
+}
+
+thread_local! {
+    static THREAD_BUFFERS: RefCell<ThreadBuffers> = RefCell::new(ThreadBuffers::default());
+}
+
+/// the source of unique dispatcher ids
+static NEXT_DISPATCHER_ID: AtomicUsize = AtomicUsize::new(0);
+
+/// state shared between the producing threads and the writer thread
+struct Shared {
+    id: usize,
+    capacity: usize,
+    /// every thread's buffer, only locked when a thread registers or the writer prunes
+    buffers: Mutex<Vec<Arc<ThreadBuffer>>>,
+    /// incremented whenever `buffers` changes, so that the writer knows to take a new snapshot
+    generation: AtomicUsize,
+    /// a shared buffer for events logged while a thread's own buffer is unavailable (such as
+    /// during thread-local destruction)
+    fallback: Arc<ThreadBuffer>,
+    receivers: Arc<ReceiverList>,
+    policy: OverflowPolicy,
+    shutdown: AtomicBool,
+    sleeping: AtomicBool,
+    busy: AtomicBool,
+    dropped: AtomicU64,
+}
+impl Shared {
+    fn all_empty(&self) -> bool {
+        self.buffers
+            .lock()
+            .expect("log buffers are poisoned")
+            .iter()
+            .all(|buffer| buffer.queue.is_empty())
+    }
+}
+
+/// hands log events to a dedicated writer thread through a bounded ring queue per producing
+/// thread, so that threads never contend with each other; the writer merges them by timestamp
+/// (apart from events which are still being pushed when the writer catches up)
+pub(crate) struct Dispatcher {
+    shared: Arc<Shared>,
+    writer: Option<JoinHandle<()>>,
+    writer_thread: Thread,
+}
+impl Dispatcher {
+    /// start a writer thread which fans events out to the given receivers, where each producing
+    /// thread buffers up to `capacity` events
+    pub(crate) fn new(
+        receivers: Arc<ReceiverList>,
+        capacity: usize,
+        policy: OverflowPolicy,
+    ) -> Self {
+        let fallback = Arc::new(ThreadBuffer::new(capacity));
+        let shared = Arc::new(Shared {
+            id: NEXT_DISPATCHER_ID.fetch_add(1, Ordering::Relaxed),
+            capacity,
+            buffers: Mutex::new(vec![fallback.clone()]),
+            generation: AtomicUsize::new(0),
+            fallback,
+            receivers,
+            policy,
+            shutdown: AtomicBool::new(false),
+            sleeping: AtomicBool::new(false),
+            busy: AtomicBool::new(false),
+            dropped: AtomicU64::new(0),
+        });
+        let writer_shared = shared.clone();
+        let writer = spawn(move || Self::drain(&writer_shared));
+        let writer_thread = writer.thread().clone();
+        Self {
+            shared,
+            writer: Some(writer),
+            writer_thread,
+        }
+    }
+
+    /// find the calling thread's buffer, registering a new one if it has none yet
+    fn thread_buffer<'b>(
+        &self,
+        buffers: &'b mut Vec<(usize, Arc<ThreadBuffer>)>,
+        capacity: usize,
+    ) -> &'b ThreadBuffer {
+        let index = match buffers.iter().position(|(id, _)| *id == self.shared.id) {
+            Some(index) => index,
+            None => {
+                buffers.retain(|(_, buffer)| !buffer.closed.load(Ordering::Relaxed));
+                let buffer = Arc::new(ThreadBuffer::new(capacity));
+                self.shared
+                    .buffers
+                    .lock()
+                    .expect("log buffers are poisoned")
+                    .push(buffer.clone());
+                self.shared.generation.fetch_add(1, Ordering::SeqCst);
+                buffers.push((self.shared.id, buffer));
+                buffers.len() - 1
+            }
+        };
+        &buffers[index].1
+    }
+
+    /// give the calling thread a buffer of its own holding up to `capacity` events, unless it
+    /// already has one (threads are otherwise registered on their first event)
+    pub(crate) fn register_thread(&self, capacity: usize) {
+        let _ = THREAD_BUFFERS.try_with(|buffers| {
+            if let Ok(mut buffers) = buffers.try_borrow_mut() {
+                self.thread_buffer(&mut buffers.0, capacity);
+            }
+        });
+    }
+
+    /// the default number of events buffered per thread
+    pub(crate) fn capacity(&self) -> usize {
+        self.shared.capacity
+    }
+
+    /// queue an event in the calling thread's buffer for the writer thread
+    pub(crate) fn submit(&self, event: Event) {
+        let mut event = Some(event);
+        let _ = THREAD_BUFFERS.try_with(|buffers| {
+            if let Ok(mut buffers) = buffers.try_borrow_mut() {
+                let buffer = self.thread_buffer(&mut buffers.0, self.shared.capacity);
+                if let Some(event) = event.take() {
+                    self.push(&buffer.queue, event);
+                }
+            }
+        });
+        if let Some(event) = event {
+            self.push(&self.shared.fallback.queue, event);
+        }
+        if self.shared.sleeping.load(Ordering::SeqCst) {
+            self.wake();
+        }
+    }
+
+    /// push an event into a queue, applying the overflow policy if the queue is full
+    fn push(&self, queue: &RingQueue<Event>, event: Event) {
+        let mut event = event;
+        loop {
+            event = match queue.push(event) {
+                Ok(()) => return,
+                Err(rejected) => rejected,
+            };
+            match self.shared.policy {
+                OverflowPolicy::DropNewest => {
+                    self.shared.dropped.fetch_add(1, Ordering::Relaxed);
+                    return;
+                }
+                OverflowPolicy::DropOldest => {
+                    if queue.pop().is_some() {
+                        self.shared.dropped.fetch_add(1, Ordering::Relaxed);
+                    }
+                }
+                OverflowPolicy::Block => {
+                    self.wake();
+                    yield_now();
+                }
+            }
+        }
+    }
+
+    /// the number of events discarded by the overflow policy so far
+    pub(crate) fn dropped(&self) -> u64 {
+        self.shared.dropped.load(Ordering::Relaxed)
+    }
+
+    /// block until every event submitted so far has been handed to the receivers
+    pub(crate) fn wait_until_drained(&self) {
+        while !self.shared.all_empty() || self.shared.busy.load(Ordering::SeqCst) {
+            self.wake();
+            yield_now();
+        }
+    }
+
+    fn wake(&self) {
+        self.writer_thread.unpark();
+    }
+
+    /// the body of the writer thread
+    fn drain(shared: &Shared) {
+        // each buffer in the snapshot, with the events taken from it but not yet dispatched
+        let mut sources: Vec<(Arc<ThreadBuffer>, VecDeque<Event>)> = Vec::new();
+        let mut generation = None;
+        let mut batch = Vec::with_capacity(BATCH_SIZE);
+        loop {
+            let current_generation = shared.generation.load(Ordering::SeqCst);
+            if generation != Some(current_generation) {
+                let buffers = shared
+                    .buffers
+                    .lock()
+                    .expect("log buffers are poisoned")
+                    .clone();
+                let mut previous = std::mem::take(&mut sources);
+                for buffer in buffers {
+                    let pending = match previous
+                        .iter()
+                        .position(|(other, _)| Arc::ptr_eq(other, &buffer))
+                    {
+                        Some(index) => previous.swap_remove(index).1,
+                        None => VecDeque::with_capacity(BATCH_SIZE),
+                    };
+                    sources.push((buffer, pending));
+                }
+                generation = Some(current_generation);
+            }
+
+            shared.busy.store(true, Ordering::SeqCst);
+            // every event still queued in a buffer is at least as late as the last event taken
+            // from it, so events up to the earliest of those can be merged in order
+            let mut watermark = None;
+            let mut blocked = false;
+            for (buffer, pending) in sources.iter_mut() {
+                while pending.len() < BATCH_SIZE {
+                    match buffer.queue.pop() {
+                        Some(event) => pending.push_back(event),
+                        None => break,
+                    }
+                }
+                if !buffer.queue.is_empty() {
+                    match pending.back() {
+                        Some(last) if watermark.is_none_or(|time| last.time < time) => {
+                            watermark = Some(last.time)
+                        }
+                        Some(_) => {}
+                        // an event is still being written into the buffer
+                        None => blocked = true,
+                    }
+                }
+            }
+            if !blocked {
+                loop {
+                    let next = sources
+                        .iter()
+                        .enumerate()
+                        .filter_map(|(index, (_, pending))| Some((pending.front()?.time, index)))
+                        .min();
+                    match next {
+                        Some((time, index))
+                            if watermark.is_none_or(|watermark| time <= watermark) =>
+                        {
+                            batch.extend(sources[index].1.pop_front())
+                        }
+                        _ => break,
+                    }
+                }
+            }
+            if !batch.is_empty() {
+                for receiver in shared
+                    .receivers
+                    .read()
+                    .expect("receivers is poisoned")
+                    .iter()
+                {
+                    let mut receiver = receiver.write().expect("receivers is poisoned");
+                    for event in batch.iter() {
+                        receiver.notify(event);
+                    }
+                }
+                batch.clear();
+                shared.busy.store(false, Ordering::SeqCst);
+                continue;
+            }
+            shared.busy.store(false, Ordering::SeqCst);
+            if blocked {
+                yield_now();
+                continue;
+            }
+
+            // the buffers looked empty: flush what the receivers buffered, forget the buffers of
+            // threads that have exited, then sleep
+            for receiver in shared
+                .receivers
+                .read()
+                .expect("receivers is poisoned")
+                .iter()
+            {
+                receiver.write().expect("receivers is poisoned").flush();
+            }
+            let orphaned = |buffer: &Arc<ThreadBuffer>| {
+                buffer.exited.load(Ordering::SeqCst)
+                    && buffer.queue.is_empty()
+                    && sources
+                        .iter()
+                        .all(|(other, pending)| !Arc::ptr_eq(other, buffer) || pending.is_empty())
+            };
+            if sources.iter().any(|(buffer, _)| orphaned(buffer)) {
+                shared
+                    .buffers
+                    .lock()
+                    .expect("log buffers are poisoned")
+                    .retain(|buffer| !orphaned(buffer));
+                shared.generation.fetch_add(1, Ordering::SeqCst);
+                continue;
+            }
+            if shared.shutdown.load(Ordering::SeqCst) {
+                if shared.all_empty() {
+                    break;
+                }
+                continue;
+            }
+            shared.sleeping.store(true, Ordering::SeqCst);
+            if shared.generation.load(Ordering::SeqCst) == current_generation
+                && sources.iter().all(|(buffer, _)| buffer.queue.is_empty())
+            {
+                park_timeout(IDLE_TIMEOUT);
+            }
+            shared.sleeping.store(false, Ordering::SeqCst);
+        }
+    }
+}
+impl Drop for Dispatcher {
+    /// drain every queued event into the receivers before the writer thread is stopped
+    fn drop(&mut self) {
+        self.shared.shutdown.store(true, Ordering::SeqCst);
+        self.wake();
+        if let Some(writer) = self.writer.take() {
+            let _ = writer.join();
+        }
+        for buffer in self
+            .shared
+            .buffers
+            .lock()
+            .expect("log buffers are poisoned")
+            .iter()
+        {
+            buffer.closed.store(true, Ordering::Relaxed);
+        }
+    }
+}
@@ -1,10 +1,16 @@
 //! the log event-handling subsystem
 
 extern crate chrono;
-use super::output::console::write_event;
+use super::context::ContextId;
+use super::output::console::{write_event, write_event_to};
+use super::timestamp::Timestamp;
 use chrono::{DateTime, FixedOffset, Local, Utc};
+use std::fmt::{self, Display, Formatter};
+use std::io::Write;
 
-/// the severity level of a log event
+/// the severity level of a log event, ordered from least to most severe
+#[derive(Clone, Copy, Debug, PartialEq, Eq, PartialOrd, Ord, Hash)]
+#[repr(u8)]
 pub enum Severity {
     /// to be used by developers during development, shouldn't exist in production code
     Debug,
@@ -19,27 +25,275 @@ pub enum Severity {
     /// something went wrong, and the program will fail
     Fatal,
 }
+impl Severity {
+    /// convert from the numeric representation given by `severity as u8`
+    pub fn from_u8(value: u8) -> Option<Self> {
+        match value {
+            0 => Some(Severity::Debug),
+            1 => Some(Severity::Verbose),
+            2 => Some(Severity::Info),
+            3 => Some(Severity::Warning),
+            4 => Some(Severity::Error),
+            5 => Some(Severity::Fatal),
+            _ => None,
+        }
+    }
+}
+
+/// the maximum number of arguments that can be recorded with a message template
+pub const MAX_ARGUMENTS: usize = 6;
+
+/// a raw value recorded alongside a message template, to be formatted only when needed
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum Argument {
+    /// a signed integer
+    Signed(i64),
+    /// an unsigned integer
+    Unsigned(u64),
+    /// a floating point number
+    Float(f64),
+    /// a boolean
+    Bool(bool),
+    /// a character
+    Char(char),
+    /// a static string
+    Str(&'static str),
+}
+
+macro_rules! impl_argument_from {
+    ( $variant:ident, $target:ty, $( $source:ty ),* ) => {
+        $(
+            impl From<$source> for Argument {
+                fn from(value: $source) -> Self {
+                    Argument::$variant(value as $target)
+                }
+            }
+        )*
+    };
+}
+impl_argument_from!(Signed, i64, i8, i16, i32, i64, isize);
+impl_argument_from!(Unsigned, u64, u8, u16, u32, u64, usize);
+impl_argument_from!(Float, f64, f32, f64);
+impl From<bool> for Argument {
+    fn from(value: bool) -> Self {
+        Argument::Bool(value)
+    }
+}
+impl From<char> for Argument {
+    fn from(value: char) -> Self {
+        Argument::Char(value)
+    }
+}
+impl From<&'static str> for Argument {
+    fn from(value: &'static str) -> Self {
+        Argument::Str(value)
+    }
+}
+impl Display for Argument {
+    fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+        match self {
+            Argument::Signed(value) => Display::fmt(value, f),
+            Argument::Unsigned(value) => Display::fmt(value, f),
+            Argument::Float(value) => Display::fmt(value, f),
+            Argument::Bool(value) => Display::fmt(value, f),
+            Argument::Char(value) => Display::fmt(value, f),
+            Argument::Str(value) => Display::fmt(value, f),
+        }
+    }
+}
+
+/// a static message template with `{}` placeholders (and `{{`/`}}` escapes), plus the raw
+/// arguments that fill them in
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct Template {
+    template: &'static str,
+    arguments: [Argument; MAX_ARGUMENTS],
+    length: u8,
+}
+impl Template {
+    /// record a template and its arguments (arguments beyond `MAX_ARGUMENTS` are discarded)
+    pub fn new(template: &'static str, arguments: &[Argument]) -> Self {
+        debug_assert!(
+            arguments.len() <= MAX_ARGUMENTS,
+            "too many log message arguments"
+        );
+        let length = arguments.len().min(MAX_ARGUMENTS);
+        let mut stored = [Argument::Unsigned(0); MAX_ARGUMENTS];
+        stored[..length].copy_from_slice(&arguments[..length]);
+        Self {
+            template,
+            arguments: stored,
+            length: length as u8,
+        }
+    }
+
+    /// the template string
+    pub fn template(&self) -> &'static str {
+        self.template
+    }
+
+    /// the recorded arguments
+    pub fn arguments(&self) -> &[Argument] {
+        &self.arguments[..self.length as usize]
+    }
+}
+impl Display for Template {
+    fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+        format_template(f, self.template, self.arguments())
+    }
+}
+
+/// write a template to a formatter, filling each `{}` placeholder with the next argument
+pub fn format_template<A: Display>(
+    f: &mut Formatter<'_>,
+    template: &str,
+    arguments: &[A],
+) -> fmt::Result {
+    let mut arguments = arguments.iter();
+    let mut rest = template;
+    while let Some(index) = rest.find(['{', '}']) {
+        f.write_str(&rest[..index])?;
+        let tail = &rest[index..];
+        if let Some(after) = tail.strip_prefix("{}") {
+            match arguments.next() {
+                Some(argument) => Display::fmt(argument, f)?,
+                None => f.write_str("{}")?,
+            }
+            rest = after;
+        } else if let Some(after) = tail.strip_prefix("{{").or_else(|| tail.strip_prefix("}}")) {
+            f.write_str(&tail[..1])?;
+            rest = after;
+        } else {
+            f.write_str(&tail[..1])?;
+            rest = &tail[1..];
+        }
+    }
+    f.write_str(rest)
+}
+
+/// the human-readable part of a log event, formatted lazily when a receiver displays it
+#[derive(Debug, PartialEq)]
+pub enum Message {
+    /// a static string, which costs nothing to record
+    Static(&'static str),
+    /// a string built at runtime
+    Owned(String),
+    /// a static template and its raw arguments, which costs nothing to record
+    Template(Template),
+}
+impl Clone for Message {
+    fn clone(&self) -> Self {
+        match self {
+            Message::Static(message) => Message::Static(message),
+            Message::Owned(message) => Message::Owned(message.clone()),
+            Message::Template(template) => Message::Template(*template),
+        }
+    }
+
+    /// reuse the existing allocation when both messages are owned strings
+    fn clone_from(&mut self, source: &Self) {
+        match (self, source) {
+            (Message::Owned(message), Message::Owned(source)) => message.clone_from(source),
+            (message, source) => *message = source.clone(),
+        }
+    }
+}
+impl Message {
+    /// record a static template and the arguments to fill it in with
+    pub fn template(template: &'static str, arguments: &[Argument]) -> Self {
+        Message::Template(Template::new(template, arguments))
+    }
+}
+impl From<&'static str> for Message {
+    fn from(message: &'static str) -> Self {
+        Message::Static(message)
+    }
+}
+impl From<String> for Message {
+    fn from(message: String) -> Self {
+        Message::Owned(message)
+    }
+}
+impl From<&String> for Message {
+    fn from(message: &String) -> Self {
+        Message::Owned(message.clone())
+    }
+}
+impl From<Template> for Message {
+    fn from(template: Template) -> Self {
+        Message::Template(template)
+    }
+}
+impl Display for Message {
+    fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+        match self {
+            Message::Static(message) => f.write_str(message),
+            Message::Owned(message) => f.write_str(message),
+            Message::Template(template) => Display::fmt(template, f),
+        }
+    }
+}
 
 /// a log message or event, containing a message, date/time, severity level, and context
+#[derive(Debug)]
 pub struct Event {
-    /// the date and time that the log message was created
-    pub time: DateTime<Utc>,
+    /// the monotonic time that the log message was created
+    pub time: Timestamp,
     /// the severity level of the log event
     pub severity: Severity,
-    /// a name indicating the source or purpose of the log message, used for filtering logs
-    pub context: String,
+    /// a handle to the name indicating the source or purpose of the log message, used for
+    /// filtering logs
+    pub context: ContextId,
     /// the human-readable message about whatever the log event is trying to say
-    pub message: String,
+    pub message: Message,
+}
+
+impl Clone for Event {
+    fn clone(&self) -> Self {
+        Event {
+            time: self.time,
+            severity: self.severity,
+            context: self.context,
+            message: self.message.clone(),
+        }
+    }
+
+    /// reuse the existing message allocation where possible
+    fn clone_from(&mut self, source: &Self) {
+        self.time = source.time;
+        self.severity = source.severity;
+        self.context = source.context;
+        self.message.clone_from(&source.message);
+    }
 }
 
 impl Event {
     /// create a new event marked with the current time
-    pub fn now(severity: Severity, context: &str, message: &str) -> Self {
+    pub fn now(
+        severity: Severity,
+        context: impl Into<ContextId>,
+        message: impl Into<Message>,
+    ) -> Self {
+        Event {
+            time: Timestamp::now(),
+            severity,
+            context: context.into(),
+            message: message.into(),
+        }
+    }
+
+    /// create a new event marked with a given timestamp
+    pub fn with_timestamp(
+        time: Timestamp,
+        severity: Severity,
+        context: impl Into<ContextId>,
+        message: impl Into<Message>,
+    ) -> Self {
         Event {
-            time: Utc::now(),
+            time,
             severity,
-            context: context.to_owned(),
-            message: message.to_owned(),
+            context: context.into(),
+            message: message.into(),
         }
     }
 
@@ -47,14 +301,14 @@ impl Event {
     pub fn with_utc_time(
         time: DateTime<Utc>,
         severity: Severity,
-        context: &str,
-        message: &str,
+        context: impl Into<ContextId>,
+        message: impl Into<Message>,
     ) -> Self {
         Event {
-            time,
+            time: Timestamp::from_utc(&time),
             severity,
-            context: context.to_owned(),
-            message: message.to_owned(),
+            context: context.into(),
+            message: message.into(),
         }
     }
 
@@ -62,14 +316,14 @@ impl Event {
     pub fn with_local_time(
         time: DateTime<Local>,
         severity: Severity,
-        context: &str,
-        message: &str,
+        context: impl Into<ContextId>,
+        message: impl Into<Message>,
     ) -> Self {
         Event {
-            time: time.with_timezone(&Utc),
+            time: Timestamp::from_utc(&time.with_timezone(&Utc)),
             severity,
-            context: context.to_owned(),
-            message: message.to_owned(),
+            context: context.into(),
+            message: message.into(),
         }
     }
 
@@ -77,14 +331,14 @@ impl Event {
     pub fn with_time(
         time: DateTime<FixedOffset>,
         severity: Severity,
-        context: &str,
-        message: &str,
+        context: impl Into<ContextId>,
+        message: impl Into<Message>,
     ) -> Self {
         Event {
-            time: time.with_timezone(&Utc),
+            time: Timestamp::from_utc(&time.with_timezone(&Utc)),
             severity,
-            context: context.to_owned(),
-            message: message.to_owned(),
+            context: context.into(),
+            message: message.into(),
         }
     }
 }
@@ -93,17 +347,52 @@ impl Event {
 pub trait Receiver {
     /// called in order to notify of a log event
     fn notify(&mut self, event: &Event);
+
+    /// called when buffered output should be written out, such as when the log goes idle
+    fn flush(&mut self) {}
 }
 
+/// a stream standing in for stdout or stderr in a `ConsoleReceiver`
+pub type ConsoleSink = Box<dyn Write + Send + Sync>;
+
 /// a receiver that displays log messages on the system console (stdout and stderr)
 #[derive(Default)]
-pub struct ConsoleReceiver;
+pub struct ConsoleReceiver {
+    /// the streams written to instead of stdout and stderr, if any
+    sinks: Option<(ConsoleSink, ConsoleSink)>,
+}
 impl ConsoleReceiver {
     /// create a new console log receiver
-    pub fn new() -> Self { Default::default() }
+    pub fn new() -> Self {
+        Default::default()
+    }
+
+    /// create a console log receiver which writes to a pair of streams in place of stdout and
+    /// stderr (e.g. to measure the cost of formatting without the cost of the console)
+    pub fn with_sinks(out: ConsoleSink, err: ConsoleSink) -> Self {
+        Self {
+            sinks: Some((out, err)),
+        }
+    }
 }
 impl Receiver for ConsoleReceiver {
     fn notify(&mut self, event: &Event) {
-        let _ = write_event(&event);
+        let _ = match self.sinks {
+            Some((ref mut out, ref mut err)) => write_event_to(out, err, event),
+            None => write_event(event),
+        };
+    }
+
+    fn flush(&mut self) {
+        match self.sinks {
+            Some((ref mut out, ref mut err)) => {
+                let _ = out.flush();
+                let _ = err.flush();
+            }
+            None => {
+                let _ = std::io::stdout().flush();
+                let _ = std::io::stderr().flush();
+            }
+        }
     }
 }
@@ -0,0 +1,211 @@
+//! a log receiver which writes batches of events to rotating files
+
+use super::event::{Event, Receiver, Severity};
+use super::output::string::append_event;
+use super::timestamp::Timestamp;
+use chrono::{DateTime, Duration as DateDuration, NaiveDate, TimeZone, Utc};
+use std::fs::{rename, File, OpenOptions};
+use std::io::{Result, Write};
+use std::path::{Path, PathBuf};
+use std::time::{Duration, Instant};
+
+/// when a log file is closed and moved aside so that logging continues in a fresh file
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum Rotation {
+    /// keep appending to the same file forever
+    Never,
+    /// rotate before the file would grow beyond a number of bytes
+    Size(u64),
+    /// rotate when the (UTC) date of the events changes
+    Daily,
+}
+
+/// a receiver that formats events into a large in-memory buffer and writes it to a file in a
+/// single call once it fills up, once it gets old, or as soon as a severe event arrives
+pub struct FileReceiver {
+    path: PathBuf,
+    file: File,
+    file_size: u64,
+    /// the date of the events in the file, for daily rotation (starting from the date the file
+    /// was last modified)
+    file_date: NaiveDate,
+    /// the first instant of the day after `file_date`, compared against event times
+    next_date: Timestamp,
+    /// the time of the latest event, whose date names files rotated by size
+    latest: Timestamp,
+    buffer: Vec<u8>,
+    buffer_capacity: usize,
+    flush_interval: Duration,
+    flush_severity: Severity,
+    last_flush: Instant,
+    rotation: Rotation,
+}
+impl FileReceiver {
+    /// create a file log receiver with default settings, appending to the file at `path`
+    pub fn new(path: impl AsRef<Path>) -> Result<Self> {
+        FileReceiverBuilder::new(path).build()
+    }
+
+    /// write the buffered events out to the file (rotating it first if needed)
+    fn write_buffer(&mut self) -> Result<()> {
+        self.last_flush = Instant::now();
+        if self.buffer.is_empty() {
+            return Ok(());
+        }
+        if let Rotation::Size(max_size) = self.rotation {
+            if self.file_size > 0 && self.file_size + self.buffer.len() as u64 > max_size {
+                self.rotate(self.latest.to_utc().naive_utc().date())?;
+            }
+        }
+        let result = self.file.write_all(&self.buffer);
+        self.file_size += self.buffer.len() as u64;
+        self.buffer.clear();
+        result
+    }
+
+    /// set the date of the current file, and when the next date begins
+    fn set_date(&mut self, date: NaiveDate) {
+        let midnight = (date + DateDuration::days(1))
+            .and_hms_opt(0, 0, 0)
+            .expect("midnight is a valid time");
+        self.file_date = date;
+        self.next_date = Timestamp::from_utc(&Utc.from_utc_datetime(&midnight));
+    }
+
+    /// move the current file aside (naming it after a date) and start a new one in its place
+    fn rotate(&mut self, date: NaiveDate) -> Result<()> {
+        let stem = self
+            .path
+            .file_stem()
+            .map(|stem| stem.to_string_lossy().into_owned())
+            .unwrap_or_default();
+        let extension = self
+            .path
+            .extension()
+            .map(|extension| format!(".{}", extension.to_string_lossy()))
+            .unwrap_or_default();
+        let mut number = 1;
+        let rotated = loop {
+            let rotated = self
+                .path
+                .with_file_name(format!("{}.{}.{}{}", stem, date, number, extension));
+            if !rotated.exists() {
+                break rotated;
+            }
+            number += 1;
+        };
+        rename(&self.path, rotated)?;
+        self.file = open_file(&self.path)?;
+        self.file_size = 0;
+        Ok(())
+    }
+}
+impl Receiver for FileReceiver {
+    fn notify(&mut self, event: &Event) {
+        if let Rotation::Daily = self.rotation {
+            if event.time >= self.next_date {
+                let _ = self.write_buffer();
+                if self.file_size > 0 {
+                    let _ = self.rotate(self.file_date);
+                }
+                self.set_date(event.time.to_utc().naive_utc().date());
+            }
+        }
+        self.latest = event.time;
+        append_event(&mut self.buffer, event);
+        if self.buffer.len() >= self.buffer_capacity
+            || event.severity >= self.flush_severity
+            || self.last_flush.elapsed() >= self.flush_interval
+        {
+            let _ = self.write_buffer();
+        }
+    }
+
+    fn flush(&mut self) {
+        let _ = self.write_buffer();
+    }
+}
+impl Drop for FileReceiver {
+    fn drop(&mut self) {
+        let _ = self.write_buffer();
+    }
+}
+
+fn open_file(path: &Path) -> Result<File> {
+    OpenOptions::new().create(true).append(true).open(path)
+}
+
+/// builder for constructing a FileReceiver struct with a fluent API
+pub struct FileReceiverBuilder {
+    path: PathBuf,
+    buffer_capacity: usize,
+    flush_interval: Duration,
+    flush_severity: Severity,
+    rotation: Rotation,
+}
+impl FileReceiverBuilder {
+    /// begin building a FileReceiver which appends to the file at `path`
+    pub fn new(path: impl AsRef<Path>) -> Self {
+        Self {
+            path: path.as_ref().to_owned(),
+            buffer_capacity: 64 * 1024,
+            flush_interval: Duration::from_secs(1),
+            flush_severity: Severity::Error,
+            rotation: Rotation::Never,
+        }
+    }
+
+    /// set the number of bytes of formatted events to buffer before writing them out
+    pub fn with_buffer_capacity(mut self, bytes: usize) -> Self {
+        self.buffer_capacity = bytes;
+        self
+    }
+
+    /// set the longest time buffered events may wait before being written out (checked whenever
+    /// an event arrives, or whenever the log flushes its receivers)
+    pub fn with_flush_interval(mut self, interval: Duration) -> Self {
+        self.flush_interval = interval;
+        self
+    }
+
+    /// set the severity at and above which events are written out immediately
+    pub fn with_flush_severity(mut self, severity: Severity) -> Self {
+        self.flush_severity = severity;
+        self
+    }
+
+    /// set when the file should be rotated
+    pub fn with_rotation(mut self, rotation: Rotation) -> Self {
+        self.rotation = rotation;
+        self
+    }
+
+    /// open the file and build the FileReceiver, disposing of the builder
+    pub fn build(self) -> Result<FileReceiver> {
+        let file = open_file(&self.path)?;
+        let metadata = file.metadata()?;
+        let file_size = metadata.len();
+        // an existing file holds events from when it was last written to
+        let file_time = match metadata.modified() {
+            Ok(modified) if file_size > 0 => DateTime::<Utc>::from(modified),
+            _ => Timestamp::now().to_utc(),
+        };
+        let file_date = file_time.naive_utc().date();
+        let mut receiver = FileReceiver {
+            path: self.path,
+            file,
+            file_size,
+            file_date,
+            next_date: Timestamp::from_ticks(0),
+            latest: Timestamp::from_utc(&file_time),
+            buffer: Vec::with_capacity(self.buffer_capacity),
+            buffer_capacity: self.buffer_capacity,
+            flush_interval: self.flush_interval,
+            flush_severity: self.flush_severity,
+            last_flush: Instant::now(),
+            rotation: self.rotation,
+        };
+        receiver.set_date(file_date);
+        Ok(receiver)
+    }
+}
@@ -0,0 +1,125 @@
+//! severity filtering, checked before a log event is ever constructed
+
+use super::context::ContextId;
+use super::event::Severity;
+use std::sync::atomic::{AtomicU8, Ordering};
+use std::sync::Mutex;
+
+/// the number of contexts (in interning order) which can have their own minimum severity
+pub const MAX_CONTEXT_OVERRIDES: usize = 256;
+
+/// the lowest severity which the logging macros compile in, selected with the `min_severity_*`
+/// cargo features (or the `release_min_severity_*` features for builds without debug assertions);
+/// macro calls below it compile to nothing
+pub const STATIC_MIN_SEVERITY: Severity = if cfg!(feature = "min_severity_fatal")
+    || (!cfg!(debug_assertions) && cfg!(feature = "release_min_severity_fatal"))
+{
+    Severity::Fatal
+} else if cfg!(feature = "min_severity_error")
+    || (!cfg!(debug_assertions) && cfg!(feature = "release_min_severity_error"))
+{
+    Severity::Error
+} else if cfg!(feature = "min_severity_warning")
+    || (!cfg!(debug_assertions) && cfg!(feature = "release_min_severity_warning"))
+{
+    Severity::Warning
+} else if cfg!(feature = "min_severity_info")
+    || (!cfg!(debug_assertions) && cfg!(feature = "release_min_severity_info"))
+{
+    Severity::Info
+} else if cfg!(feature = "min_severity_verbose")
+    || (!cfg!(debug_assertions) && cfg!(feature = "release_min_severity_verbose"))
+{
+    Severity::Verbose
+} else {
+    Severity::Debug
+};
+
+/// marks a context override slot that defers to the global minimum severity
+const UNSET: u8 = u8::MAX;
+
+/// a runtime minimum severity, with optional per-context overrides
+pub(crate) struct SeverityFilter {
+    /// the lowest of the global minimum and every override, so most rejections take one load
+    floor: AtomicU8,
+    global: AtomicU8,
+    overrides: Box<[AtomicU8]>,
+    /// serializes changes, so that the floor always reflects the latest settings
+    update_lock: Mutex<()>,
+}
+impl Default for SeverityFilter {
+    fn default() -> Self {
+        Self {
+            floor: AtomicU8::new(Severity::Debug as u8),
+            global: AtomicU8::new(Severity::Debug as u8),
+            overrides: (0..MAX_CONTEXT_OVERRIDES)
+                .map(|_| AtomicU8::new(UNSET))
+                .collect(),
+            update_lock: Mutex::new(()),
+        }
+    }
+}
+impl SeverityFilter {
+    /// whether or not an event of this severity could pass for at least one context
+    #[inline]
+    pub(crate) fn may_pass(&self, severity: Severity) -> bool {
+        severity as u8 >= self.floor.load(Ordering::Relaxed)
+    }
+
+    /// whether or not an event of this severity passes for a given context
+    #[inline]
+    pub(crate) fn passes(&self, severity: Severity, context: ContextId) -> bool {
+        if !self.may_pass(severity) {
+            return false;
+        }
+        let minimum = match self.overrides.get(context.index()) {
+            Some(minimum) => match minimum.load(Ordering::Relaxed) {
+                UNSET => self.global.load(Ordering::Relaxed),
+                minimum => minimum,
+            },
+            None => self.global.load(Ordering::Relaxed),
+        };
+        severity as u8 >= minimum
+    }
+
+    /// the global minimum severity
+    pub(crate) fn global(&self) -> Severity {
+        Severity::from_u8(self.global.load(Ordering::Relaxed)).unwrap_or(Severity::Debug)
+    }
+
+    /// set the global minimum severity
+    pub(crate) fn set_global(&self, severity: Severity) {
+        let _lock = self
+            .update_lock
+            .lock()
+            .expect("severity filter is poisoned");
+        self.global.store(severity as u8, Ordering::Relaxed);
+        self.update_floor();
+    }
+
+    /// set or clear (with `None`) the minimum severity of a context, returning `false` if the
+    /// context is beyond `MAX_CONTEXT_OVERRIDES`
+    pub(crate) fn set_override(&self, context: ContextId, severity: Option<Severity>) -> bool {
+        let _lock = self
+            .update_lock
+            .lock()
+            .expect("severity filter is poisoned");
+        match self.overrides.get(context.index()) {
+            Some(minimum) => {
+                minimum.store(severity.map_or(UNSET, |s| s as u8), Ordering::Relaxed);
+                self.update_floor();
+                true
+            }
+            None => false,
+        }
+    }
+
+    fn update_floor(&self) {
+        let floor = self
+            .overrides
+            .iter()
+            .map(|minimum| minimum.load(Ordering::Relaxed))
+            .fold(self.global.load(Ordering::Relaxed), u8::min);
+        self.floor.store(floor, Ordering::Relaxed);
+    }
+}
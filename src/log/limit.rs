@@ -0,0 +1,185 @@
+//! rate limiting and deduplication of log events, for keeping log throughput bounded when a
+//! caller logs the same thing every frame
+
+use super::context::ContextId;
+use super::event::{Event, Message, Receiver};
+use super::filter::MAX_CONTEXT_OVERRIDES;
+use super::timestamp::Timestamp;
+use std::sync::atomic::{AtomicI64, AtomicU64, Ordering};
+
+/// a per-context rate limit, using the generic cell rate algorithm (an atomic token bucket)
+#[derive(Default)]
+struct Bucket {
+    /// the ticks between events at the sustained rate, or zero if the context is unlimited
+    interval: AtomicI64,
+    /// how many ticks ahead of schedule the context may get (the burst size, minus one, times
+    /// the interval)
+    tolerance: AtomicI64,
+    /// the theoretical arrival time of the next event at the sustained rate
+    arrival: AtomicI64,
+    /// the number of events rejected since the last one was admitted
+    suppressed: AtomicU64,
+}
+
+/// the outcome of checking an event against its context's rate limit
+pub(crate) enum Admission {
+    /// the context has no rate limit
+    Unlimited,
+    /// the event is within the rate limit, and was checked at the given time
+    Admitted {
+        /// the time the event was checked at, for stamping it without reading the clock again
+        time: Timestamp,
+        /// the number of events that were rejected since the previous admitted event
+        suppressed: u64,
+    },
+    /// the event exceeds the rate limit, and should be discarded
+    Rejected,
+}
+
+/// per-context rate limits, checked without locks
+pub(crate) struct RateLimits {
+    buckets: Box<[Bucket]>,
+}
+impl Default for RateLimits {
+    fn default() -> Self {
+        Self {
+            buckets: (0..MAX_CONTEXT_OVERRIDES)
+                .map(|_| Bucket::default())
+                .collect(),
+        }
+    }
+}
+impl RateLimits {
+    /// limit a context to a sustained number of events per second, allowing bursts of up to
+    /// `burst` events, or remove its limit (with a rate of zero), returning `false` if the
+    /// context is beyond `MAX_CONTEXT_OVERRIDES`
+    pub(crate) fn set(&self, context: ContextId, events_per_second: f64, burst: u32) -> bool {
+        match self.buckets.get(context.index()) {
+            Some(bucket) => {
+                let interval = if events_per_second > 0.0 {
+                    ((1_000_000_000.0 / events_per_second) as i64).max(1)
+                } else {
+                    0
+                };
+                let burst = i64::from(burst.max(1));
+                bucket
+                    .tolerance
+                    .store(interval.saturating_mul(burst - 1), Ordering::Relaxed);
+                bucket.interval.store(interval, Ordering::Relaxed);
+                true
+            }
+            None => false,
+        }
+    }
+
+    /// check an event in a context against its rate limit
+    #[inline]
+    pub(crate) fn admit(&self, context: ContextId) -> Admission {
+        let bucket = match self.buckets.get(context.index()) {
+            Some(bucket) => bucket,
+            None => return Admission::Unlimited,
+        };
+        let interval = bucket.interval.load(Ordering::Relaxed);
+        if interval == 0 {
+            return Admission::Unlimited;
+        }
+        let time = Timestamp::now();
+        let now = time.ticks();
+        let tolerance = bucket.tolerance.load(Ordering::Relaxed);
+        let mut arrival = bucket.arrival.load(Ordering::Relaxed);
+        loop {
+            let start = arrival.max(now);
+            if start - now > tolerance {
+                bucket.suppressed.fetch_add(1, Ordering::Relaxed);
+                return Admission::Rejected;
+            }
+            match bucket.arrival.compare_exchange_weak(
+                arrival,
+                start + interval,
+                Ordering::Relaxed,
+                Ordering::Relaxed,
+            ) {
+                Ok(_) => break,
+                Err(current) => arrival = current,
+            }
+        }
+        let suppressed = match bucket.suppressed.load(Ordering::Relaxed) {
+            0 => 0,
+            _ => bucket.suppressed.swap(0, Ordering::Relaxed),
+        };
+        Admission::Admitted { time, suppressed }
+    }
+}
+
+/// a receiver owned by a log, which optionally collapses identical consecutive events into a
+/// single "repeated" summary (using the receiver's own lock, so no lock is shared between them)
+pub(crate) struct ReceiverSlot {
+    receiver: Box<dyn Receiver + Send + Sync>,
+    deduplicate: bool,
+    previous: Option<Event>,
+    repeated: u64,
+}
+impl ReceiverSlot {
+    pub(crate) fn new(receiver: Box<dyn Receiver + Send + Sync>, deduplicate: bool) -> Self {
+        Self {
+            receiver,
+            deduplicate,
+            previous: None,
+            repeated: 0,
+        }
+    }
+
+    /// turn deduplication on or off, reporting any pending repeats when turning it off
+    pub(crate) fn set_deduplication(&mut self, deduplicate: bool) {
+        if !deduplicate {
+            self.report_repeats();
+            self.previous = None;
+        }
+        self.deduplicate = deduplicate;
+    }
+
+    fn report_repeats(&mut self) {
+        if self.repeated == 0 {
+            return;
+        }
+        if let Some(ref previous) = self.previous {
+            self.receiver.notify(&Event::with_timestamp(
+                previous.time,
+                previous.severity,
+                previous.context,
+                Message::template("last message repeated {} times", &[self.repeated.into()]),
+            ));
+        }
+        self.repeated = 0;
+    }
+}
+impl Receiver for ReceiverSlot {
+    fn notify(&mut self, event: &Event) {
+        if !self.deduplicate {
+            self.receiver.notify(event);
+            return;
+        }
+        if let Some(ref mut previous) = self.previous {
+            if previous.severity == event.severity
+                && previous.context == event.context
+                && previous.message == event.message
+            {
+                previous.time = event.time;
+                self.repeated += 1;
+                return;
+            }
+        }
+        self.report_repeats();
+        self.receiver.notify(event);
+        match self.previous {
+            Some(ref mut previous) => previous.clone_from(event),
+            None => self.previous = Some(event.clone()),
+        }
+    }
+
+    /// report any pending repeats, then flush the receiver
+    fn flush(&mut self) {
+        self.report_repeats();
+        self.receiver.flush();
+    }
+}
@@ -0,0 +1,85 @@
+//! logging macros which record a static template and raw arguments instead of formatting eagerly
+
+/// log an event with a given severity through a `Log`, recording a static message template and
+/// its raw arguments (formatted lazily, only if a receiver displays the message), where the
+/// context is a string literal interned once per call site
+///
+/// Calls below `log::filter::STATIC_MIN_SEVERITY` compile to nothing, and calls below the log's
+/// minimum severity return after a single relaxed atomic load, before the event is constructed.
+/// Events over their context's rate limit are discarded before they are constructed, too. The
+/// `Log` expression is evaluated at most once.
+///
+/// e.g. `log_event!(services.log, Severity::Verbose, "demo", "render delta: {}", delta)`
+#[macro_export]
+macro_rules! log_event {
+    ( $log:expr, $severity:expr, $context:expr, $template:expr $( , $argument:expr )* $(,)? ) => {{
+        let severity: $crate::log::event::Severity = $severity;
+        if severity as u8 >= $crate::log::filter::STATIC_MIN_SEVERITY as u8 {
+            let log = &$log;
+            if log.severity_enabled(severity) {
+                static CONTEXT: $crate::log::context::StaticContext =
+                    $crate::log::context::StaticContext::new($context);
+                let context = CONTEXT.id();
+                if let Some(time) = log.admit(severity, context) {
+                    log.dispatch($crate::log::event::Event::with_timestamp(
+                        time,
+                        severity,
+                        context,
+                        $crate::log::event::Message::template(
+                            $template,
+                            &[ $( $crate::log::event::Argument::from($argument) ),* ],
+                        ),
+                    ));
+                }
+            }
+        }
+    }};
+}
+
+/// log a debug event with a static message template (see `log_event!`)
+#[macro_export]
+macro_rules! log_debug {
+    ( $log:expr, $context:expr, $( $rest:tt )+ ) => {
+        $crate::log_event!($log, $crate::log::event::Severity::Debug, $context, $( $rest )+)
+    };
+}
+
+/// log a verbose event with a static message template (see `log_event!`)
+#[macro_export]
+macro_rules! log_verbose {
+    ( $log:expr, $context:expr, $( $rest:tt )+ ) => {
+        $crate::log_event!($log, $crate::log::event::Severity::Verbose, $context, $( $rest )+)
+    };
+}
+
+/// log an info event with a static message template (see `log_event!`)
+#[macro_export]
+macro_rules! log_info {
+    ( $log:expr, $context:expr, $( $rest:tt )+ ) => {
+        $crate::log_event!($log, $crate::log::event::Severity::Info, $context, $( $rest )+)
+    };
+}
+
+/// log a warning event with a static message template (see `log_event!`)
+#[macro_export]
+macro_rules! log_warning {
+    ( $log:expr, $context:expr, $( $rest:tt )+ ) => {
+        $crate::log_event!($log, $crate::log::event::Severity::Warning, $context, $( $rest )+)
+    };
+}
+
+/// log an error event with a static message template (see `log_event!`)
+#[macro_export]
+macro_rules! log_error {
+    ( $log:expr, $context:expr, $( $rest:tt )+ ) => {
+        $crate::log_event!($log, $crate::log::event::Severity::Error, $context, $( $rest )+)
+    };
+}
+
+/// log a fatal event with a static message template (see `log_event!`)
+#[macro_export]
+macro_rules! log_fatal {
+    ( $log:expr, $context:expr, $( $rest:tt )+ ) => {
+        $crate::log_event!($log, $crate::log::event::Severity::Fatal, $context, $( $rest )+)
+    };
+}
@@ -1,11 +1,27 @@
 //! the log subsystem
 
+use crate::event::timing::frame_time;
 use chrono::{DateTime, FixedOffset, Local, Utc};
-use event::{Event, Receiver, Severity};
-use std::sync::RwLock;
+use context::ContextId;
+use dispatch::{Dispatcher, OverflowPolicy, ReceiverList};
+use event::{Event, Message, Receiver, Severity};
+use filter::SeverityFilter;
+use limit::{Admission, RateLimits, ReceiverSlot};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, RwLock};
+use timestamp::Timestamp;
 
+pub mod binary;
+pub mod context;
+pub mod dispatch;
 pub mod event;
+pub mod file;
+pub mod filter;
+mod limit;
+mod macros;
 pub mod output;
+pub mod ring;
+pub mod timestamp;
 
 #[cfg(test)]
 mod test;
@@ -14,96 +30,324 @@ mod test;
 #[derive(Default)]
 pub struct Log {
     /// receivers to which events will be dispatched
-    receivers: RwLock<Vec<RwLock<Box<dyn Receiver + Send + Sync>>>>,
+    receivers: Arc<ReceiverList>,
+    /// the background writer, or `None` if events are dispatched on the calling thread
+    dispatcher: Option<Dispatcher>,
+    /// the runtime minimum severity, checked before events are constructed
+    filter: SeverityFilter,
+    /// the per-context rate limits, checked after the severity filter
+    limits: RateLimits,
+    /// whether or not receivers collapse identical consecutive events
+    deduplicate: AtomicBool,
+    /// whether or not events logged from a game loop are stamped with the time its frame began
+    frame_timestamps: AtomicBool,
 }
 
 impl Log {
     /// create a new log handler service
     pub fn new() -> Log {
+        Timestamp::calibrate();
         Default::default()
     }
 
+    /// create a new log handler service which queues events into a bounded ring buffer of
+    /// `capacity` events per logging thread, to be merged in time order and dispatched to the
+    /// receivers by a dedicated writer thread (any queued events are still dispatched when the
+    /// log is dropped)
+    pub fn new_async(capacity: usize, overflow_policy: OverflowPolicy) -> Log {
+        Timestamp::calibrate();
+        let receivers = Arc::new(ReceiverList::default());
+        let dispatcher = Dispatcher::new(receivers.clone(), capacity, overflow_policy);
+        Log {
+            receivers,
+            dispatcher: Some(dispatcher),
+            filter: Default::default(),
+            limits: Default::default(),
+            deduplicate: Default::default(),
+            frame_timestamps: Default::default(),
+        }
+    }
+
+    /// give the calling thread its own event buffer ahead of time, rather than on its first log
+    /// event (a no-op for logs which dispatch on the calling thread)
+    pub fn register_thread(&self) {
+        if let Some(ref dispatcher) = self.dispatcher {
+            dispatcher.register_thread(dispatcher.capacity());
+        }
+    }
+
+    /// give the calling thread its own event buffer with room for `capacity` events, unless it
+    /// already has one (a no-op for logs which dispatch on the calling thread)
+    pub fn register_thread_with_capacity(&self, capacity: usize) {
+        if let Some(ref dispatcher) = self.dispatcher {
+            dispatcher.register_thread(capacity);
+        }
+    }
+
+    /// get the minimum severity of events which are dispatched (for contexts without their own)
+    pub fn minimum_severity(&self) -> Severity {
+        self.filter.global()
+    }
+
+    /// set the minimum severity of events which are dispatched (for contexts without their own);
+    /// events below it are discarded before they are constructed
+    pub fn set_minimum_severity(&self, severity: Severity) {
+        self.filter.set_global(severity);
+    }
+
+    /// set or clear (with `None`) the minimum severity for a single context, overriding the log's
+    /// minimum severity, and returning `false` if the context cannot be overridden because more
+    /// than `filter::MAX_CONTEXT_OVERRIDES` contexts were interned before it
+    pub fn set_context_severity(
+        &self,
+        context: impl Into<ContextId>,
+        severity: Option<Severity>,
+    ) -> bool {
+        self.filter.set_override(context.into(), severity)
+    }
+
+    /// whether or not events of this severity may be dispatched for at least one context (a
+    /// single relaxed atomic load, for skipping work before the context is known)
+    #[inline]
+    pub fn severity_enabled(&self, severity: Severity) -> bool {
+        self.filter.may_pass(severity)
+    }
+
+    /// whether or not an event with this severity and context would be dispatched
+    #[inline]
+    pub fn enabled(&self, severity: Severity, context: ContextId) -> bool {
+        self.filter.passes(severity, context)
+    }
+
+    /// limit a context to a sustained rate of events per second, allowing bursts of up to
+    /// `burst` events above it, and returning `false` if the context cannot be limited because
+    /// more than `filter::MAX_CONTEXT_OVERRIDES` contexts were interned before it (the number of
+    /// events discarded is reported in a warning before the next event which is let through)
+    pub fn set_rate_limit(
+        &self,
+        context: impl Into<ContextId>,
+        events_per_second: f64,
+        burst: u32,
+    ) -> bool {
+        self.limits.set(context.into(), events_per_second, burst)
+    }
+
+    /// remove the rate limit from a context
+    pub fn clear_rate_limit(&self, context: impl Into<ContextId>) -> bool {
+        self.limits.set(context.into(), 0.0, 0)
+    }
+
+    /// collapse identical consecutive events (with the same severity, context and message) into
+    /// a single "last message repeated" event per receiver, which is notified when a different
+    /// event arrives or the log is flushed
+    pub fn set_deduplication(&self, enabled: bool) {
+        self.deduplicate.store(enabled, Ordering::Relaxed);
+        for receiver in self.receivers.read().expect("receivers is poisoned").iter() {
+            receiver
+                .write()
+                .expect("receivers is poisoned")
+                .set_deduplication(enabled);
+        }
+    }
+
+    /// stamp events logged from a game loop with the time its current frame began (see
+    /// `event::timing::frame_time`) instead of reading the clock for each event, trading
+    /// precision within a frame for a cheaper timestamp (events outside a loop, and rate limited
+    /// events, still read the clock)
+    pub fn set_frame_timestamps(&self, enabled: bool) {
+        self.frame_timestamps.store(enabled, Ordering::Relaxed);
+    }
+
+    /// the time to stamp an event with
+    #[inline]
+    fn timestamp(&self) -> Timestamp {
+        if self.frame_timestamps.load(Ordering::Relaxed) {
+            if let Some(frame_time) = frame_time() {
+                return Timestamp::from_instant(frame_time);
+            }
+        }
+        Timestamp::now()
+    }
+
+    /// check an event with this severity and context against the severity filter and the
+    /// context's rate limit, returning the time to stamp it with if it should be dispatched
+    #[inline]
+    pub fn admit(&self, severity: Severity, context: ContextId) -> Option<Timestamp> {
+        let time = self.filter(severity, context)?;
+        Some(time.unwrap_or_else(|| self.timestamp()))
+    }
+
+    /// check an event against the severity filter and the context's rate limit without reading
+    /// the clock unless the context is rate limited, returning whether it should be dispatched,
+    /// with the time the rate limit read (if any)
+    #[inline]
+    fn filter(&self, severity: Severity, context: ContextId) -> Option<Option<Timestamp>> {
+        if !self.enabled(severity, context) {
+            return None;
+        }
+        match self.limits.admit(context) {
+            Admission::Unlimited => Some(None),
+            Admission::Admitted { time, suppressed } => {
+                if suppressed > 0 {
+                    self.dispatch(Event::with_timestamp(
+                        time,
+                        Severity::Warning,
+                        context,
+                        Message::template(
+                            "{} events suppressed by the rate limit",
+                            &[suppressed.into()],
+                        ),
+                    ));
+                }
+                Some(Some(time))
+            }
+            Admission::Rejected => None,
+        }
+    }
+
     /// add a receiver to an existing log handler
     pub fn add_receiver(&self, receiver: Box<dyn Receiver + Send + Sync>) {
+        let deduplicate = self.deduplicate.load(Ordering::Relaxed);
         self.receivers
             .write()
             .expect("receivers is poisoned")
-            .push(RwLock::new(receiver));
+            .push(RwLock::new(ReceiverSlot::new(receiver, deduplicate)));
     }
 
-    /// create and notify a log event for the current instant
-    pub fn now(&self, severity: Severity, context: &str, message: &str) {
-        let event = Event::now(severity, context, message);
-        self.notify(&event);
+    /// create and notify a log event for the current instant, if it passes the severity filter
+    /// and rate limit
+    pub fn now(
+        &self,
+        severity: Severity,
+        context: impl Into<ContextId>,
+        message: impl Into<Message>,
+    ) {
+        if !self.severity_enabled(severity) {
+            return;
+        }
+        let context = context.into();
+        if let Some(time) = self.admit(severity, context) {
+            self.dispatch(Event::with_timestamp(time, severity, context, message));
+        }
     }
 
-    /// create and notify a log event for a given time in UTC
+    /// create and notify a log event for a given time in UTC, if it passes the severity filter
+    /// and rate limit
     pub fn with_utc_time(
         &self,
         time: DateTime<Utc>,
         severity: Severity,
-        context: &str,
-        message: &str,
+        context: impl Into<ContextId>,
+        message: impl Into<Message>,
     ) {
+        if !self.severity_enabled(severity) {
+            return;
+        }
+        let context = context.into();
+        if self.filter(severity, context).is_none() {
+            return;
+        }
         let event = Event::with_utc_time(time, severity, context, message);
-        self.notify(&event);
+        self.dispatch(event);
     }
 
-    /// create and notify a log event for a given time in local time
+    /// create and notify a log event for a given time in local time, if it passes the severity filter
+    /// and rate limit
     pub fn with_local_time(
         &self,
         time: DateTime<Local>,
         severity: Severity,
-        context: &str,
-        message: &str,
+        context: impl Into<ContextId>,
+        message: impl Into<Message>,
     ) {
+        if !self.severity_enabled(severity) {
+            return;
+        }
+        let context = context.into();
+        if self.filter(severity, context).is_none() {
+            return;
+        }
         let event = Event::with_local_time(time, severity, context, message);
-        self.notify(&event);
+        self.dispatch(event);
     }
 
-    /// create and notify a log event for a given arbitrary time
+    /// create and notify a log event for a given arbitrary time, if it passes the severity filter
+    /// and rate limit
     pub fn with_time(
         &self,
         time: DateTime<FixedOffset>,
         severity: Severity,
-        context: &str,
-        message: &str,
+        context: impl Into<ContextId>,
+        message: impl Into<Message>,
     ) {
+        if !self.severity_enabled(severity) {
+            return;
+        }
+        let context = context.into();
+        if self.filter(severity, context).is_none() {
+            return;
+        }
         let event = Event::with_time(time, severity, context, message);
-        self.notify(&event);
+        self.dispatch(event);
     }
 
     /// helper function for logging a debug message
-    pub fn debug(&self, context: &str, message: &str) {
+    pub fn debug(&self, context: impl Into<ContextId>, message: impl Into<Message>) {
         self.now(Severity::Debug, context, message);
     }
 
     /// helper function for logging a verbose message
-    pub fn verbose(&self, context: &str, message: &str) {
+    pub fn verbose(&self, context: impl Into<ContextId>, message: impl Into<Message>) {
         self.now(Severity::Verbose, context, message);
     }
 
     /// helper function for logging an info message
-    pub fn info(&self, context: &str, message: &str) {
+    pub fn info(&self, context: impl Into<ContextId>, message: impl Into<Message>) {
         self.now(Severity::Info, context, message);
     }
 
     /// helper function for logging a warning message
-    pub fn warning(&self, context: &str, message: &str) {
+    pub fn warning(&self, context: impl Into<ContextId>, message: impl Into<Message>) {
         self.now(Severity::Warning, context, message);
     }
 
     /// helper function for logging an error message
-    pub fn error(&self, context: &str, message: &str) {
+    pub fn error(&self, context: impl Into<ContextId>, message: impl Into<Message>) {
         self.now(Severity::Error, context, message);
     }
 
     /// helper function for logging a fatal error message
-    pub fn fatal(&self, context: &str, message: &str) {
+    pub fn fatal(&self, context: impl Into<ContextId>, message: impl Into<Message>) {
         self.now(Severity::Fatal, context, message);
     }
 
-    /// notify all receivers of a log event
+    /// hand a log event off to the receivers, either through the writer thread or directly
+    pub fn dispatch(&self, event: Event) {
+        match self.dispatcher {
+            Some(ref dispatcher) => dispatcher.submit(event),
+            None => self.notify(&event),
+        }
+    }
+
+    /// wait for all queued events to be dispatched, then flush every receiver
+    pub fn flush(&self) {
+        if let Some(ref dispatcher) = self.dispatcher {
+            dispatcher.wait_until_drained();
+        }
+        for receiver in self.receivers.read().expect("receivers is poisoned").iter() {
+            receiver.write().expect("receivers is poisoned").flush();
+        }
+    }
+
+    /// the number of events discarded because the dispatch queue was full
+    pub fn dropped_events(&self) -> u64 {
+        match self.dispatcher {
+            Some(ref dispatcher) => dispatcher.dropped(),
+            None => 0,
+        }
+    }
+
+    /// notify all receivers of a log event immediately, on the calling thread
     pub fn notify(&self, event: &Event) {
         for receiver in self.receivers.read().expect("receivers is poisoned").iter() {
             receiver
@@ -119,4 +363,9 @@ impl Receiver for Log {
     fn notify(&mut self, event: &Event) {
         Log::notify(self, event);
     }
+
+    /// flush all receivers
+    fn flush(&mut self) {
+        Log::flush(self);
+    }
 }
@@ -1,16 +1,17 @@
 //! subsystem for log data output
 
 macro_rules! write_log_event {
-    ( $stream:expr, $event:ident ) => {
+    ( $stream:expr, $event:ident ) => {{
+        let time = $event.time.to_utc();
         writeln!(
             $stream,
             "{year:04}-{month:02}-{day:02} {hour:02}:{minute:02}:{second:02} {severity:<7} -> {context:<8}: {message}",
-            year = &$event.time.year(),
-            month = &$event.time.month(),
-            day = &$event.time.day(),
-            hour = &$event.time.hour(),
-            minute = &$event.time.minute(),
-            second = &$event.time.second(),
+            year = time.year(),
+            month = time.month(),
+            day = time.day(),
+            hour = time.hour(),
+            minute = time.minute(),
+            second = time.second(),
             severity = match &$event.severity {
                 Severity::Debug => "Debug",
                 Severity::Verbose => "Verbose",
@@ -22,7 +23,7 @@ macro_rules! write_log_event {
             context = &$event.context,
             message = &$event.message
         )
-    };
+    }};
 }
 
 /// subsystem for printing log data to strings
@@ -34,9 +35,14 @@ pub mod string {
     /// write a log event to a character vector
     pub fn format_event(event: &Event) -> Vec<u8> {
         let mut stream = Vec::new();
-        let _ = write_log_event!(&mut stream, event);
+        append_event(&mut stream, event);
         stream
     }
+
+    /// append a log event to an existing character vector, reusing its capacity
+    pub fn append_event(stream: &mut Vec<u8>, event: &Event) {
+        let _ = write_log_event!(stream, event);
+    }
 }
 
 /// subsystem for printing log data to the console
@@ -47,11 +53,21 @@ pub mod console {
 
     /// write a log event to the console (stdout or stderr, depending on severity)
     pub fn write_event(event: &Event) -> std::result::Result<(), std::io::Error> {
+        write_event_to(&mut std::io::stdout(), &mut std::io::stderr(), event)
+    }
+
+    /// write a log event to one of a pair of streams standing in for stdout and stderr,
+    /// depending on severity
+    pub fn write_event_to(
+        out: &mut dyn Write,
+        err: &mut dyn Write,
+        event: &Event,
+    ) -> std::result::Result<(), std::io::Error> {
         match &event.severity {
             Severity::Debug | Severity::Verbose | Severity::Info | Severity::Warning => {
-                write_log_event!(std::io::stdout(), event)
+                write_log_event!(out, event)
             }
-            Severity::Error | Severity::Fatal => write_log_event!(std::io::stderr(), event),
+            Severity::Error | Severity::Fatal => write_log_event!(err, event),
         }
     }
 }
@@ -0,0 +1,199 @@
+//! a log receiver which keeps the most recent events in memory, for crash dumps and inspection
+
+use super::context::ContextId;
+use super::event::{Event, Receiver, Severity};
+use super::output::string::append_event;
+use std::fs::File;
+use std::io::{Result, Write};
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, Mutex, TryLockError};
+use std::thread::yield_now;
+use std::time::{Duration, Instant};
+
+/// how long a panic dump waits for another thread (such as an asynchronous log's writer) to
+/// release the ring before giving up
+const DUMP_LOCK_TIMEOUT: Duration = Duration::from_millis(5);
+
+/// the fixed-capacity storage behind a ring receiver
+struct Ring {
+    /// preallocated to the full capacity; events are pushed until it is full, then overwritten
+    events: Vec<Event>,
+    capacity: usize,
+    /// the index of the oldest event once the ring is full
+    next: usize,
+}
+impl Ring {
+    fn push(&mut self, event: &Event) {
+        if self.events.len() < self.capacity {
+            self.events.push(event.clone());
+        } else {
+            self.events[self.next].clone_from(event);
+            self.next = (self.next + 1) % self.capacity;
+        }
+    }
+
+    /// iterate from the oldest event to the newest
+    fn iter(&self) -> impl DoubleEndedIterator<Item = &Event> {
+        let (newer, older) = self.events.split_at(self.next);
+        older.iter().chain(newer.iter())
+    }
+}
+
+/// a receiver that keeps the last N events in a preallocated ring, writing them to a file when a
+/// fatal event arrives (or when asked to, such as from a panic hook installed with
+/// `App::dump_log_on_panic`), and which can be queried while the game is running
+///
+/// Clones of a ring receiver share the same ring, so one clone can be given to the log while
+/// another is kept around for inspection.
+#[derive(Clone)]
+pub struct RingReceiver {
+    ring: Arc<Mutex<Ring>>,
+    dump_path: Option<Arc<PathBuf>>,
+}
+impl RingReceiver {
+    /// create a ring receiver that keeps the last `capacity` events
+    pub fn new(capacity: usize) -> Self {
+        let capacity = capacity.max(1);
+        Self {
+            ring: Arc::new(Mutex::new(Ring {
+                events: Vec::with_capacity(capacity),
+                capacity,
+                next: 0,
+            })),
+            dump_path: None,
+        }
+    }
+
+    /// set the file that the ring is written to on a fatal event or a call to `dump`
+    pub fn with_dump_path(mut self, path: impl AsRef<Path>) -> Self {
+        self.dump_path = Some(Arc::new(path.as_ref().to_owned()));
+        self
+    }
+
+    /// the maximum number of events kept
+    pub fn capacity(&self) -> usize {
+        self.ring.lock().expect("log ring is poisoned").capacity
+    }
+
+    /// the number of events currently kept
+    pub fn len(&self) -> usize {
+        self.ring.lock().expect("log ring is poisoned").events.len()
+    }
+
+    /// whether or not no events have been kept yet
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// record an event into the ring
+    pub fn record(&self, event: &Event) {
+        self.ring.lock().expect("log ring is poisoned").push(event);
+    }
+
+    /// copy every kept event, from oldest to newest
+    pub fn snapshot(&self) -> Vec<Event> {
+        self.ring
+            .lock()
+            .expect("log ring is poisoned")
+            .iter()
+            .cloned()
+            .collect()
+    }
+
+    /// copy the newest `limit` kept events at or above a severity (and in a given context, if
+    /// any), from oldest to newest
+    pub fn query(
+        &self,
+        minimum_severity: Severity,
+        context: Option<ContextId>,
+        limit: usize,
+    ) -> Vec<Event> {
+        let ring = self.ring.lock().expect("log ring is poisoned");
+        let mut events = ring
+            .iter()
+            .rev()
+            .filter(|event| {
+                event.severity >= minimum_severity
+                    && context.is_none_or(|context| event.context == context)
+            })
+            .take(limit)
+            .cloned()
+            .collect::<Vec<_>>();
+        events.reverse();
+        events
+    }
+
+    /// write every kept event in the text log format, from oldest to newest
+    pub fn write_to(&self, writer: &mut dyn Write) -> Result<()> {
+        let ring = self.ring.lock().expect("log ring is poisoned");
+        Self::write_ring(&ring, writer)
+    }
+
+    fn write_ring(ring: &Ring, writer: &mut dyn Write) -> Result<()> {
+        let mut buffer = Vec::new();
+        for event in ring.iter() {
+            append_event(&mut buffer, event);
+        }
+        writer.write_all(&buffer)?;
+        writer.flush()
+    }
+
+    /// write every kept event to the dump file, if one was set
+    pub fn dump(&self) -> Result<()> {
+        match self.dump_path {
+            Some(ref path) => self.dump_to(path.as_path()),
+            None => Ok(()),
+        }
+    }
+
+    /// write every kept event to a file
+    pub fn dump_to(&self, path: impl AsRef<Path>) -> Result<()> {
+        self.write_to(&mut File::create(path)?)
+    }
+
+    /// record an event and dump the ring without blocking indefinitely, for use while panicking
+    /// (if the ring stays locked, such as by the panicking thread itself, only the event is
+    /// dumped, with a note that the ring was skipped)
+    pub fn record_and_dump_on_panic(&self, event: &Event) {
+        let deadline = Instant::now() + DUMP_LOCK_TIMEOUT;
+        let mut ring = loop {
+            match self.ring.try_lock() {
+                Ok(ring) => break ring,
+                Err(TryLockError::Poisoned(poisoned)) => break poisoned.into_inner(),
+                Err(TryLockError::WouldBlock) if Instant::now() < deadline => yield_now(),
+                Err(TryLockError::WouldBlock) => {
+                    if let Some(ref path) = self.dump_path {
+                        if let Ok(mut file) = File::create(path.as_path()) {
+                            let mut buffer = Vec::new();
+                            append_event(&mut buffer, event);
+                            buffer.extend_from_slice(
+                                b"(the rest of the log ring was skipped, as it was locked)\n",
+                            );
+                            let _ = file.write_all(&buffer);
+                        }
+                    }
+                    return;
+                }
+            }
+        };
+        ring.push(event);
+        self.dump_ring(&ring);
+    }
+
+    fn dump_ring(&self, ring: &Ring) {
+        if let Some(ref path) = self.dump_path {
+            if let Ok(mut file) = File::create(path.as_path()) {
+                let _ = Self::write_ring(ring, &mut file);
+            }
+        }
+    }
+}
+impl Receiver for RingReceiver {
+    fn notify(&mut self, event: &Event) {
+        let mut ring = self.ring.lock().expect("log ring is poisoned");
+        ring.push(event);
+        if event.severity == Severity::Fatal {
+            self.dump_ring(&ring);
+        }
+    }
+}
@@ -1,8 +1,18 @@
 //! test suite for the log subsystem
 
-use crate::log::event::{Event, Severity};
+use crate::log::binary::{BinaryReceiver, DecodeError, Decoder, MAGIC, VERSION};
+use crate::log::context::ContextId;
+use crate::log::dispatch::{OverflowPolicy, RingQueue};
+use crate::log::event::{Argument, Event, Message, Receiver, Severity};
+use crate::log::file::{FileReceiverBuilder, Rotation};
+use crate::log::filter::STATIC_MIN_SEVERITY;
 use crate::log::output::string::format_event;
-use chrono::DateTime;
+use crate::log::ring::RingReceiver;
+use crate::log::timestamp::Timestamp;
+use crate::log::Log;
+use chrono::{DateTime, Utc};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
 
 #[test]
 fn test_log_event_to_string() {
@@ -25,3 +35,541 @@ fn test_log_event_to_string() {
 
     assert_eq!(prototype, string);
 }
+
+/// a receiver that counts the events it was notified of
+struct CountingReceiver {
+    count: Arc<AtomicUsize>,
+}
+impl Receiver for CountingReceiver {
+    fn notify(&mut self, _event: &Event) {
+        self.count.fetch_add(1, Ordering::SeqCst);
+    }
+}
+
+#[test]
+fn test_ring_queue_rejects_when_full() {
+    let queue = RingQueue::with_capacity(4);
+    for i in 0..4 {
+        assert!(queue.push(i).is_ok());
+    }
+    assert_eq!(queue.push(4), Err(4));
+    assert_eq!(queue.pop(), Some(0));
+    assert!(queue.push(4).is_ok());
+    assert_eq!(
+        (0..4).filter_map(|_| queue.pop()).collect::<Vec<_>>(),
+        vec![1, 2, 3, 4]
+    );
+    assert!(queue.is_empty());
+}
+
+#[test]
+fn test_async_log_flushes_on_drop() {
+    let count = Arc::new(AtomicUsize::new(0));
+    {
+        let log = Log::new_async(16, OverflowPolicy::Block);
+        log.add_receiver(Box::new(CountingReceiver {
+            count: count.clone(),
+        }));
+        for _ in 0..1000 {
+            log.debug("test", "this is a test message");
+        }
+    }
+    assert_eq!(count.load(Ordering::SeqCst), 1000);
+}
+
+#[test]
+fn test_async_log_flush_waits_for_receivers() {
+    let count = Arc::new(AtomicUsize::new(0));
+    let log = Log::new_async(1024, OverflowPolicy::DropNewest);
+    log.add_receiver(Box::new(CountingReceiver {
+        count: count.clone(),
+    }));
+    for _ in 0..100 {
+        log.debug("test", "this is a test message");
+    }
+    log.flush();
+    assert_eq!(count.load(Ordering::SeqCst), 100);
+    assert_eq!(log.dropped_events(), 0);
+}
+
+#[test]
+fn test_template_message_formats_lazily() {
+    let message = Message::template(
+        "{} of {} ({}%) {{done}}",
+        &[
+            Argument::from(3u32),
+            Argument::from(4i64),
+            Argument::from(75.5),
+        ],
+    );
+    assert_eq!(message.to_string(), "3 of 4 (75.5%) {done}");
+}
+
+#[test]
+fn test_context_interning() {
+    let context = ContextId::intern("interned");
+    assert_eq!(context, ContextId::from("interned"));
+    assert_eq!(context.name(), "interned");
+    assert_ne!(context, ContextId::intern("other"));
+}
+
+#[test]
+fn test_log_macro_records_template() {
+    let count = Arc::new(AtomicUsize::new(0));
+    let log = Log::new();
+    log.add_receiver(Box::new(CountingReceiver {
+        count: count.clone(),
+    }));
+    for i in 0..3 {
+        crate::log_verbose!(log, "test", "iteration {}", i);
+    }
+    let compiled_in = Severity::Verbose >= STATIC_MIN_SEVERITY;
+    assert_eq!(
+        count.load(Ordering::SeqCst),
+        if compiled_in { 3 } else { 0 }
+    );
+}
+
+#[test]
+fn test_log_macro_evaluates_its_log_once() {
+    let count = Arc::new(AtomicUsize::new(0));
+    let log = Log::new();
+    log.add_receiver(Box::new(CountingReceiver {
+        count: count.clone(),
+    }));
+    let evaluations = AtomicUsize::new(0);
+    let get_log = || {
+        evaluations.fetch_add(1, Ordering::SeqCst);
+        &log
+    };
+    crate::log_fatal!(get_log(), "test", "evaluated {}", 1);
+    assert_eq!(evaluations.load(Ordering::SeqCst), 1);
+    assert_eq!(count.load(Ordering::SeqCst), 1);
+}
+
+#[test]
+fn test_severity_filter_skips_events() {
+    let count = Arc::new(AtomicUsize::new(0));
+    let log = Log::new();
+    log.add_receiver(Box::new(CountingReceiver {
+        count: count.clone(),
+    }));
+    log.set_minimum_severity(Severity::Info);
+    log.debug("test", "filtered");
+    crate::log_verbose!(log, "test", "filtered {}", 1);
+    log.info("test", "kept");
+    assert_eq!(count.load(Ordering::SeqCst), 1);
+
+    assert!(log.set_context_severity("noisy", Some(Severity::Error)));
+    assert!(log.set_context_severity("chatty", Some(Severity::Debug)));
+    log.warning("noisy", "filtered");
+    log.debug("chatty", "kept");
+    crate::log_debug!(log, "chatty", "kept {}", 2);
+    log.debug("test", "filtered");
+    let compiled_in = Severity::Debug >= STATIC_MIN_SEVERITY;
+    assert_eq!(
+        count.load(Ordering::SeqCst),
+        if compiled_in { 3 } else { 2 }
+    );
+
+    assert!(log.severity_enabled(Severity::Debug));
+    assert!(log.set_context_severity("chatty", None));
+    assert!(!log.severity_enabled(Severity::Debug));
+}
+
+#[test]
+fn test_file_receiver_batches_and_rotates() {
+    let directory = std::env::temp_dir().join(format!("timberwolf-log-{}", std::process::id()));
+    let _ = std::fs::remove_dir_all(&directory);
+    std::fs::create_dir_all(&directory).expect("failed to create test directory");
+    let path = directory.join("game.log");
+    let time = DateTime::parse_from_rfc3339("2019-01-29T21:09:30+00:00").expect("bad time");
+    let line_length = format_event(&Event::with_time(time, Severity::Info, "test", "x")).len();
+
+    let mut receiver = FileReceiverBuilder::new(&path)
+        .with_buffer_capacity(line_length * 4)
+        .with_flush_interval(std::time::Duration::from_secs(3600))
+        .with_rotation(Rotation::Size(line_length as u64 * 6))
+        .build()
+        .expect("failed to open log file");
+    let file_length = |path: &std::path::Path| std::fs::metadata(path).map_or(0, |m| m.len());
+
+    for _ in 0..3 {
+        receiver.notify(&Event::with_time(time, Severity::Info, "test", "x"));
+    }
+    assert_eq!(file_length(&path), 0);
+    receiver.notify(&Event::with_time(time, Severity::Info, "test", "x"));
+    assert_eq!(file_length(&path), line_length as u64 * 4);
+    receiver.notify(&Event::with_time(time, Severity::Error, "test", "x"));
+    assert_eq!(file_length(&path), line_length as u64 * 5);
+
+    for _ in 0..2 {
+        receiver.notify(&Event::with_time(time, Severity::Info, "test", "x"));
+    }
+    receiver.flush();
+    assert_eq!(file_length(&path), line_length as u64 * 2);
+    let rotated = std::fs::read_dir(&directory)
+        .expect("failed to read test directory")
+        .count();
+    assert_eq!(rotated, 2);
+    // files rotated by size are named after the date of the events being written
+    assert_eq!(
+        file_length(&directory.join("game.2019-01-29.1.log")),
+        line_length as u64 * 5
+    );
+    drop(receiver);
+
+    // a reopened file keeps the date it was last written on, for daily rotation
+    let yesterday = std::time::UNIX_EPOCH + std::time::Duration::from_secs(1_548_712_800);
+    std::fs::OpenOptions::new()
+        .append(true)
+        .open(&path)
+        .and_then(|file| file.set_modified(yesterday))
+        .expect("failed to set the log file's modification time");
+    let mut receiver = FileReceiverBuilder::new(&path)
+        .with_rotation(Rotation::Daily)
+        .build()
+        .expect("failed to open log file");
+    receiver.notify(&Event::with_time(time, Severity::Info, "test", "x"));
+    receiver.flush();
+    assert_eq!(
+        file_length(&directory.join("game.2019-01-28.1.log")),
+        line_length as u64 * 2
+    );
+    assert_eq!(file_length(&path), line_length as u64);
+
+    drop(receiver);
+    let _ = std::fs::remove_dir_all(&directory);
+}
+
+#[test]
+fn test_binary_log_round_trip() {
+    let time = DateTime::parse_from_rfc3339("2019-01-29T21:09:30+00:00").expect("bad time");
+    let later = DateTime::parse_from_rfc3339("2019-01-29T21:09:31.5+00:00").expect("bad time");
+    let events = vec![
+        Event::with_time(time, Severity::Debug, "test", "this is a test message"),
+        Event::with_time(
+            later,
+            Severity::Warning,
+            "binary",
+            Message::template(
+                "{} {} {} {} {} {}",
+                &[
+                    Argument::from(-3i32),
+                    Argument::from(7u64),
+                    Argument::from(0.25),
+                    Argument::from(true),
+                    Argument::from('x'),
+                    Argument::from("str"),
+                ],
+            ),
+        ),
+        Event::with_time(
+            time,
+            Severity::Fatal,
+            "test",
+            "going back in time".to_owned(),
+        ),
+    ];
+
+    let mut bytes = Vec::new();
+    {
+        let mut receiver = BinaryReceiver::new(&mut bytes).expect("failed to write header");
+        for event in events.iter() {
+            receiver.notify(event);
+        }
+    }
+    let decoded = Decoder::new(&bytes)
+        .expect("failed to read header")
+        .map(|record| format_event(&record.expect("failed to decode").to_event()))
+        .collect::<Vec<_>>();
+    let expected = events.iter().map(format_event).collect::<Vec<_>>();
+    assert_eq!(decoded, expected);
+
+    assert_eq!(
+        Decoder::new(&bytes[..bytes.len() - 1])
+            .expect("failed to read header")
+            .last(),
+        Some(Err(DecodeError::Truncated))
+    );
+
+    // a definition with an id beyond the next one is rejected rather than allocated
+    let mut corrupt = MAGIC.to_vec();
+    corrupt.extend_from_slice(&[VERSION, 0, 1, 0xff, 0xff, 0xff, 0xff, 0x0f, 1, b'x']);
+    assert_eq!(
+        Decoder::new(&corrupt)
+            .expect("failed to read header")
+            .next(),
+        Some(Err(DecodeError::Malformed))
+    );
+}
+
+#[test]
+fn test_timestamp_round_trips_through_utc() {
+    let time = DateTime::parse_from_rfc3339("2019-01-29T21:09:30.123456789+00:00")
+        .expect("bad time")
+        .with_timezone(&Utc);
+    assert_eq!(Timestamp::from_utc(&time).to_utc(), time);
+
+    let first = Timestamp::now();
+    let second = Timestamp::now();
+    assert!(second >= first);
+}
+
+/// a receiver that records the context and ticks of the events it was notified of
+struct TimeRecordingReceiver {
+    events: Arc<std::sync::Mutex<Vec<(ContextId, i64)>>>,
+}
+impl Receiver for TimeRecordingReceiver {
+    fn notify(&mut self, event: &Event) {
+        self.events
+            .lock()
+            .expect("poisoned")
+            .push((event.context, event.time.ticks()));
+    }
+}
+
+/// a receiver that blocks on the first event it is notified of until it is released
+struct GateReceiver {
+    gate: Option<std::sync::Mutex<std::sync::mpsc::Receiver<()>>>,
+}
+impl Receiver for GateReceiver {
+    fn notify(&mut self, _event: &Event) {
+        if let Some(gate) = self.gate.take() {
+            let gate = gate.into_inner().expect("poisoned");
+            let _ = gate.recv();
+        }
+    }
+}
+
+#[test]
+fn test_async_log_merges_threads_in_order() {
+    let events = Arc::new(std::sync::Mutex::new(Vec::new()));
+    let log = Arc::new(Log::new_async(4096, OverflowPolicy::Block));
+    let (release, gate) = std::sync::mpsc::channel();
+    log.add_receiver(Box::new(GateReceiver {
+        gate: Some(std::sync::Mutex::new(gate)),
+    }));
+    log.add_receiver(Box::new(TimeRecordingReceiver {
+        events: events.clone(),
+    }));
+    // hold the writer thread up, so that every thread's events are queued before it merges them
+    log.info("test", "gate");
+    let contexts = ["thread 0", "thread 1", "thread 2", "thread 3"];
+    let threads = contexts
+        .iter()
+        .map(|context| {
+            let log = log.clone();
+            let context = ContextId::intern(context);
+            std::thread::spawn(move || {
+                log.register_thread();
+                for _ in 0..500 {
+                    log.info(context, "this is a test message");
+                }
+            })
+        })
+        .collect::<Vec<_>>();
+    for thread in threads {
+        thread.join().expect("logging thread panicked");
+    }
+    release.send(()).expect("gate is gone");
+    log.flush();
+
+    let events = events.lock().expect("poisoned");
+    assert_eq!(events.len(), 2001);
+    assert!(events.windows(2).all(|pair| pair[0].1 <= pair[1].1));
+    for context in contexts.iter() {
+        let context = ContextId::intern(context);
+        let count = events
+            .iter()
+            .filter(|(event_context, _)| *event_context == context)
+            .count();
+        assert_eq!(count, 500);
+    }
+}
+
+#[test]
+fn test_async_log_keeps_buffers_registered_while_threads_exit() {
+    let count = Arc::new(AtomicUsize::new(0));
+    let log = Arc::new(Log::new_async(16, OverflowPolicy::Block));
+    log.add_receiver(Box::new(CountingReceiver {
+        count: count.clone(),
+    }));
+    for _ in 0..50 {
+        let exiting = {
+            let log = log.clone();
+            std::thread::spawn(move || log.debug("test", "this thread is exiting"))
+        };
+        let (done, finished) = std::sync::mpsc::channel();
+        let registering = {
+            let log = log.clone();
+            std::thread::spawn(move || {
+                log.register_thread();
+                // more events than the buffer holds, which only get through if the writer thread
+                // still reads this thread's buffer
+                for _ in 0..100 {
+                    log.debug("test", "this thread is registering");
+                }
+                let _ = done.send(());
+            })
+        };
+        exiting.join().expect("logging thread panicked");
+        finished
+            .recv_timeout(std::time::Duration::from_secs(10))
+            .expect("logging thread is blocked on a buffer the writer has forgotten");
+        registering.join().expect("logging thread panicked");
+    }
+    log.flush();
+    assert_eq!(count.load(Ordering::SeqCst), 50 * 101);
+}
+
+#[test]
+fn test_ring_receiver_keeps_newest_events() {
+    let path = std::env::temp_dir().join(format!("timberwolf-ring-{}.log", std::process::id()));
+    let ring = RingReceiver::new(3).with_dump_path(&path);
+    let log = Log::new();
+    log.add_receiver(Box::new(ring.clone()));
+    let messages = ["zero", "one", "two", "three", "four"];
+    for (i, message) in messages.iter().enumerate() {
+        let severity = if i % 2 == 0 {
+            Severity::Info
+        } else {
+            Severity::Warning
+        };
+        log.now(severity, "ring", message.to_string());
+    }
+
+    let snapshot = ring.snapshot();
+    let snapshot = snapshot
+        .iter()
+        .map(|event| event.message.to_string())
+        .collect::<Vec<_>>();
+    assert_eq!(snapshot, vec!["two", "three", "four"]);
+    let warnings = ring.query(Severity::Warning, Some(ContextId::intern("ring")), 10);
+    assert_eq!(warnings.len(), 1);
+    assert_eq!(warnings[0].message, Message::Owned("three".to_owned()));
+    assert!(!path.exists());
+
+    log.fatal("ring", "five");
+    let dumped = std::fs::read_to_string(&path).expect("ring was not dumped");
+    assert_eq!(dumped.lines().count(), 3);
+    assert!(dumped.ends_with(": five\n"));
+    let _ = std::fs::remove_file(&path);
+}
+
+/// a writer which holds up whoever writes to it, after signalling that it has been reached
+struct SlowWriter {
+    reached: std::sync::mpsc::Sender<()>,
+    delay: std::time::Duration,
+}
+impl std::io::Write for SlowWriter {
+    fn write(&mut self, buffer: &[u8]) -> std::io::Result<usize> {
+        let _ = self.reached.send(());
+        std::thread::sleep(self.delay);
+        Ok(buffer.len())
+    }
+
+    fn flush(&mut self) -> std::io::Result<()> {
+        Ok(())
+    }
+}
+
+#[test]
+fn test_ring_receiver_dumps_on_panic_while_locked() {
+    let path =
+        std::env::temp_dir().join(format!("timberwolf-ring-locked-{}.log", std::process::id()));
+    let ring = RingReceiver::new(3).with_dump_path(&path);
+    let log = Log::new();
+    log.add_receiver(Box::new(ring.clone()));
+    log.info("ring", "kept");
+
+    // a brief hold is waited out, and a long one skips the ring with a note
+    for &(delay, lines) in [(1, 2), (200, 2)].iter() {
+        let (reached, wait) = std::sync::mpsc::channel();
+        let holder = {
+            let ring = ring.clone();
+            std::thread::spawn(move || {
+                let mut writer = SlowWriter {
+                    reached,
+                    delay: std::time::Duration::from_millis(delay),
+                };
+                let _ = ring.write_to(&mut writer);
+            })
+        };
+        wait.recv().expect("ring was not written");
+        ring.record_and_dump_on_panic(&Event::now(Severity::Fatal, "panic", "panicked"));
+        holder.join().expect("writing thread panicked");
+
+        let dumped = std::fs::read_to_string(&path).expect("ring was not dumped");
+        assert_eq!(dumped.lines().count(), lines);
+        match delay {
+            1 => assert!(dumped.contains(": kept\n")),
+            _ => assert!(dumped.ends_with("skipped, as it was locked)\n")),
+        }
+        let _ = std::fs::remove_file(&path);
+    }
+}
+
+#[test]
+fn test_rate_limit_reports_suppressed_events() {
+    let ring = RingReceiver::new(16);
+    let log = Log::new();
+    log.add_receiver(Box::new(ring.clone()));
+    assert!(log.set_rate_limit("flood", 10.0, 2));
+    for _ in 0..5 {
+        log.info("flood", "spam");
+    }
+    log.info("test", "unlimited");
+    assert_eq!(ring.len(), 3);
+
+    std::thread::sleep(std::time::Duration::from_millis(150));
+    log.info("flood", "spam");
+    let events = ring.snapshot();
+    assert_eq!(events.len(), 5);
+    assert_eq!(events[3].severity, Severity::Warning);
+    assert_eq!(
+        events[3].message.to_string(),
+        "3 events suppressed by the rate limit"
+    );
+    assert_eq!(events[4].message.to_string(), "spam");
+
+    assert!(log.clear_rate_limit("flood"));
+    for _ in 0..5 {
+        log.info("flood", "spam");
+    }
+    assert_eq!(ring.len(), 10);
+}
+
+#[test]
+fn test_deduplication_collapses_repeats() {
+    let ring = RingReceiver::new(16);
+    let log = Log::new();
+    log.set_deduplication(true);
+    log.add_receiver(Box::new(ring.clone()));
+    for _ in 0..4 {
+        log.warning("test", "same");
+    }
+    log.warning("test", "other");
+    log.warning("test", "other");
+    log.warning("test", "other");
+    log.flush();
+    let messages: Vec<String> = ring
+        .snapshot()
+        .iter()
+        .map(|event| event.message.to_string())
+        .collect();
+    assert_eq!(
+        messages,
+        [
+            "same",
+            "last message repeated 3 times",
+            "other",
+            "last message repeated 2 times"
+        ]
+    );
+
+    log.set_deduplication(false);
+    log.warning("test", "other");
+    log.warning("test", "other");
+    assert_eq!(ring.len(), 6);
+}
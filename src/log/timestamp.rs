@@ -0,0 +1,87 @@
+//! cheap monotonic timestamps for log events, converted to calendar time only when displayed
+
+use chrono::{DateTime, Duration, Utc};
+use std::sync::OnceLock;
+use std::time::Instant;
+
+/// a reading of the monotonic and wall clocks taken together, once per process
+struct Anchor {
+    instant: Instant,
+    time: DateTime<Utc>,
+    nanoseconds: i64,
+}
+
+fn anchor() -> &'static Anchor {
+    static ANCHOR: OnceLock<Anchor> = OnceLock::new();
+    ANCHOR.get_or_init(|| {
+        let time = Utc::now();
+        Anchor {
+            instant: Instant::now(),
+            time,
+            nanoseconds: unix_nanoseconds(&time),
+        }
+    })
+}
+
+/// the number of nanoseconds between the Unix epoch and a UTC date and time
+pub fn unix_nanoseconds(time: &DateTime<Utc>) -> i64 {
+    time.timestamp() * 1_000_000_000 + i64::from(time.timestamp_subsec_nanos())
+}
+
+/// a point in time, stored as the monotonic nanoseconds elapsed since the process-wide anchor
+///
+/// Reading the current timestamp costs one monotonic clock read (no calendar arithmetic, and no
+/// system call on platforms with a vDSO clock). Wall-clock time is reconstructed from the anchor
+/// only when a receiver needs it, so it does not follow wall-clock adjustments made while the
+/// process is running.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub struct Timestamp(i64);
+impl Timestamp {
+    /// take the anchor reading now, if it has not been taken yet, so that it is not taken later
+    /// on a hot path
+    pub fn calibrate() {
+        anchor();
+    }
+
+    /// the current time
+    #[inline]
+    pub fn now() -> Self {
+        let anchor = anchor();
+        Timestamp(Instant::now().duration_since(anchor.instant).as_nanos() as i64)
+    }
+
+    /// create a timestamp from a monotonic clock reading (e.g. the time the current frame began,
+    /// to avoid reading the clock again)
+    pub fn from_instant(instant: Instant) -> Self {
+        let anchor = anchor();
+        match instant.checked_duration_since(anchor.instant) {
+            Some(since) => Timestamp(since.as_nanos() as i64),
+            None => Timestamp(-(anchor.instant.duration_since(instant).as_nanos() as i64)),
+        }
+    }
+
+    /// create a timestamp from a raw tick count, as given by `ticks`
+    pub fn from_ticks(ticks: i64) -> Self {
+        Timestamp(ticks)
+    }
+
+    /// create a timestamp from a UTC date and time
+    pub fn from_utc(time: &DateTime<Utc>) -> Self {
+        Timestamp(unix_nanoseconds(time) - anchor().nanoseconds)
+    }
+
+    /// the raw tick count: nanoseconds since the process-wide anchor (negative if before it)
+    pub fn ticks(self) -> i64 {
+        self.0
+    }
+
+    /// the number of nanoseconds between the Unix epoch and this timestamp
+    pub fn unix_nanoseconds(self) -> i64 {
+        anchor().nanoseconds + self.0
+    }
+
+    /// convert to a UTC date and time
+    pub fn to_utc(self) -> DateTime<Utc> {
+        anchor().time + Duration::nanoseconds(self.0)
+    }
+}